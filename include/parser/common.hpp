@@ -2,7 +2,11 @@
 
 #include <cstdint>
 #include <string>
+#ifdef _WIN32
 #include <winsock2.h> // for host to network conversion
+#else
+#include <arpa/inet.h> // for host to network conversion
+#endif
 
 
 namespace DNS {
@@ -121,11 +125,13 @@ namespace DNS {
     namespace Port {
         constexpr uint16_t DNS     = 53;
         constexpr uint16_t DNS_TLS = 853;  // DNS over TLS (DoT)
+        constexpr uint16_t HTTPS   = 443;  // DNS over HTTPS (DoH)
     }
 
     namespace Limits {
         constexpr size_t   MAX_UDP_PACKET    = 512;   // Classic DNS max UDP
         constexpr size_t   MAX_EDNS_PAYLOAD  = 4096;  // EDNS0 extended UDP
+        constexpr uint16_t SAFE_EDNS_PAYLOAD = 1232;  // Fits any IPv6 path unfragmented (DNS Flag Day 2020)
         constexpr size_t   MAX_LABEL_LEN     = 63;    // Max single label length
         constexpr size_t   MAX_NAME_LEN      = 255;   // Max full domain name
         constexpr uint8_t  COMPRESSION_MASK  = 0xC0;  // Top 2 bits = pointer
@@ -160,11 +166,16 @@ namespace DNS {
         SERVER_RECV_FAIL    = 32,   // recvfrom() returned error
         SERVER_SEND_FAIL    = 33,   // sendto() returned error
         SERVER_NOT_RUNNING  = 34,   // operation called before run()
+        SERVER_WOULD_BLOCK  = 35,   // non-blocking socket has nothing queued
+        SERVER_TLS_FAIL     = 36,   // DNS over HTTPS certificate or key could not be loaded
 
         // ── Upstream / forwarding errors ─────────────────────────────────────
         UPSTREAM_TIMEOUT    = 40,   // upstream did not respond in time
         UPSTREAM_UNREACHABLE= 41,   // could not reach upstream resolver
+        UPSTREAM_BUSY       = 42,   // every upstream transaction ID is in flight
         UPSTREAM_SERVFAIL   = 43,   // upstream returned SERVFAIL
+        UPSTREAM_CIRCUIT_OPEN = 44, // every upstream's circuit breaker is open
+        UPSTREAM_TLS_FAIL   = 45,   // DNS over TLS unavailable or misconfigured (CA file)
 
         // ── Cache errors ─────────────────────────────────────────────────────
         CACHE_MISS          = 50,   // key not found in cache
@@ -202,9 +213,14 @@ namespace DNS {
             case Error::SERVER_RECV_FAIL:      return "recvfrom() failed";
             case Error::SERVER_SEND_FAIL:      return "sendto() failed";
             case Error::SERVER_NOT_RUNNING:    return "Server not running";
+            case Error::SERVER_WOULD_BLOCK:    return "No datagram pending";
+            case Error::SERVER_TLS_FAIL:       return "TLS certificate or key could not be loaded";
             case Error::UPSTREAM_TIMEOUT:      return "Upstream timeout";
             case Error::UPSTREAM_UNREACHABLE:  return "Upstream unreachable";
+            case Error::UPSTREAM_BUSY:         return "Too many queries in flight";
             case Error::UPSTREAM_SERVFAIL:     return "Upstream SERVFAIL";
+            case Error::UPSTREAM_CIRCUIT_OPEN: return "Every upstream circuit is open";
+            case Error::UPSTREAM_TLS_FAIL:     return "DNS over TLS unavailable or misconfigured";
             case Error::CACHE_MISS:            return "Cache miss";
             case Error::CACHE_EXPIRED:         return "Cache entry expired";
             case Error::CACHE_FULL:            return "Cache full";
@@ -0,0 +1,85 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+#include "platform.hpp"
+#include "pool.hpp"
+#if defined(__linux__)
+#include <sys/uio.h> // iovec
+#endif
+
+namespace DNS::Server {
+
+    /*
+     *  A fixed set of datagram slots that can be filled or flushed with one syscall.
+     *
+     *      recv(s)  → recvmmsg(): drains up to capacity() datagrams in a single call
+     *      push()   → queues one outgoing datagram (payload + destination)
+     *      send(s)  → sendmmsg(): flushes every queued datagram in a single call
+     *
+     *  Every slot owns MAX_EDNS_PAYLOAD cache-line-aligned bytes of one PacketPool made
+     *  once in reset(), so the hot path never allocates. On platforms without
+     *  recvmmsg/sendmmsg the same interface falls back to a recvfrom/sendto loop.
+     *
+     *  Slot i after recv():
+     *      data(i)    → payload (mutable, so the caller may rewrite the ID in place)
+     *      length(i)  → payload size in bytes
+     *      addr(i)    → sender address
+     */
+    class DatagramBatch {
+    public:
+        // Upper bound on slots: each holds a full EDNS-sized datagram (4 KiB), so this caps a
+        // batch at 1 MiB, and stays well within recvmmsg()/sendmmsg()'s UIO_MAXIOV (1024).
+        static constexpr size_t MAX_CAPACITY = 256;
+
+        /**
+         * @brief (Re)allocates the batch with @p capacity slots (clamped to [1, MAX_CAPACITY]) and clears it.
+         */
+        void reset(size_t capacity);
+
+        /**
+         * @brief Receives as many datagrams as are queued on @p s, up to capacity(). Never blocks.
+         *
+         * @return number of datagrams received, 0 if nothing was queued, or -1 on error (see Platform::lastError()).
+         */
+        int recv(Platform::socket_t s) noexcept;
+
+        /**
+         * @brief Sends every queued datagram on @p s and clears the batch.
+         *
+         * @return number of datagrams handed to the kernel, or -1 if the first send failed.
+         *         A short count means the socket buffer filled up; the rest are dropped (UDP semantics).
+         */
+        int send(Platform::socket_t s) noexcept;
+
+        /**
+         * @brief Copies a datagram into the next free slot.
+         * @return false if the batch is full or @p len exceeds MAX_EDNS_PAYLOAD.
+         */
+        bool push(const uint8_t *data, size_t len, const sockaddr_storage &to) noexcept;
+
+        void clear() noexcept { count_ = 0; }
+
+        size_t size()     const noexcept { return count_; }
+        size_t capacity() const noexcept { return lens_.size(); }
+
+        uint8_t           *data(size_t i)         noexcept;
+        size_t             length(size_t i) const noexcept { return lens_[i]; }
+        const sockaddr_storage &addr(size_t i) const noexcept { return addrs_[i]; }
+
+    private:
+        PacketPool               storage_;      // slot i is batch slot i; its free list goes unused
+        std::vector<size_t>      lens_;
+        std::vector<sockaddr_storage> addrs_;
+        size_t                   count_ { 0 };
+#if defined(__linux__)
+        std::vector<mmsghdr>     hdrs_;
+        std::vector<iovec>       iov_;
+
+        // Points every header at its slot; called before each syscall because recv overwrites lengths.
+        void prepare(size_t n, bool forRecv) noexcept;
+#endif
+    };
+
+} // namespace DNS::Server
@@ -0,0 +1,132 @@
+#pragma once
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <utility>
+#include <vector>
+
+namespace DNS::Server {
+
+    /*
+     *  Coroutine frames of one worker, carved from chunks that are kept and reused.
+     *
+     *      allocate(n) → a frame of n bytes; from the free list if it fits a slot
+     *      release(p)  → back onto the free list of the pool it came from
+     *
+     *  Every frame is preceded by a header naming its pool, so a frame can be released
+     *  without knowing where it came from. Frames larger than a slot come from the heap.
+     *  Not thread-safe: each worker owns its own pool.
+     */
+    class FramePool {
+    public:
+        static constexpr size_t SLOT_SIZE   = 1024;  // header included; resolve() takes ~700
+        static constexpr size_t CHUNK_SLOTS = 256;
+
+        /**
+         * @brief A frame of @p n bytes, owned by this pool (or the heap if it is too large).
+         */
+        void *allocate(size_t n);
+
+        /**
+         * @brief A frame of @p n bytes straight from the heap, for coroutines without a pool.
+         */
+        static void *allocateUnpooled(size_t n);
+
+        /**
+         * @brief Returns frame @p p, as handed out by any pool's allocate(), to where it came from.
+         */
+        static void release(void *p) noexcept;
+
+        size_t slots() const noexcept { return chunks_.size() * CHUNK_SLOTS; }
+
+    private:
+        struct alignas(std::max_align_t) Header {
+            FramePool *pool;                // nullptr = heap
+        };
+        struct Free {
+            Free *next;
+        };
+
+        std::vector<std::unique_ptr<std::byte[]>> chunks_;
+        Free                                     *free_ { nullptr };
+    };
+
+    /*
+     *  Base of an object whose member coroutines take their frames from its own FramePool
+     *  (see Task). May be a private base: the frame is allocated inside the member itself.
+     */
+    class FrameOwner {
+    public:
+        FramePool &frames() noexcept { return frames_; }
+
+    private:
+        FramePool frames_;
+    };
+
+    /*
+     *  The return type of a fire-and-forget coroutine.
+     *
+     *  It starts running as soon as it is called, up to its first co_await, and frees
+     *  itself when it returns; nobody waits for it. A member function coroutine of a
+     *  FrameOwner takes its frame from the owner's pool, any other coroutine from the heap:
+     *
+     *      Task Listener::resolve(...) { ...; const auto r = co_await pending; ... }
+     */
+    class Task {
+    public:
+        struct promise_type {
+            Task get_return_object() noexcept { return {}; }
+            std::suspend_never initial_suspend() noexcept { return {}; }
+            std::suspend_never final_suspend()   noexcept { return {}; }
+            void return_void() noexcept {}
+            void unhandled_exception() noexcept { std::terminate(); }
+
+            // The coroutine's arguments follow the owner; they are ignored, and taking them as
+            // C varargs keeps this a plain function GCC can pair with the deletes below
+            // (a template here trips -Wmismatched-new-delete). They must be trivially copyable.
+            static void *operator new(size_t n, FrameOwner &owner, ...) { return owner.frames().allocate(n); }
+            static void *operator new(size_t n) { return FramePool::allocateUnpooled(n); }
+
+            // Either way the frame goes back through release(), which knows where it came from.
+            static void operator delete(void *p, FrameOwner &, ...) noexcept { FramePool::release(p); }
+            static void operator delete(void *p, size_t) noexcept { FramePool::release(p); }
+        };
+    };
+
+    /*
+     *  A value some later event delivers to a suspended coroutine.
+     *
+     *      co_await pending  → suspends until resume() (or cancel()) is called
+     *      resume(v)         → hands @p v over and runs the coroutine to its next co_await
+     *      cancel()          → destroys the suspended coroutine instead
+     *
+     *  The Pending lives in the waiting coroutine's frame, so it is gone once resume()
+     *  returns if the coroutine finished.
+     */
+    template <typename T>
+    class Pending {
+    public:
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(std::coroutine_handle<> h) noexcept { handle_ = h; }
+        T    await_resume() noexcept { return std::move(value_); }
+
+        void resume(T value) noexcept {
+            value_ = std::move(value);
+            std::exchange(handle_, {}).resume();
+        }
+
+        void cancel() noexcept {
+            if (handle_)
+                std::exchange(handle_, {}).destroy();
+        }
+
+        bool waiting() const noexcept { return static_cast<bool>(handle_); }
+
+    private:
+        std::coroutine_handle<> handle_;
+        T                       value_ {};
+    };
+
+} // namespace DNS::Server
@@ -0,0 +1,351 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "platform.hpp"
+#include "tcp.hpp"
+#include "tls.hpp"
+#include "http2.hpp"
+
+namespace DNS::Server {
+
+    /**
+     * @brief One HTTP/2 stream, i.e. one DoH request and its response.
+     *
+     * @param body       What the peer sends on it: the query (server side: a POST body as it
+     *                   arrives, or the decoded ?dns= of a GET) or the answer (client side).
+     * @param out        What we send on it: the answer (server) or the query (client);
+     *                   outOff of it is already framed, the rest waits for flow-control window.
+     * @param sendWindow What the peer's window for this stream still admits, in bytes.
+     * @param id         Client side: the upstream ID of the query.
+     * @param status     Client side: the response's :status.
+     * @param receiving  The peer has not ended its side of the stream yet.
+     * @param dispatched Server side: the query was handed on; the stream waits for its answer.
+     */
+    struct DohStream {
+        std::vector<uint8_t> body;
+        std::vector<uint8_t> out;
+        size_t               outOff     { 0 };
+        int64_t              sendWindow { Http2::DEFAULT_WINDOW };
+        uint16_t             id         { 0 };
+        uint16_t             status     { 0 };
+        bool                 receiving  { false };
+        bool                 dispatched { false };
+    };
+
+    /**
+     * @brief One end of an HTTP/2 connection over TLS, as both DoH sides keep it.
+     *
+     * @param tls          The TLS session; handshaking until its handshake completes.
+     * @param goaway       The peer sent GOAWAY: no new streams on this connection.
+     * @param hpack        Decoding context of the peer's header blocks.
+     * @param streams      Open streams by ID.
+     * @param headerBlock  HEADERS + CONTINUATION fragments of headerStream collected so far.
+     * @param lastStream   Server side: highest stream ID the client opened.
+     * @param goawayLast   The last of our streams the peer's GOAWAY promised to process.
+     * @param sendWindow   Connection-level window for our DATA; peerWindow / peerMaxFrame /
+     *                     peerMaxStreams are the peer's SETTINGS_INITIAL_WINDOW_SIZE /
+     *                     SETTINGS_MAX_FRAME_SIZE / SETTINGS_MAX_CONCURRENT_STREAMS.
+     * @param unacked      DATA bytes received and not yet handed back with WINDOW_UPDATE.
+     * @param blocked      Streams whose DATA waits for window.
+     */
+    struct Http2Session : TcpStream {
+        ssl_st              *tls { nullptr };
+        bool                 handshaking { false };
+        bool                 goaway { false };
+        Http2::HpackDecoder  hpack;
+        std::unordered_map<uint32_t, DohStream> streams;
+        std::vector<uint8_t> headerBlock;
+        uint32_t             headerStream   { 0 };
+        uint8_t              headerFlags    { 0 };
+        uint32_t             lastStream     { 0 };
+        uint32_t             goawayLast     { 0 };
+        int64_t              sendWindow     { Http2::DEFAULT_WINDOW };
+        uint32_t             peerWindow     { Http2::DEFAULT_WINDOW };
+        uint32_t             peerMaxFrame   { Http2::DEFAULT_MAX_FRAME };
+        // RFC 9113 section 6.5.2 recommends at least 100 until the peer says otherwise.
+        uint32_t             peerMaxStreams { 100 };
+        uint32_t             unacked        { 0 };
+        std::vector<uint32_t> blocked;
+    };
+
+    /**
+     * @brief One DNS-over-HTTPS client connection.
+     *
+     * @param peer    Client address, for logging and the blocklist log lines.
+     * @param token   Handle that in-flight queries carry back to this connection.
+     * @param pending Queries of this connection still waiting for the upstream.
+     * @param preface The client's connection preface arrived.
+     */
+    struct DohConnection : Http2Session {
+        sockaddr_storage     peer {};
+        uint32_t             token   { 0 };
+        uint32_t             pending { 0 };
+        bool                 preface { false };
+    };
+
+    /*
+     *  The DNS-over-HTTPS clients of one worker (RFC 8484 over HTTP/2, RFC 9113).
+     *
+     *      accept(..)   → takes every pending connection off the listening socket and starts
+     *                     its TLS handshake
+     *      read(..)     → moves a connection along (handshake, frames, flow control, pending
+     *                     writes) and hands on the query of every request that completed
+     *      respond(..)  → answers a stream with 200 and an application/dns-message body
+     *      reject(..)   → answers a stream with an HTTP error status and no body
+     *      find(token)  → the connection an answer belongs to, or nullptr if it closed since
+     *      closeIdle()  → drops connections idle for longer than IDLE_TIMEOUT
+     *
+     *  Every request is its own stream, so one connection carries up to MAX_STREAMS queries
+     *  at once and answers go out in whatever order they complete. Accepted are
+     *  "POST /dns-query" with an application/dns-message body and "GET /dns-query?dns=" with
+     *  the query in base64url. Responses respect the client's flow-control windows; what does
+     *  not fit waits for its WINDOW_UPDATE. Received DATA is handed back to the client's
+     *  connection window as it is consumed; per stream a query never exceeds the initial
+     *  65535-byte window, so stream windows need no updates.
+     *  Tokens have TOKEN_TAG set, so they never collide with TcpConnections tokens and one
+     *  field of an in-flight entry can hold either. Not thread-safe: each worker owns its own set.
+     */
+    class DohConnections {
+    public:
+        using clock = std::chrono::steady_clock;
+
+        static constexpr size_t   MAX_CONNECTIONS = 1024;
+        static constexpr uint32_t MAX_STREAMS     = 256;
+        // Browsers keep a DoH connection open across page loads.
+        static constexpr auto     IDLE_TIMEOUT    = std::chrono::seconds(30);
+        static constexpr size_t   MAX_BACKLOG     = 256 * 1024;
+        static constexpr uint32_t TOKEN_TAG       = 0x80000000;
+
+        /**
+         * @brief Whether @p token is a DohConnections token (as opposed to a TcpConnections one).
+         */
+        static bool owns(uint32_t token) noexcept { return (token & TOKEN_TAG) != 0; }
+
+        /**
+         * @brief Sets the TLS context connections are accepted with (must outlive the set).
+         */
+        void init(TlsServer *tls) noexcept { tls_ = tls; }
+
+        void attach(Platform::Poller *poller) noexcept { poller_ = poller; }
+
+        /**
+         * @brief Accepts every connection queued on @p listener (closing any beyond MAX_CONNECTIONS).
+         * @return number of connections accepted.
+         */
+        size_t accept(Platform::socket_t listener) noexcept;
+
+        /**
+         * @brief Services connection @p s after the Poller reported it readable or writable and
+         *        calls @p onQuery(DohConnection&, uint32_t stream, uint8_t *msg, size_t len)
+         *        for every request that completed. Closes the connection on EOF, error or an
+         *        HTTP/2 protocol violation.
+         * @return false if @p s is not one of these connections.
+         */
+        template <typename Fn>
+        bool read(Platform::socket_t s, Fn &&onQuery) {
+            const auto it = bySocket_.find(s);
+            if (it == bySocket_.end())
+                return false;
+            DohConnection &c = slots_[it->second];
+            ready_.clear();
+            if (!process(c)) {
+                close(c);
+                return true;
+            }
+            for (const uint32_t id : ready_) {
+                const auto st = c.streams.find(id);
+                if (st == c.streams.end())
+                    continue;
+                st->second.dispatched = true;
+                // The handler may answer (and so drop) the stream straight away.
+                query_ = std::move(st->second.body);
+                onQuery(c, id, query_.data(), query_.size());
+                if (c.sock == Platform::INVALID_SOCK)
+                    return true;
+            }
+            // Statuses from reject() are only queued.
+            if (!ready_.empty() && !c.stalled && !Tls::write(c.tls, c, poller_))
+                close(c);
+            return true;
+        }
+
+        /**
+         * @brief Answers @p stream of connection @p c with @p msg (status 200).
+         * @return false if the stream or connection is gone, or the connection was closed now
+         *         because its backlog would exceed MAX_BACKLOG.
+         */
+        bool respond(DohConnection &c, uint32_t stream, const uint8_t *msg, size_t len) noexcept;
+
+        /**
+         * @brief Answers @p stream of connection @p c with HTTP status @p status and no body.
+         */
+        void reject(DohConnection &c, uint32_t stream, uint16_t status) noexcept;
+
+        DohConnection *find(uint32_t token) noexcept;
+
+        /**
+         * @brief Closes every connection idle for IDLE_TIMEOUT (or told to go away) with
+         *        nothing pending.
+         */
+        void closeIdle(clock::time_point now) noexcept;
+
+        void close(DohConnection &c) noexcept;
+        void closeAll() noexcept;
+
+        size_t size() const noexcept { return bySocket_.size(); }
+
+    private:
+        std::vector<DohConnection>  slots_;
+        std::vector<uint16_t>       generations_;
+        std::vector<uint32_t>       free_;
+        std::unordered_map<Platform::socket_t, uint32_t> bySocket_;
+        Platform::Poller           *poller_ { nullptr };
+        TlsServer                  *tls_    { nullptr };
+        std::vector<uint32_t>       ready_;     // streams whose query completed in process()
+        std::vector<uint8_t>        query_;     // the query handed to onQuery
+        std::vector<Http2::Header>  headers_;   // scratch for decoded header blocks
+
+        // Reads, handles every complete frame and writes; false = close the connection.
+        bool process(DohConnection &c) noexcept;
+        // A request's header block arrived; returns an HTTP/2 error code, 0 = fine.
+        uint32_t request(DohConnection &c, uint32_t stream, uint8_t flags) noexcept;
+    };
+
+    /**
+     * @brief The HTTP/2 connection to one DoH resolver.
+     *
+     * @param connecting The non-blocking connect has not completed yet.
+     * @param nextStream ID the next request's stream gets (odd, rising).
+     * @param queued     Queries (upstream ID, message) waiting for the handshake or for a
+     *                   stream, once peerMaxStreams are open.
+     * @param answered   Answers received on this connection.
+     */
+    struct DohUpstream : Http2Session {
+        bool                 connecting { false };
+        uint32_t             nextStream { 1 };
+        std::deque<std::pair<uint16_t, std::vector<uint8_t>>> queued;
+        uint64_t             answered   { 0 };
+    };
+
+    /*
+     *  Persistent HTTP/2 connections to DNS-over-HTTPS resolvers (RFC 8484), one per
+     *  resolver and worker, multiplexing every query in flight to it.
+     *
+     *      send(i, ..)   → queues a query for resolver i, connecting first if needed
+     *      read(s, fn)   → handles a readable connection, fn(upstream, msg, len) per answer
+     *      flush(s)      → completes a pending connect and handshake and writes the backlog
+     *      takeOrphans() → queries stranded on a connection that closed or went away
+     *      closeIdle()   → closes connections idle for IDLE_TIMEOUT with nothing waiting
+     *
+     *  Every query is a "POST /dns-query" on its own stream, up to the resolver's
+     *  SETTINGS_MAX_CONCURRENT_STREAMS at once; the rest queue until a stream frees up.
+     *  Queries go out with ID 0 (RFC 8484 section 4.1, so HTTP caches can share answers);
+     *  the stream tells the answers apart and each gets its upstream ID back before it is
+     *  handed on. Both directions honour HTTP/2 flow control: request bodies wait for the
+     *  resolver's windows, and answers consumed are handed back to its connection window.
+     *  Streams refused because they were opened before the resolver's SETTINGS announced a
+     *  lower limit are queued again. After a GOAWAY the streams it covers still finish, new
+     *  queries wait, and the connection closes with its last stream. Connections close like
+     *  TcpUpstreams ones: queries stranded on a connection that had answered before, or
+     *  that the GOAWAY did not cover, come back through takeOrphans() for the next one.
+     *  TLS is the TlsClient's (ALPN "h2"), with its session resumption.
+     *  Not thread-safe: each worker owns its own set.
+     */
+    class DohUpstreams {
+    public:
+        using clock = std::chrono::steady_clock;
+
+        static constexpr auto IDLE_TIMEOUT = std::chrono::seconds(30);
+        static constexpr std::string_view PATH = "/dns-query";
+        // Queries waiting for a stream beyond this many are refused.
+        static constexpr size_t MAX_QUEUED = 1024;
+
+        /**
+         * @brief Sizes the set for @p upstreams resolvers, closing any open connection.
+         *        @p tls (which must outlive the set) offers ALPN "h2"; every request names
+         *        its resolver by the TlsClient peer's host, or its address.
+         */
+        void init(size_t upstreams, TlsClient *tls);
+
+        void attach(Platform::Poller *poller) noexcept { poller_ = poller; }
+
+        /**
+         * @brief Queues query @p msg for resolver @p upstream at @p addr under upstream ID @p id.
+         * @return false if no connection could be opened, the queue is full or the connection
+         *         failed on write.
+         */
+        bool send(uint8_t upstream, const sockaddr_storage &addr, uint16_t id, const uint8_t *msg, size_t len) noexcept;
+
+        /**
+         * @brief Handles everything queued on connection @p s and calls
+         *        @p onAnswer(uint8_t upstream, uint8_t *msg, size_t len) for each complete
+         *        answer (status 200), its ID field set back to the upstream ID.
+         * @return false if @p s is not one of these connections.
+         */
+        template <typename Fn>
+        bool read(Platform::socket_t s, Fn &&onAnswer) {
+            const auto it = bySocket_.find(s);
+            if (it == bySocket_.end())
+                return false;
+            const uint8_t upstream = it->second;
+            DohUpstream &c = streams_[upstream];
+            if (c.connecting || c.handshaking)
+                return true;
+            answers_.clear();
+            // Answers that arrived just before the resolver closed are still good.
+            const bool open = process(upstream);
+            for (auto &[id, msg] : answers_) {
+                msg[0] = static_cast<uint8_t>(id >> 8);
+                msg[1] = static_cast<uint8_t>(id & 0xFF);
+                onAnswer(upstream, msg.data(), msg.size());
+            }
+            if (!open)
+                close(upstream);
+            return true;
+        }
+
+        /**
+         * @brief Completes a pending connect (and TLS handshake) on @p s and writes its backlog.
+         * @return false if @p s is not one of these connections.
+         */
+        bool flush(Platform::socket_t s) noexcept;
+
+        /**
+         * @brief Whether query @p id is still queued or waiting for its answer on an open
+         *        connection to resolver @p upstream.
+         */
+        bool waiting(uint8_t upstream, uint16_t id) const noexcept;
+
+        void takeOrphans(std::vector<std::pair<uint8_t, uint16_t>> &out) noexcept;
+
+        void closeIdle(clock::time_point now) noexcept;
+        void closeAll() noexcept;
+
+        size_t size() const noexcept { return bySocket_.size(); }
+
+    private:
+        std::vector<DohUpstream>                         streams_;
+        std::vector<std::string>                         authorities_;
+        std::unordered_map<Platform::socket_t, uint8_t>  bySocket_;
+        std::vector<std::pair<uint8_t, uint16_t>>        orphans_;
+        std::vector<std::pair<uint16_t, std::vector<uint8_t>>> answers_;  // scratch for read()
+        std::vector<Http2::Header>                       headers_;        // scratch for process()
+        Platform::Poller                                *poller_ { nullptr };
+        TlsClient                                       *tls_ { nullptr };
+
+        bool process(uint8_t upstream) noexcept;
+        bool handshake(uint8_t upstream) noexcept;
+        // Opens a stream for every queued query the resolver's stream limit admits.
+        void start(uint8_t upstream) noexcept;
+        void close(uint8_t upstream) noexcept;
+    };
+
+} // namespace DNS::Server
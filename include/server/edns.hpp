@@ -0,0 +1,59 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <optional>
+
+#include "../parser/common.hpp"
+
+/*
+ *  EDNS0 (RFC 6891) on the wire, for the forwarding path: nothing here parses a whole
+ *  message or allocates.
+ *
+ *      findOpt(..)      → where the OPT pseudo-RR of a message is, if it has one
+ *      payloadSize(..)  → the UDP payload size a query's sender can take
+ *      clampPayload(..) → lowers the payload size a query advertises before it goes upstream
+ *      truncate(..)     → cuts an answer down to what a client takes, with TC set
+ *
+ *  The OPT record's CLASS field carries the sender's UDP payload size; without one a
+ *  client takes 512 bytes (RFC 1035 section 4.2.1), and smaller advertised sizes count
+ *  as 512 too (RFC 6891 section 6.2.5).
+ */
+namespace DNS::Server::Edns {
+
+    /**
+     * @brief Location of an OPT record: @p offset of its TYPE field (right after the root
+     *        name) and the UDP payload size in its CLASS field.
+     */
+    struct Opt {
+        size_t   offset  { 0 };
+        uint16_t payload { 0 };
+        uint32_t ttl     { 0 };     // extended RCODE, version and the DO bit
+    };
+
+    /**
+     * @brief Finds the OPT record in the additional section of @p msg.
+     * @return nothing if there is none or the message is malformed.
+     */
+    std::optional<Opt> findOpt(const uint8_t *msg, size_t len) noexcept;
+
+    /**
+     * @brief The UDP payload size the sender of query @p msg takes, in
+     *        [512, Limits::MAX_EDNS_PAYLOAD].
+     */
+    uint16_t payloadSize(const uint8_t *msg, size_t len) noexcept;
+
+    /**
+     * @brief Lowers the payload size advertised by the OPT record of @p msg to @p limit;
+     *        a query without OPT, or advertising less, is left alone.
+     */
+    void clampPayload(uint8_t *msg, size_t len, uint16_t limit) noexcept;
+
+    /**
+     * @brief Cuts answer @p msg down to header and question with TC set if it is longer than
+     *        @p limit, so the client asks again over TCP (RFC 2181 section 9). An answer that
+     *        carried an OPT record keeps one, advertising @p advertise.
+     * @return the new length: @p len if it fit, 0 if the answer cannot be cut (malformed).
+     */
+    size_t truncate(uint8_t *msg, size_t len, size_t limit, uint16_t advertise) noexcept;
+
+} // namespace DNS::Server::Edns
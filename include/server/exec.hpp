@@ -0,0 +1,433 @@
+#pragma once
+#include <atomic>
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <expected>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stop_token>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "../parser/common.hpp"
+#include "platform.hpp"
+
+/*
+ *  A small sender/receiver layer in the shape of C++26 std::execution (P2300), for
+ *  toolchains whose standard library does not ship <execution> senders yet.
+ *
+ *      schedule(s)          → a sender that completes on scheduler s
+ *      s | then(f)          → feeds s's value to f and completes with f's result
+ *      s | continues_on(t)  → completes with s's value, but on scheduler t
+ *      co_await s           → inside a coroutine: std::expected<value, DNS::Error>
+ *
+ *  A sender is any type with a value_type (void allowed) and a connect(receiver) that
+ *  returns an operation with start(). A receiver has set_value(v) (set_value() for void)
+ *  and set_error(DNS::Error); there is no stopped channel, contexts finish what they
+ *  were given before they go away.
+ *
+ *  Operations are built in place and never move, so a chain costs no allocation: the
+ *  whole of it lives in the awaiting coroutine's frame.
+ *
+ *  Schedulers are values naming a Context, picked at run time:
+ *      Scheduler{}      → inline, on whichever thread starts the work
+ *      ThreadPool       → any of a fixed set of threads, which steal work from each other
+ *      RunLoop          → one event loop's thread, the next time it drains the loop
+ */
+namespace DNS::Server::Exec {
+
+    /*
+     *  One piece of work handed to a Context. It lives inside the operation that posts it,
+     *  so posting never allocates; the Context links it into its queue through next.
+     */
+    struct Work {
+        void (*run)(Work *) noexcept { nullptr };
+        Work *next { nullptr };
+    };
+
+    /*
+     *  Where work runs. post() may be called from any thread; the Context calls
+     *  work->run(work) exactly once, on one of its own threads.
+     */
+    class Context {
+    public:
+        virtual void post(Work *work) noexcept = 0;
+
+    protected:
+        ~Context() = default;
+    };
+
+    /*
+     *  A handle on a Context, cheap to copy. The default one has no Context and runs
+     *  work inline, right where it is posted.
+     */
+    class Scheduler {
+    public:
+        Scheduler() noexcept = default;
+        explicit Scheduler(Context *context) noexcept : context_(context) {}
+
+        bool inlined() const noexcept { return context_ == nullptr; }
+
+        void post(Work *work) const noexcept {
+            if (context_)
+                context_->post(work);
+            else
+                work->run(work);
+        }
+
+        bool operator==(const Scheduler &) const noexcept = default;
+
+    private:
+        Context *context_ { nullptr };
+    };
+
+    template <typename S>
+    concept Sender = std::is_object_v<S> && requires { typename S::value_type; };
+
+    namespace detail {
+
+        // What a sender completed with, kept until it can be handed on.
+        template <typename T>
+        struct Result {
+            std::optional<std::expected<T, DNS::Error>> value;
+
+            template <typename R>
+            void deliver(R &r) noexcept {
+                if (value->has_value()) r.set_value(std::move(**value));
+                else                    r.set_error(value->error());
+            }
+        };
+
+        template <>
+        struct Result<void> {
+            std::optional<std::expected<void, DNS::Error>> value;
+
+            template <typename R>
+            void deliver(R &r) noexcept {
+                if (value->has_value()) r.set_value();
+                else                    r.set_error(value->error());
+            }
+        };
+
+        template <typename F, typename T>
+        struct Invoke { using type = std::invoke_result_t<F, T>; };
+        template <typename F>
+        struct Invoke<F, void> { using type = std::invoke_result_t<F>; };
+
+    } // namespace detail
+
+    // schedule()
+
+    class ScheduleSender {
+    public:
+        using value_type = void;
+
+        explicit ScheduleSender(Scheduler scheduler) noexcept : scheduler_(scheduler) {}
+
+        template <typename R>
+        class Operation : Work {
+        public:
+            Operation(Scheduler scheduler, R r) noexcept : scheduler_(scheduler), r_(std::move(r)) {
+                run = [](Work *w) noexcept { static_cast<Operation *>(w)->r_.set_value(); };
+            }
+            Operation(const Operation &) = delete;
+            Operation &operator=(const Operation &) = delete;
+
+            void start() noexcept { scheduler_.post(this); }
+
+        private:
+            Scheduler scheduler_;
+            R         r_;
+        };
+
+        template <typename R>
+        Operation<R> connect(R r) && noexcept { return Operation<R>(scheduler_, std::move(r)); }
+
+    private:
+        Scheduler scheduler_;
+    };
+
+    /**
+     * @brief A sender that completes, with no value, on a thread of @p scheduler.
+     */
+    inline ScheduleSender schedule(Scheduler scheduler) noexcept { return ScheduleSender(scheduler); }
+
+    // then()
+
+    template <Sender S, typename F>
+    class ThenSender {
+    public:
+        using value_type = typename detail::Invoke<F, typename S::value_type>::type;
+
+        ThenSender(S s, F f) noexcept : s_(std::move(s)), f_(std::move(f)) {}
+
+        template <typename R>
+        struct Receiver {
+            F f;
+            R r;
+
+            template <typename... V>
+            void set_value(V &&...v) noexcept {
+                if constexpr (std::is_void_v<value_type>) {
+                    f(std::forward<V>(v)...);
+                    r.set_value();
+                } else {
+                    r.set_value(f(std::forward<V>(v)...));
+                }
+            }
+            void set_error(DNS::Error e) noexcept { r.set_error(e); }
+        };
+
+        template <typename R>
+        auto connect(R r) && noexcept { return std::move(s_).connect(Receiver<R>{ std::move(f_), std::move(r) }); }
+
+    private:
+        S s_;
+        F f_;
+    };
+
+    template <typename F>
+    struct ThenClosure { F f; };
+
+    /**
+     * @brief Pipes a sender's value into @p f (which must not throw): `s | then(f)`.
+     */
+    template <typename F>
+    ThenClosure<F> then(F f) noexcept { return { std::move(f) }; }
+
+    template <Sender S, typename F>
+    ThenSender<S, F> operator|(S s, ThenClosure<F> c) noexcept { return ThenSender<S, F>(std::move(s), std::move(c.f)); }
+
+    // continues_on()
+
+    template <Sender S>
+    class ContinuesOnSender {
+    public:
+        using value_type = typename S::value_type;
+
+        ContinuesOnSender(S s, Scheduler scheduler) noexcept : s_(std::move(s)), scheduler_(scheduler) {}
+
+        template <typename R>
+        class Operation : Work {
+        public:
+            Operation(S &&s, Scheduler scheduler, R r) noexcept
+                : scheduler_(scheduler), r_(std::move(r)), inner_(std::move(s).connect(Receiver{ this })) {
+                run = [](Work *w) noexcept {
+                    auto *self = static_cast<Operation *>(w);
+                    self->result_.deliver(self->r_);
+                };
+            }
+            Operation(const Operation &) = delete;
+            Operation &operator=(const Operation &) = delete;
+
+            void start() noexcept { inner_.start(); }
+
+        private:
+            struct Receiver {
+                Operation *op;
+
+                template <typename... V>
+                void set_value(V &&...v) noexcept {
+                    op->result_.value.emplace(std::in_place, std::forward<V>(v)...);
+                    op->scheduler_.post(op);
+                }
+                void set_error(DNS::Error e) noexcept {
+                    op->result_.value.emplace(std::unexpect, e);
+                    op->scheduler_.post(op);
+                }
+            };
+
+            Scheduler                                                       scheduler_;
+            R                                                               r_;
+            detail::Result<value_type>                                      result_;
+            decltype(std::declval<S>().connect(std::declval<Receiver>()))  inner_;
+        };
+
+        template <typename R>
+        Operation<R> connect(R r) && noexcept { return Operation<R>(std::move(s_), scheduler_, std::move(r)); }
+
+    private:
+        S         s_;
+        Scheduler scheduler_;
+    };
+
+    struct ContinuesOnClosure { Scheduler scheduler; };
+
+    /**
+     * @brief Moves a sender's completion onto @p scheduler: `s | continues_on(loop)`.
+     */
+    inline ContinuesOnClosure continues_on(Scheduler scheduler) noexcept { return { scheduler }; }
+
+    template <Sender S>
+    ContinuesOnSender<S> operator|(S s, ContinuesOnClosure c) noexcept { return ContinuesOnSender<S>(std::move(s), c.scheduler); }
+
+    // co_await
+
+    /*
+     *  Runs a sender from a coroutine. The coroutine only suspends if the sender does not
+     *  complete inline, and is resumed on whichever thread completes it.
+     */
+    template <Sender S>
+    class Awaiter {
+    public:
+        using value_type = typename S::value_type;
+
+        explicit Awaiter(S &&s) noexcept : op_(std::move(s).connect(Receiver{ this })) {}
+        Awaiter(const Awaiter &) = delete;
+        Awaiter &operator=(const Awaiter &) = delete;
+
+        bool await_ready() const noexcept { return false; }
+
+        bool await_suspend(std::coroutine_handle<> h) noexcept {
+            handle_ = h;
+            op_.start();
+            // Still running elsewhere: suspend. Already done (inline): carry straight on.
+            uint8_t expected = STARTING;
+            return state_.compare_exchange_strong(expected, SUSPENDED, std::memory_order_acq_rel);
+        }
+
+        std::expected<value_type, DNS::Error> await_resume() noexcept { return std::move(*result_.value); }
+
+    private:
+        enum : uint8_t { STARTING, SUSPENDED, DONE };
+
+        struct Receiver {
+            Awaiter *a;
+
+            template <typename... V>
+            void set_value(V &&...v) noexcept {
+                a->result_.value.emplace(std::in_place, std::forward<V>(v)...);
+                a->complete();
+            }
+            void set_error(DNS::Error e) noexcept {
+                a->result_.value.emplace(std::unexpect, e);
+                a->complete();
+            }
+        };
+
+        void complete() noexcept {
+            uint8_t expected = STARTING;
+            if (!state_.compare_exchange_strong(expected, DONE, std::memory_order_acq_rel))
+                handle_.resume();
+        }
+
+        std::coroutine_handle<>                                      handle_;
+        std::atomic<uint8_t>                                         state_ { STARTING };
+        detail::Result<value_type>                                   result_;
+        decltype(std::declval<S>().connect(std::declval<Receiver>())) op_;
+    };
+
+    template <Sender S>
+    Awaiter<S> operator co_await(S &&s) noexcept { return Awaiter<S>(std::move(s)); }
+
+    /*
+     *  A fixed set of threads, each with a queue of its own, that steal from each other.
+     *
+     *      start(n)     → n threads, n queues
+     *      scheduler()  → posts onto the queue of the posting thread's home thread
+     *      stats(..)    → work run and work stolen, for [STATS]
+     *
+     *  Every thread that posts (an I/O worker, say) keeps posting to the same queue, and a
+     *  pool thread posts to its own, so related work stays on one core while there is
+     *  nothing better to do. A pool thread whose queue runs dry takes half of the longest
+     *  one instead of sleeping, so a burst of expensive work from one poster spreads over
+     *  every idle thread rather than queueing behind one. Threads with nothing to run or
+     *  steal spin briefly, then sleep until the next post().
+     *
+     *  Each queue is FIFO under its own lock; the lock is only ever shared by its owner, the
+     *  threads posting to it and an occasional thief.
+     *  Destroying the pool runs whatever is still queued, then joins the threads.
+     */
+    class ThreadPool final : public Context {
+    public:
+        ThreadPool() = default;
+        ThreadPool(const ThreadPool &) = delete;
+        ThreadPool &operator=(const ThreadPool &) = delete;
+        ~ThreadPool() noexcept;
+
+        void start(unsigned threads);
+
+        void post(Work *work) noexcept override;
+
+        Scheduler scheduler() noexcept { return Scheduler(this); }
+        size_t    size() const noexcept { return threads_.size(); }
+
+        struct Stats {
+            uint64_t ran    { 0 };     // work items run
+            uint64_t stolen { 0 };     // of which taken from another thread's queue
+            size_t   queued { 0 };     // waiting right now, over all queues
+        };
+
+        /**
+         * @brief Totals over every thread since the last stats(true).
+         */
+        Stats stats(bool reset = false) noexcept;
+
+    private:
+        static constexpr int SPINS = 256;
+
+        struct alignas(64) Queue {
+            std::mutex            mutex;
+            Work                 *head { nullptr };
+            Work                 *tail { nullptr };
+            std::atomic<size_t>   size { 0 };       // read without the lock to pick a victim
+            std::atomic<uint64_t> ran { 0 };
+            std::atomic<uint64_t> stolen { 0 };
+        };
+
+        void  loop(unsigned self, std::stop_token stop) noexcept;
+        void  push(Queue &q, Work *first, Work *last, size_t n) noexcept;
+        Work *pop(Queue &q) noexcept;
+        Work *steal(unsigned self) noexcept;
+        bool  anyQueued() const noexcept;
+
+        std::unique_ptr<Queue[]>  queues_;
+        unsigned                  count_ { 0 };
+        std::atomic<unsigned>     nextHome_ { 0 };  // round-robin home queues for posting threads
+        std::atomic<uint32_t>     epoch_ { 0 };     // bumped to wake sleepers
+        std::atomic<unsigned>     sleepers_ { 0 };
+        std::vector<std::jthread> threads_;         // last: joined before the queues go away
+    };
+
+    /*
+     *  Work for one event loop's thread, posted from anywhere.
+     *
+     *      open()      → creates the wakeup handle the event loop watches
+     *      post(w)     → queues w and makes fd() readable
+     *      drain()     → on the loop's thread: runs everything queued so far
+     *
+     *  Only the first post() after a drain() signals, so a burst costs one wakeup.
+     */
+    class RunLoop final : public Context {
+    public:
+        RunLoop() = default;
+        RunLoop(const RunLoop &) = delete;
+        RunLoop &operator=(const RunLoop &) = delete;
+        ~RunLoop() noexcept;
+
+        bool open() noexcept;
+
+        void post(Work *work) noexcept override;
+
+        /**
+         * @brief Runs the work queued so far (not what it posts in turn).
+         * @return number of items run.
+         */
+        size_t drain() noexcept;
+
+        Platform::socket_t fd() const noexcept { return wakeup_; }
+        Scheduler          scheduler() noexcept { return Scheduler(this); }
+
+    private:
+        std::mutex         mutex_;
+        Work              *head_ { nullptr };
+        Work              *tail_ { nullptr };
+        bool               signalled_ { false };
+        Platform::socket_t wakeup_ { Platform::INVALID_SOCK };
+    };
+
+} // namespace DNS::Server::Exec
@@ -0,0 +1,150 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/*
+ *  The parts of HTTP/2 (RFC 9113) and HPACK (RFC 7541) that DNS over HTTPS (RFC 8484) needs.
+ *
+ *      FrameHeader / parseHeader() → the 9-byte header in front of every frame
+ *      append*()                   → builds frames at the end of an output buffer
+ *      HpackDecoder                → decodes header blocks, dynamic table and Huffman included
+ *      Hpack::indexed/literal()    → encodes header fields without touching the peer's
+ *                                    dynamic table: static table references and literals
+ *                                    "without indexing", never Huffman-coded
+ *      base64UrlDecode()           → the ?dns= parameter of a GET request (RFC 4648 section 5)
+ *
+ *  Header blocks are small for DNS (a handful of fields), so decoded fields are plain
+ *  strings; nothing here is on the UDP path.
+ */
+namespace DNS::Server::Http2 {
+
+    // Every client connection starts with these 24 bytes (RFC 9113 section 3.4).
+    constexpr std::string_view PREFACE = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+
+    constexpr size_t   FRAME_HEADER_SIZE = 9;
+    constexpr uint32_t DEFAULT_WINDOW    = 65535;
+    constexpr uint32_t DEFAULT_MAX_FRAME = 16384;
+    constexpr uint32_t MAX_WINDOW        = 0x7FFFFFFF;
+
+    enum class Frame : uint8_t {
+        DATA          = 0x0,
+        HEADERS       = 0x1,
+        PRIORITY      = 0x2,
+        RST_STREAM    = 0x3,
+        SETTINGS      = 0x4,
+        PUSH_PROMISE  = 0x5,
+        PING          = 0x6,
+        GOAWAY        = 0x7,
+        WINDOW_UPDATE = 0x8,
+        CONTINUATION  = 0x9,
+    };
+
+    namespace Flag {
+        constexpr uint8_t END_STREAM  = 0x01;
+        constexpr uint8_t ACK         = 0x01;   // SETTINGS and PING
+        constexpr uint8_t END_HEADERS = 0x04;
+        constexpr uint8_t PADDED      = 0x08;
+        constexpr uint8_t PRIORITY    = 0x20;
+    }
+
+    namespace Setting {
+        constexpr uint16_t HEADER_TABLE_SIZE      = 0x1;
+        constexpr uint16_t ENABLE_PUSH            = 0x2;
+        constexpr uint16_t MAX_CONCURRENT_STREAMS = 0x3;
+        constexpr uint16_t INITIAL_WINDOW_SIZE    = 0x4;
+        constexpr uint16_t MAX_FRAME_SIZE         = 0x5;
+        constexpr uint16_t MAX_HEADER_LIST_SIZE   = 0x6;
+    }
+
+    // Error codes carried by RST_STREAM and GOAWAY.
+    namespace Code {
+        constexpr uint32_t NO_ERROR           = 0x0;
+        constexpr uint32_t PROTOCOL_ERROR     = 0x1;
+        constexpr uint32_t INTERNAL_ERROR     = 0x2;
+        constexpr uint32_t FLOW_CONTROL_ERROR = 0x3;
+        constexpr uint32_t FRAME_SIZE_ERROR   = 0x6;
+        constexpr uint32_t REFUSED_STREAM     = 0x7;
+        constexpr uint32_t CANCEL             = 0x8;
+        constexpr uint32_t COMPRESSION_ERROR  = 0x9;
+    }
+
+    struct FrameHeader {
+        uint32_t length { 0 };
+        Frame    type   { Frame::DATA };
+        uint8_t  flags  { 0 };
+        uint32_t stream { 0 };
+    };
+
+    FrameHeader parseHeader(const uint8_t *p) noexcept;
+
+    void appendFrame(std::vector<uint8_t> &out, Frame type, uint8_t flags, uint32_t stream,
+                     const uint8_t *payload, size_t len);
+    void appendSetting(std::vector<uint8_t> &payload, uint16_t id, uint32_t value);
+    void appendWindowUpdate(std::vector<uint8_t> &out, uint32_t stream, uint32_t increment);
+    void appendRstStream(std::vector<uint8_t> &out, uint32_t stream, uint32_t code);
+    void appendGoaway(std::vector<uint8_t> &out, uint32_t lastStream, uint32_t code);
+
+    /**
+     * @brief Reads a 31-bit big-endian value (stream ID, window increment) at @p p.
+     */
+    inline uint32_t read31(const uint8_t *p) noexcept {
+        return (static_cast<uint32_t>(p[0] & 0x7F) << 24) | (static_cast<uint32_t>(p[1]) << 16) |
+               (static_cast<uint32_t>(p[2]) << 8) | p[3];
+    }
+
+    struct Header {
+        std::string name;
+        std::string value;
+    };
+
+    /*
+     *  HPACK decoding context of one connection direction. Header blocks must be decoded in
+     *  the order they arrive, including those of streams that get refused, or the dynamic
+     *  table falls out of step with the peer's encoder.
+     */
+    class HpackDecoder {
+    public:
+        // SETTINGS_HEADER_TABLE_SIZE we never change from its default.
+        static constexpr size_t MAX_TABLE_SIZE = 4096;
+
+        /**
+         * @brief Decodes one complete header block into @p out (appended).
+         * @return false on a malformed block (COMPRESSION_ERROR: the connection must close).
+         */
+        bool decode(const uint8_t *block, size_t len, std::vector<Header> &out);
+
+    private:
+        std::deque<Header> dynamic_;    // newest first, as HPACK indexes it
+        size_t             size_    { 0 };
+        size_t             maxSize_ { MAX_TABLE_SIZE };
+
+        bool lookup(uint64_t index, Header &out) const;
+        void insert(Header h);
+        void evict(size_t limit);
+    };
+
+    namespace Hpack {
+        /**
+         * @brief Appends a field that is entry @p index of the static table as a whole
+         *        (e.g. 8 = ":status: 200", 3 = ":method: POST").
+         */
+        void indexed(std::vector<uint8_t> &out, uint8_t index);
+
+        /**
+         * @brief Appends a field named by static table entry @p nameIndex with value @p value,
+         *        as a literal without indexing.
+         */
+        void literal(std::vector<uint8_t> &out, uint8_t nameIndex, std::string_view value);
+    }
+
+    /**
+     * @brief Decodes unpadded base64url @p in into @p out.
+     * @return false on a character outside the base64url alphabet or a dangling bit group.
+     */
+    bool base64UrlDecode(std::string_view in, std::vector<uint8_t> &out);
+
+} // namespace DNS::Server::Http2
@@ -0,0 +1,200 @@
+#pragma once
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <expected>
+#include <optional>
+#include <queue>
+#include <span>
+#include <vector>
+
+#include "../parser/common.hpp"
+#include "platform.hpp"
+#include "coro.hpp"
+
+namespace DNS::Server {
+
+    /*
+     *  Outstanding upstream queries of one worker, keyed by the transaction ID
+     *  the query carries on the wire to the upstream.
+     *
+     *      insert(..)      → claims a free upstream ID and remembers who asked with which ID
+     *      addAttempt(..)  → sends the same query again (hedge or retransmit) under a new ID
+     *      find(id)        → looks an entry up without releasing it
+     *      take(id)        → matches a reply: returns the entry and frees it together with
+     *                        every other attempt of the same query, or nothing if the ID is
+     *                        unknown (late, duplicate or spoofed reply)
+     *      dueRetries(..)  → queries whose next attempt is due (see scheduleRetry())
+     *      expire(..)      → frees every entry whose deadline has passed
+     *
+     *  Every attempt has its own upstream ID, so a late answer to an earlier attempt is
+     *  still recognised and its RTT measured without ambiguity (no Karn problem). The
+     *  first attempt (the primary) lists the IDs of all attempts of the query.
+     *
+     *  A copy of every query is kept next to its entry so it can be re-sent without the
+     *  caller holding on to the datagram; the copies reuse their storage.
+     *
+     *  The coroutine that asked a query waits on the entry's waiter; whoever releases
+     *  the query (an answer, its deadline, or giving up) resumes it with the Outcome.
+     *
+     *  Upstream IDs come from the OS's CSPRNG (Platform::randomBytes()), a batch at a time;
+     *  a busy one is drawn again rather than probed past, so no ID says anything about the
+     *  next. That is all the protection there is against spoofed answers: each worker's
+     *  upstream socket keeps one source port (no RFC 5452 port randomisation), and
+     *  matchReply() otherwise only checks the resolver's address, so an off-path attacker
+     *  has to guess 16 bits, some 32768 forged answers per query on average, within its
+     *  timeout. All 65536 entries are allocated once,
+     *  so the forwarding path never allocates except for the timer heaps.
+     *  Not thread-safe: each worker owns its own table.
+     */
+    class InflightTable {
+    public:
+        using clock = std::chrono::steady_clock;
+
+        static constexpr size_t MAX_ATTEMPTS = 4;
+
+        /*
+         *  How a query ended, handed to the coroutine waiting on it:
+         *      ANSWERED   → msg is the answer, ID restored, cut down to what the client takes
+         *      TIMED_OUT  → timeout_ms passed; msg is the query
+         *      FAILED     → every resolver's circuit is open; msg is the query
+         *  msg is only valid until the coroutine next suspends.
+         */
+        struct Outcome {
+            enum class Kind : uint8_t { ANSWERED, TIMED_OUT, FAILED };
+            Kind                     kind { Kind::TIMED_OUT };
+            std::span<const uint8_t> msg;
+        };
+
+        struct Entry {
+            sockaddr_storage  client {};
+            uint16_t          id       { 0 };   // client's original transaction ID
+            uint8_t           upstream { 0 };   // UpstreamPool index this attempt went to
+            clock::time_point sent {};
+            clock::time_point deadline {};      // shared by every attempt of the query
+            uint16_t          primary  { 0 };   // upstream ID of the first attempt
+            uint32_t          tcp      { 0 };   // TcpConnections / DohConnections token, 0 = UDP
+            uint32_t          stream   { 0 };   // HTTP/2 stream of a DoH client's request
+            uint16_t          udpSize  { 512 }; // largest answer the client takes (EDNS0 payload size)
+            Pending<Outcome> *waiter   { nullptr }; // coroutine waiting for the query, nullptr for probes
+            bool              hedge    { false };   // sent early to another resolver, not a retransmit
+            bool              charged  { false };   // already counted as a miss against its resolver
+            bool              probe    { false };   // health probe of an open circuit, no client
+            bool              truncated { false };  // answered with TC over UDP, asked again over TCP
+            bool              active   { false };
+
+            // Primary only.
+            clock::time_point retryAt {};       // default-constructed = no further attempt
+            bool              hedgeNext   { false };  // the attempt at retryAt is a hedge
+            bool              overTcp     { false };  // an answer came back truncated; later attempts use TCP
+            uint8_t           retransmits { 0 };
+            uint8_t           attempts    { 0 };
+            std::array<uint16_t, MAX_ATTEMPTS> ids {};
+        };
+
+        InflightTable();
+
+        /**
+         * @brief Registers a query; @p entry holds who asked, the original ID, where it
+         *        goes and when it expires, plus retryAt/hedgeNext for its first retry.
+         *
+         * @return the upstream ID to write into the query before sending it, or
+         *         DNS::Error::UPSTREAM_BUSY if (nearly) all 65536 IDs are in flight or no
+         *         random ID could be had.
+         */
+        std::expected<uint16_t, DNS::Error> insert(const Entry &entry, const uint8_t *query, size_t len) noexcept;
+
+        /**
+         * @brief Registers another attempt of the query whose primary is @p primaryId.
+         *
+         * The new entry shares client, ID and deadline with the primary and goes to
+         * @p upstream. The primary's retryAt is cleared; see scheduleRetry().
+         *
+         * @return the new upstream ID, or UPSTREAM_BUSY as for insert() or if the query
+         *         already has MAX_ATTEMPTS attempts.
+         */
+        std::expected<uint16_t, DNS::Error>
+        addAttempt(uint16_t primaryId, uint8_t upstream, bool hedge, clock::time_point now) noexcept;
+
+        /**
+         * @brief Arms the next attempt of primary @p primaryId at @p at (ignored past its deadline).
+         */
+        void scheduleRetry(uint16_t primaryId, clock::time_point at, bool hedge) noexcept;
+
+        /**
+         * @brief The query bytes stored by insert() for @p upstreamId (ID field as the client sent it).
+         */
+        std::span<const uint8_t> query(uint16_t upstreamId) const noexcept;
+
+        /**
+         * @brief Appends to @p out every primary whose retryAt is at or before @p now,
+         *        and clears their retryAt so each is reported once.
+         * @return number of entries appended.
+         */
+        size_t dueRetries(clock::time_point now, std::vector<uint16_t> &out) noexcept;
+
+        /**
+         * @brief Returns the entry in flight under @p upstreamId, or nullptr.
+         */
+        const Entry *find(uint16_t upstreamId) const noexcept;
+        Entry       *find(uint16_t upstreamId) noexcept;
+
+        /**
+         * @brief Matches a reply carrying upstream ID @p upstreamId and releases it along
+         *        with every other attempt of the same query.
+         * @return the matched entry, or std::nullopt if nothing with that ID is in flight.
+         */
+        std::optional<Entry> take(uint16_t upstreamId) noexcept;
+
+        /**
+         * @brief Releases every entry whose deadline is at or before @p now,
+         *        calling @p onTimeout(const Entry&) for each one.
+         * @return number of entries expired.
+         */
+        template <typename Fn>
+        size_t expire(clock::time_point now, Fn &&onTimeout) {
+            size_t n = 0;
+            while (!deadlines_.empty() && deadlines_.top().first <= now) {
+                const uint16_t upstreamId = deadlines_.top().second;
+                deadlines_.pop();
+                Entry &e = entries_[upstreamId];
+                // The heap may still hold IDs that were answered (and maybe reused) since.
+                if (!e.active || e.deadline > now)
+                    continue;
+                e.active = false;
+                --size_;
+                ++n;
+                onTimeout(e);
+            }
+            return n;
+        }
+
+        /**
+         * @brief Milliseconds until the earliest deadline or retry (0 if already due),
+         *        or -1 if nothing is in flight.
+         */
+        int msUntilNextDeadline(clock::time_point now) const noexcept;
+
+        size_t size() const noexcept { return size_; }
+        bool   empty() const noexcept { return size_ == 0; }
+
+    private:
+        using Deadline = std::pair<clock::time_point, uint16_t>;
+
+        std::vector<Entry> entries_;
+        std::vector<std::vector<uint8_t>> queries_;
+        std::priority_queue<Deadline, std::vector<Deadline>, std::greater<>> deadlines_;
+        std::priority_queue<Deadline, std::vector<Deadline>, std::greater<>> retries_;
+        size_t             size_ { 0 };
+
+        // Random IDs not handed out yet; claim() gives up after MAX_DRAWS busy ones in a row.
+        static constexpr size_t ID_BATCH  = 256;
+        static constexpr int    MAX_DRAWS = 64;
+        std::array<uint16_t, ID_BATCH> ids_ {};
+        size_t             idsLeft_ { 0 };
+
+        std::expected<uint16_t, DNS::Error> claim(const Entry &entry) noexcept;
+        bool nextId(uint16_t &id) noexcept;
+    };
+
+} // namespace DNS::Server
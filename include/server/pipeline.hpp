@@ -0,0 +1,87 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+#include "platform.hpp"
+#include "pool.hpp"
+#include "ring.hpp"
+
+namespace DNS::Server {
+
+    /*
+     *  One UDP datagram between pipeline stages: a query on its way to be classified or
+     *  forwarded, or an answer on its way out. Only the first len bytes are copied.
+     */
+    struct Datagram {
+        sockaddr_storage             addr {};
+        size_t                       len { 0 };
+        alignas(CACHE_LINE) uint8_t  data[PacketPool::SLOT_SIZE];
+    };
+
+    /*
+     *  How another thread wakes an event loop: a wakeup handle (Platform::openWakeup())
+     *  the loop polls next to its sockets.
+     *
+     *      ring()    → any thread; only the first ring() after answer() signals the handle
+     *      answer()  → the loop, before taking what it was rung for
+     */
+    class Doorbell {
+    public:
+        Doorbell() = default;
+        Doorbell(const Doorbell &) = delete;
+        Doorbell &operator=(const Doorbell &) = delete;
+        ~Doorbell() noexcept { Platform::closeSocket(fd_); }
+
+        bool open() noexcept {
+            fd_ = Platform::openWakeup();
+            return fd_ != Platform::INVALID_SOCK;
+        }
+
+        void ring() noexcept {
+            if (!rung_.exchange(true, std::memory_order_acq_rel))
+                Platform::signalWakeup(fd_);
+        }
+
+        void answer() noexcept {
+            Platform::clearWakeup(fd_);
+            rung_.exchange(false, std::memory_order_acq_rel);
+        }
+
+        Platform::socket_t fd() const noexcept { return fd_; }
+
+    private:
+        std::atomic<bool>  rung_ { false };
+        Platform::socket_t fd_ { Platform::INVALID_SOCK };
+    };
+
+    /*
+     *  The stages of Config::pipeline and the rings between them (see server_pipeline.cpp).
+     *
+     *      receive  ──toClassify──▶  classify  ──toUpstream──▶  upstream (the event loop)
+     *                                    │                          │
+     *                                    └────────toSend────────────┴──▶  send
+     *
+     *  Each stage is one thread on its own core. A ring's consumer sleeps in its Parking
+     *  (or, for the event loop, polls upstreamBell) while its ring is empty; producers that
+     *  find a ring full wait for it, so a slow stage backs up into the kernel's receive
+     *  queue instead of losing queries in between. Answers the event loop cannot hand to a
+     *  full toSend are dropped, as a full socket buffer would.
+     */
+    struct Pipeline {
+        static constexpr size_t RING_SLOTS = 1024;
+
+        SpscRing<Datagram, RING_SLOTS> toClassify;
+        SpscRing<Datagram, RING_SLOTS> toUpstream;
+        MpscRing<Datagram, RING_SLOTS> toSend;
+
+        Parking  classifyPark;
+        Parking  sendPark;
+        Doorbell upstreamBell;
+
+        std::vector<std::jthread> stages;   // last: stopped and joined before the rings go
+    };
+
+} // namespace DNS::Server
@@ -0,0 +1,282 @@
+#pragma once
+#ifdef _WIN32
+#include <WinSock2.h> // socket
+#include <ws2tcpip.h> // inet_ntop
+#else
+#include <sys/socket.h> // socket
+#include <netinet/in.h> // sockaddr_in
+#include <arpa/inet.h>  // inet_ntop
+#include <unistd.h>     // close
+#endif
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/*
+ *  Thin socket layer so the Listener can be written once and built on both
+ *  Windows (Winsock) and Linux (BSD sockets + epoll).
+ *
+ *      socket_t      → SOCKET on Windows, int fd everywhere else
+ *      INVALID_SOCK  → INVALID_SOCKET / -1
+ *      SOCK_ERR      → SOCKET_ERROR   / -1  (return value of send/recv on failure)
+ *      Poller        → epoll on Linux, WSAPoll on Windows, poll() elsewhere
+ *
+ *  Addresses are held in sockaddr_storage, IPv4 (AF_INET) or IPv6 (AF_INET6), exactly
+ *  as the kernel reports them; nothing is converted per packet. An IPv6 socket is opened
+ *  dual-stack, so it also serves IPv4 peers, which it sees as ::ffff:a.b.c.d.
+ *
+ *  Everything here is a direct wrapper , no buffering, no allocation on the hot path.
+ */
+namespace DNS::Server::Platform {
+
+#ifdef _WIN32
+    using socket_t  = SOCKET;
+    using socklen_t = int;
+    constexpr socket_t INVALID_SOCK = INVALID_SOCKET;
+#else
+    using socket_t  = int;
+    using socklen_t = ::socklen_t;
+    constexpr socket_t INVALID_SOCK = -1;
+#endif
+    constexpr int SOCK_ERR = -1;
+
+    /**
+     * @brief Parses numeric IPv4 or IPv6 address @p ip with port @p port into @p out.
+     * @return false if @p ip is neither.
+     */
+    bool parseAddress(const std::string &ip, uint16_t port, sockaddr_storage &out) noexcept;
+
+    /**
+     * @brief Rewrites IPv4 address @p a as its IPv4-mapped IPv6 form (::ffff:a.b.c.d), for
+     *        use on a dual-stack IPv6 socket. No-op for anything else.
+     */
+    void mapToV6(sockaddr_storage &a) noexcept;
+
+    /**
+     * @brief Size of the sockaddr actually held in @p a, as sendto() / connect() expect it.
+     */
+    inline socklen_t addressLength(const sockaddr_storage &a) noexcept {
+        return a.ss_family == AF_INET6 ? sizeof(sockaddr_in6) : sizeof(sockaddr_in);
+    }
+
+    /**
+     * @brief true if @p a and @p b are the same address family, address and port.
+     */
+    bool sameAddress(const sockaddr_storage &a, const sockaddr_storage &b) noexcept;
+
+    /**
+     * @brief The address of @p a in text form ("192.0.2.1", "2001:db8::1"), for logging.
+     */
+    std::string formatAddress(const sockaddr_storage &a);
+
+    /**
+     * @brief Initialises the socket library. WSAStartup(2.2) on Windows, no-op elsewhere.
+     * @return true on success.
+     */
+    bool startup() noexcept;
+
+    /**
+     * @brief Releases the socket library. WSACleanup() on Windows, no-op elsewhere.
+     */
+    void cleanup() noexcept;
+
+    /**
+     * @brief Closes a socket and resets the handle to INVALID_SOCK. No-op if already invalid.
+     */
+    void closeSocket(socket_t &s) noexcept;
+
+    /**
+     * @brief Returns the last socket error (WSAGetLastError() / errno).
+     */
+    int lastError() noexcept;
+
+    /**
+     * @brief true if @p err means "nothing to do right now" (EAGAIN / EWOULDBLOCK / WSAEWOULDBLOCK).
+     */
+    bool isWouldBlock(int err) noexcept;
+
+    /**
+     * @brief true if @p err is an ICMP port-unreachable surfacing on a UDP socket
+     *        (WSAECONNRESET on Windows, ECONNREFUSED on Linux).
+     */
+    bool isConnReset(int err) noexcept;
+
+    /**
+     * @brief true if @p err is a signal interruption (EINTR / WSAEINTR) and the call should be retried.
+     */
+    bool isInterrupted(int err) noexcept;
+
+    /**
+     * @brief Switches a socket to non-blocking mode (O_NONBLOCK / FIONBIO).
+     * @return true on success.
+     */
+    bool setNonBlocking(socket_t s) noexcept;
+
+    /**
+     * @brief Enables SO_REUSEPORT so several sockets can bind the same address and the
+     *        kernel load-balances datagrams between them. Must be called before bind().
+     * @return false where SO_REUSEPORT does not exist (Windows).
+     */
+    bool setReusePort(socket_t s) noexcept;
+
+    /**
+     * @brief Clears IPV6_V6ONLY on an AF_INET6 socket so it also carries IPv4 (dual-stack).
+     *        Must be called before bind() / connect().
+     * @return true on success.
+     */
+    bool setDualStack(socket_t s) noexcept;
+
+    /**
+     * @brief Enables SO_REUSEADDR, so a restarted listener can bind its TCP port while
+     *        connections of the previous run linger in TIME_WAIT. Must be called before bind().
+     * @return true on success.
+     */
+    bool setReuseAddr(socket_t s) noexcept;
+
+    /**
+     * @brief send() on a connected stream socket that never raises SIGPIPE (MSG_NOSIGNAL).
+     * @return bytes written, or SOCK_ERR (see lastError()).
+     */
+    int sendStream(socket_t s, const uint8_t *data, size_t len) noexcept;
+
+    /**
+     * @brief Opens a non-blocking TCP connection to @p to with Nagle disabled.
+     *
+     * The connect is usually still in progress on return: the socket becomes writable
+     * once it completes, and connectError() then tells whether it succeeded.
+     *
+     * @return the socket, or INVALID_SOCK if it could not be created or the connect failed outright.
+     */
+    socket_t connectStream(const sockaddr_storage &to) noexcept;
+
+    /**
+     * @brief The outcome of a non-blocking connect on @p s (SO_ERROR): 0 once connected.
+     */
+    int connectError(socket_t s) noexcept;
+
+    /**
+     * @brief Attaches a classic-BPF SO_REUSEPORT program that steers every client IP to a fixed socket.
+     *
+     * The program folds the source address (IPv4, or the four words of an IPv6 one) into 16 bits
+     * and returns it modulo @p groupSize, which the kernel uses as the index into the reuseport
+     * group (sockets are numbered in bind order).
+     * Attaching to any one socket applies to the whole group. All sockets must already be bound.
+     *
+     * @return false on non-Linux platforms or if the kernel rejects the program.
+     */
+    bool attachClientSteering(socket_t s, uint32_t groupSize) noexcept;
+
+    /**
+     * @brief Attaches a classic-BPF socket filter to the UDP listener @p s that drops, in the
+     *        kernel, datagrams that cannot be a query: shorter than a header plus one byte of
+     *        question, QR set (a response), or no question at all.
+     *
+     * Dropped datagrams never wake the worker or take receive-queue space; the kernel counts
+     * them in the socket's drop counter (see receiveDrops()).
+     *
+     * @return false on non-Linux platforms or if the kernel rejects the program.
+     */
+    bool attachQueryFilter(socket_t s) noexcept;
+
+    /**
+     * @brief Datagrams the kernel dropped on @p s so far (SO_MEMINFO): those a socket filter
+     *        rejected and those that found the receive queue full.
+     * @return false where the counter is not available.
+     */
+    bool receiveDrops(socket_t s, uint32_t &drops) noexcept;
+
+    /**
+     * @brief Sets SO_BUSY_POLL on @p s: a receive (or poll) on it that finds the queue empty
+     *        first polls the NIC's queue for up to @p usec microseconds instead of waiting
+     *        for an interrupt. Raising it above net.core.busy_read needs CAP_NET_ADMIN.
+     * @return false on non-Linux platforms or if the kernel refuses.
+     */
+    bool setBusyPoll(socket_t s, uint32_t usec) noexcept;
+
+    /**
+     * @brief Pins the calling thread to logical CPU @p cpu (pthread_setaffinity_np / SetThreadAffinityMask).
+     * @return true on success.
+     */
+    bool pinThisThread(unsigned cpu) noexcept;
+
+    /**
+     * @brief Waits until @p s is readable or @p timeout_ms elapses.
+     *
+     * For one-off waits on a non-blocking socket where a Poller would be overkill;
+     * a bounded wait here replaces SO_RCVTIMEO.
+     *
+     * @return  1 if readable,
+     *          0 on timeout,
+     *         -1 on error (see lastError()).
+     */
+    int waitReadable(socket_t s, uint32_t timeout_ms) noexcept;
+
+    /**
+     * @brief Fills @p out with @p len bytes from the OS's CSPRNG (getrandom() on Linux,
+     *        arc4random_buf() on the BSDs and macOS, BCryptGenRandom() on Windows).
+     * @return false if the OS could not supply them.
+     */
+    bool randomBytes(void *out, size_t len) noexcept;
+
+    /**
+     * @brief Opens a wakeup handle another thread can make readable, so an event loop can be
+     *        woken without a socket of its own: an eventfd on Linux, a UDP socket connected
+     *        to itself on loopback elsewhere. Close it with closeSocket().
+     * @return the handle (non-blocking), or INVALID_SOCK if it could not be created.
+     */
+    socket_t openWakeup() noexcept;
+
+    /**
+     * @brief Makes wakeup handle @p s readable. Safe from any thread.
+     */
+    void signalWakeup(socket_t s) noexcept;
+
+    /**
+     * @brief Consumes every pending signal on wakeup handle @p s, so it is no longer readable.
+     */
+    void clearWakeup(socket_t s) noexcept;
+
+    /*
+     *  Level-triggered readiness poller.
+     *
+     *      open()      → create the epoll instance (Linux) / reset the fd list
+     *      add(s)      → watch s for readability
+     *      setWritable(s, on) → also report s while it is writable (for a stalled send)
+     *      remove(s)   → stop watching s (before closing it)
+     *      wait(ms)    → block until at least one socket is readable, -1 = forever
+     *      ready(i)    → i-th readable socket from the last wait()
+     *
+     *  Level-triggered is deliberate: the Listener drains until EAGAIN anyway,
+     *  and a level-triggered poller is forgiving if a drain loop stops early.
+     */
+    class Poller {
+    public:
+        Poller() = default;
+        Poller(const Poller &) = delete;
+        Poller &operator=(const Poller &) = delete;
+        ~Poller() noexcept;
+
+        bool     open() noexcept;
+        bool     add(socket_t s) noexcept;
+        bool     setWritable(socket_t s, bool on) noexcept;
+        void     remove(socket_t s) noexcept;
+        int      wait(int timeout_ms) noexcept;
+        socket_t ready(int i) const noexcept;
+
+    private:
+        static constexpr int MAX_EVENTS = 64;
+#if defined(__linux__)
+    public:
+        // The epoll descriptor itself, so another event loop (io_uring) can wait on it.
+        int fd() const noexcept { return epfd_; }
+    private:
+        int                   epfd_ { -1 };
+        std::vector<socket_t> ready_;
+#else
+        std::vector<socket_t> watched_;
+        std::vector<bool>     writable_;
+        std::vector<socket_t> ready_;
+#endif
+    };
+
+} // namespace DNS::Server::Platform
@@ -0,0 +1,94 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <vector>
+
+#include "../parser/common.hpp"
+
+namespace DNS::Server {
+
+    /*
+     *  A slab of packet buffers, each SLOT_SIZE bytes and starting on its own cache line.
+     *
+     *      reset(n)     → one allocation for n slots, made up front; never zero-filled
+     *      acquire()    → a free slot as a Buffer that hands it back when it goes away
+     *      take()/put() → the same by slot number, for buffers the kernel holds across calls
+     *      data(slot)   → the slot's bytes
+     *
+     *  The hot path borrows a slot, receives into it, rewrites it in place and sends from
+     *  it, so a query costs neither a memset nor an allocation. Slots are never shared:
+     *  a buffer is owned by whoever holds it until it is returned.
+     *
+     *  Not thread-safe: each worker owns its own pools.
+     */
+    class PacketPool {
+    public:
+        static constexpr size_t SLOT_SIZE = DNS::Limits::MAX_EDNS_PAYLOAD;
+        static constexpr size_t ALIGNMENT = 64;
+        static_assert(SLOT_SIZE % ALIGNMENT == 0, "slots must keep their cache-line alignment");
+
+        /*
+         *  A borrowed slot; returned to its pool when destroyed. Empty (false) if the pool
+         *  had none to give.
+         */
+        class Buffer {
+        public:
+            Buffer() noexcept = default;
+            Buffer(Buffer &&other) noexcept : pool_(other.pool_), slot_(other.slot_) { other.pool_ = nullptr; }
+            Buffer &operator=(Buffer &&other) noexcept;
+            Buffer(const Buffer &) = delete;
+            Buffer &operator=(const Buffer &) = delete;
+            ~Buffer() { release(); }
+
+            explicit operator bool() const noexcept { return pool_ != nullptr; }
+            uint8_t *data() const noexcept { return pool_->data(slot_); }
+            static constexpr size_t size() noexcept { return SLOT_SIZE; }
+
+        private:
+            friend class PacketPool;
+            Buffer(PacketPool *pool, uint32_t slot) noexcept : pool_(pool), slot_(slot) {}
+            void release() noexcept;
+
+            PacketPool *pool_ { nullptr };
+            uint32_t    slot_ { 0 };
+        };
+
+        /**
+         * @brief (Re)allocates the pool with @p slots slots (at least one), all free.
+         *        Buffers still borrowed from the old allocation must be gone by then.
+         */
+        void reset(size_t slots);
+
+        /**
+         * @brief Borrows a free slot.
+         * @return the slot, or an empty Buffer if every slot is in use.
+         */
+        Buffer acquire() noexcept;
+
+        /**
+         * @brief Borrows a free slot by number; give it back with put().
+         * @return false if every slot is in use.
+         */
+        bool take(uint32_t &slot) noexcept;
+
+        void put(uint32_t slot) noexcept { free_.push_back(slot); }
+
+        uint8_t *data(uint32_t slot) const noexcept { return storage_.get() + static_cast<size_t>(slot) * SLOT_SIZE; }
+
+        size_t capacity()  const noexcept { return slots_; }
+        size_t available() const noexcept { return free_.size(); }
+        size_t bytes()     const noexcept { return slots_ * SLOT_SIZE; }
+
+    private:
+        struct AlignedDelete {
+            void operator()(uint8_t *p) const noexcept { ::operator delete[](p, std::align_val_t{ ALIGNMENT }); }
+        };
+
+        std::unique_ptr<uint8_t[], AlignedDelete> storage_;
+        std::vector<uint32_t>                     free_;    // stack: the slot used last is reused first, still in cache
+        size_t                                    slots_ { 0 };
+    };
+
+} // namespace DNS::Server
@@ -0,0 +1,287 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <stop_token>
+#include <type_traits>
+#include <utility>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__)
+#include <immintrin.h> // _mm_pause
+#endif
+
+/*
+ *  Bounded lock-free queues between threads, and a way for a consumer to sleep on one.
+ *
+ *      SpscRing<T, N> → one producer thread, one consumer thread
+ *      MpscRing<T, N> → any number of producer threads, one consumer thread
+ *      Parking        → the consumer's bed: spins a little, then sleeps until woken
+ *      spinUntil(..)  → busy-waits on a non-blocking check for a fixed time
+ *
+ *  Both rings hold N slots (a power of two), allocated and initialised once up front and
+ *  reused from then on, and hand the slots out in place:
+ *
+ *      push(fill)    → fill(T &) writes the next free slot; false if the ring is full
+ *      pop(consume)  → consume(T &) reads the oldest slot; false if the ring is empty
+ *
+ *  so an element is written once and read once, and nothing allocates or locks. Each
+ *  ring also keeps its occupancy for [STATS]: size() now, the peak since peak(true) and
+ *  how often a producer found it full.
+ */
+namespace DNS::Server {
+
+    inline void cpuRelax() noexcept {
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__)
+        _mm_pause();
+#elif defined(__aarch64__)
+        asm volatile("yield");
+#endif
+    }
+
+    /**
+     * @brief Calls @p ready (which must not block) until it returns true or @p budget has
+     *        passed, so a thread that expects work soon can skip the sleep and the wakeup.
+     * @return whether ready() returned true in time.
+     */
+    template <typename Ready>
+    bool spinUntil(std::chrono::nanoseconds budget, Ready &&ready) noexcept {
+        const auto deadline = std::chrono::steady_clock::now() + budget;
+        // The clock only every 16 rounds: a cheap ready() would otherwise mostly read it.
+        for (;;) {
+            for (int i = 0; i < 16; ++i) {
+                if (ready())
+                    return true;
+                cpuRelax();
+            }
+            if (std::chrono::steady_clock::now() >= deadline)
+                return false;
+        }
+    }
+
+    // Keeps the producer's and the consumer's hot fields on separate cache lines.
+    inline constexpr size_t CACHE_LINE = 64;
+
+    namespace detail {
+
+        /*
+         *  Occupancy counters shared by both rings; written by producers, read by anyone.
+         */
+        class RingStats {
+        public:
+            size_t peak(bool reset = false) noexcept {
+                return reset ? peak_.exchange(0, std::memory_order_relaxed) : peak_.load(std::memory_order_relaxed);
+            }
+            uint64_t full() const noexcept { return full_.load(std::memory_order_relaxed); }
+
+        protected:
+            void noteSize(size_t n) noexcept {
+                size_t seen = peak_.load(std::memory_order_relaxed);
+                while (n > seen && !peak_.compare_exchange_weak(seen, n, std::memory_order_relaxed)) {}
+            }
+            void noteFull() noexcept { full_.fetch_add(1, std::memory_order_relaxed); }
+
+        private:
+            std::atomic<size_t>   peak_ { 0 };
+            std::atomic<uint64_t> full_ { 0 };
+        };
+
+    } // namespace detail
+
+    template <typename T, size_t N>
+    class SpscRing : public detail::RingStats {
+        static_assert(N > 0 && (N & (N - 1)) == 0, "ring size must be a power of two");
+        static_assert(std::is_default_constructible_v<T>);
+
+    public:
+        SpscRing() : slots_(std::make_unique_for_overwrite<T[]>(N)) {}
+        SpscRing(const SpscRing &) = delete;
+        SpscRing &operator=(const SpscRing &) = delete;
+
+        /**
+         * @brief Producer: lets @p fill write the next slot and publishes it, unless fill
+         *        returns false (nothing to publish after all).
+         * @return false if the ring was full; fill was not called.
+         */
+        template <typename F>
+        bool push(F &&fill) noexcept {
+            const size_t tail = tail_.load(std::memory_order_relaxed);
+            if (tail - headCache_ == N) {
+                headCache_ = head_.load(std::memory_order_acquire);
+                if (tail - headCache_ == N) {
+                    noteFull();
+                    return false;
+                }
+            }
+            if (fill(slots_[tail & MASK])) {
+                tail_.store(tail + 1, std::memory_order_release);
+                noteSize(tail + 1 - head_.load(std::memory_order_relaxed));
+            }
+            return true;
+        }
+
+        /**
+         * @brief Consumer: hands the oldest slot to @p consume, then frees it.
+         * @return false if the ring was empty.
+         */
+        template <typename F>
+        bool pop(F &&consume) noexcept {
+            const size_t head = head_.load(std::memory_order_relaxed);
+            if (head == tailCache_) {
+                tailCache_ = tail_.load(std::memory_order_acquire);
+                if (head == tailCache_)
+                    return false;
+            }
+            consume(slots_[head & MASK]);
+            head_.store(head + 1, std::memory_order_release);
+            return true;
+        }
+
+        bool   empty() const noexcept { return size() == 0; }
+        size_t size()  const noexcept {
+            return tail_.load(std::memory_order_acquire) - head_.load(std::memory_order_acquire);
+        }
+        static constexpr size_t capacity() noexcept { return N; }
+
+    private:
+        static constexpr size_t MASK = N - 1;
+
+        std::unique_ptr<T[]>                      slots_;
+        alignas(CACHE_LINE) std::atomic<size_t>   head_ { 0 };      // consumer writes
+        size_t                                    tailCache_ { 0 }; // consumer's last look at tail_
+        alignas(CACHE_LINE) std::atomic<size_t>   tail_ { 0 };      // producer writes
+        size_t                                    headCache_ { 0 }; // producer's last look at head_
+    };
+
+    /*
+     *  Bounded multi-producer queue (Vyukov): every slot carries a sequence number that says
+     *  whose turn it is, so producers only contend on the one counter they claim slots with.
+     */
+    template <typename T, size_t N>
+    class MpscRing : public detail::RingStats {
+        static_assert(N > 0 && (N & (N - 1)) == 0, "ring size must be a power of two");
+        static_assert(std::is_default_constructible_v<T>);
+
+    public:
+        MpscRing() : cells_(std::make_unique_for_overwrite<Cell[]>(N)) {
+            for (size_t i = 0; i < N; ++i)
+                cells_[i].seq.store(i, std::memory_order_relaxed);
+        }
+        MpscRing(const MpscRing &) = delete;
+        MpscRing &operator=(const MpscRing &) = delete;
+
+        /**
+         * @brief Producer (any thread): as SpscRing::push(). A slot claimed by a fill that
+         *        returns false is still used, as an empty element the consumer skips.
+         */
+        template <typename F>
+        bool push(F &&fill) noexcept {
+            size_t pos = tail_.load(std::memory_order_relaxed);
+            Cell  *cell;
+            for (;;) {
+                cell = &cells_[pos & MASK];
+                const size_t seq  = cell->seq.load(std::memory_order_acquire);
+                const auto   diff = static_cast<std::ptrdiff_t>(seq - pos);
+                if (diff == 0) {
+                    if (tail_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                        break;
+                } else if (diff < 0) {
+                    noteFull();
+                    return false;
+                } else {
+                    pos = tail_.load(std::memory_order_relaxed);
+                }
+            }
+            cell->used = fill(cell->value);
+            cell->seq.store(pos + 1, std::memory_order_release);
+            noteSize(pos + 1 - head_.load(std::memory_order_relaxed));
+            return true;
+        }
+
+        /**
+         * @brief Consumer: as SpscRing::pop().
+         */
+        template <typename F>
+        bool pop(F &&consume) noexcept {
+            const size_t head = head_.load(std::memory_order_relaxed);
+            Cell &cell = cells_[head & MASK];
+            if (cell.seq.load(std::memory_order_acquire) != head + 1)
+                return false;
+            if (cell.used)
+                consume(cell.value);
+            cell.seq.store(head + N, std::memory_order_release);
+            head_.store(head + 1, std::memory_order_release);
+            return true;
+        }
+
+        bool   empty() const noexcept { return size() == 0; }
+        size_t size()  const noexcept {
+            const size_t tail = tail_.load(std::memory_order_acquire);
+            const size_t head = head_.load(std::memory_order_acquire);
+            return tail > head ? tail - head : 0;
+        }
+        static constexpr size_t capacity() noexcept { return N; }
+
+    private:
+        static constexpr size_t MASK = N - 1;
+
+        struct Cell {
+            std::atomic<size_t> seq { 0 };
+            bool                used { false };
+            T                   value;
+        };
+
+        std::unique_ptr<Cell[]>                 cells_;
+        alignas(CACHE_LINE) std::atomic<size_t> head_ { 0 };    // consumer writes
+        alignas(CACHE_LINE) std::atomic<size_t> tail_ { 0 };    // producers claim
+    };
+
+    /*
+     *  Where a ring's consumer thread waits for work.
+     *
+     *      wait(stop, ready) → returns once ready() holds or stop is requested; spins for
+     *                          SPINS rounds first, then sleeps (futex on Linux)
+     *      wake()            → producer, after a push: wakes the consumer if it sleeps
+     *      wakeAll()         → unconditionally, e.g. from a stop_callback
+     *
+     *  A producer only pays for a syscall when the consumer actually sleeps.
+     */
+    class Parking {
+    public:
+        static constexpr int SPINS = 256;
+
+        template <typename Ready>
+        void wait(const std::stop_token &stop, Ready &&ready) noexcept {
+            for (int i = 0; i < SPINS; ++i) {
+                if (ready() || stop.stop_requested())
+                    return;
+                cpuRelax();
+            }
+            const uint32_t seen = bell_.load(std::memory_order_acquire);
+            sleeping_.store(true, std::memory_order_relaxed);
+            // Pairs with the fence in wake(): either it sees us asleep or we see its push.
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (!ready() && !stop.stop_requested())
+                bell_.wait(seen, std::memory_order_acquire);
+            sleeping_.store(false, std::memory_order_relaxed);
+        }
+
+        void wake() noexcept {
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (sleeping_.load(std::memory_order_relaxed))
+                wakeAll();
+        }
+
+        void wakeAll() noexcept {
+            bell_.fetch_add(1, std::memory_order_release);
+            bell_.notify_all();
+        }
+
+    private:
+        alignas(CACHE_LINE) std::atomic<uint32_t> bell_ { 0 };
+        std::atomic<bool>                         sleeping_ { false };
+    };
+
+} // namespace DNS::Server
@@ -1,8 +1,10 @@
 #pragma once
-#include <WinSock2.h> // socket
-#include <ws2tcpip.h> // inet_ntop
 #include <vector>
+#include <atomic>
 #include <cstdint>
+#include <expected>
+#include <memory>
+#include <thread>
 #include <unordered_set>
 #define RED     "\x1b[31m"
 #define GREEN   "\x1b[32m"
@@ -11,60 +13,176 @@
 
 
 #include "../parser/common.hpp"
+#include "platform.hpp"
+#include "batch.hpp"
+#include "pool.hpp"
+#include "coro.hpp"
+#include "exec.hpp"
+#include "pipeline.hpp"
+#include "inflight.hpp"
+#include "upstream.hpp"
+#include "tcp.hpp"
+#include "doh.hpp"
 
 namespace DNS::Server {
 
+    /*
+     *  How a worker moves datagrams:
+     *      POLL  → readiness loop (epoll / WSAPoll) with recvfrom/sendto or recvmmsg/sendmmsg
+     *      URING → io_uring completion loop (Linux 6.0+), falls back to POLL if unavailable
+     */
+    enum class IoEngine : uint8_t { POLL, URING };
+
     /**
      * @brief Holds configuration parameters for the DNS listener.
      *
-     * @param serverIp    The local IP address to bind the listener to. Defaults to "0.0.0.0" (all interfaces).
+     * @param serverIp    The local IPv4 or IPv6 address to bind the listener to. An IPv6 listener is
+     *                    dual-stack, so "::" serves IPv4 and IPv6 clients alike. Defaults to "0.0.0.0"
+     *                    (all IPv4 interfaces).
      * @param portServerIp The UDP port to listen on. Defaults to 53 (standard DNS port).
-     * @param upstreamIp  The IP address of the upstream DNS resolver to forward queries to. Defaults to "8.8.8.8" (Google DNS).
-     * @param timeout_ms  How long (in milliseconds) to wait for a response from the upstream resolver before giving up. Defaults to 5000ms.
+     * @param upstreamIps The upstream DNS resolvers (IPv4 or IPv6) to forward queries to. Each query
+     *                    goes to the fastest healthy one (see UpstreamPool). Defaults to { "8.8.8.8" } (Google DNS).
+     * @param timeout_ms  How long (in milliseconds) to keep trying upstream for a query before giving up,
+     *                    across all of its retransmits. Defaults to 5000ms.
+     * @param batchSize   Datagrams moved per recvmmsg()/sendmmsg() call. 1 (the default) keeps the
+     *                    one-query-at-a-time path; values above DatagramBatch::MAX_CAPACITY are clamped.
+     * @param workers     Number of worker threads. Above 1, each worker binds its own SO_REUSEPORT
+     *                    socket on serverIp:portServerIp and is pinned to its own core. Defaults to 1.
+     * @param clientAffinity With workers > 1, attach a reuseport BPF program so every query from a
+     *                    given client IP lands on the same worker (Linux only). Defaults to false.
+     * @param engine      I/O engine each worker runs. Defaults to IoEngine::POLL.
+     * @param hedging     With several upstreams, send a duplicate to a second resolver when the first
+     *                    has not answered within its p95 RTT; the first answer wins. Defaults to true.
+     * @param statsInterval_s Seconds between per-upstream [STATS] log lines (sent, answered,
+     *                    timeouts, hedges, retransmits, RTT). 0 disables them. Defaults to 60.
+     * @param tcp         Also accept DNS over TCP on serverIp:portServerIp (RFC 7766: persistent,
+     *                    pipelined connections, answers out of order). Defaults to true.
+     * @param prefilter   Attach a socket filter to the UDP listener that drops runts, responses
+     *                    and question-less datagrams in the kernel (Linux only). Defaults to true.
+     * @param upstreamTcp Send every query upstream over the persistent TCP connections that
+     *                    otherwise only carry queries whose UDP answer came back truncated.
+     *                    Health probes stay on UDP. Defaults to false.
+     * @param upstreamTls Forward every query over DNS over TLS (RFC 7858) to port 853 of each
+     *                    resolver instead: persistent, pipelined connections whose sessions are
+     *                    resumed after a reconnect. Health probes go over TLS too. Resolvers are
+     *                    authenticated by "address#name" or by their address. Defaults to false.
+     * @param upstreamDoh Forward every query over DNS over HTTPS (RFC 8484) to port 443 of each
+     *                    resolver instead: one HTTP/2 connection per resolver and worker, each
+     *                    query a POST to /dns-query on its own stream. Resolvers are
+     *                    authenticated as with upstreamTls. Defaults to false.
+     * @param tlsCaFile   PEM file of the CAs trusted for upstreamTls / upstreamDoh; empty = the
+     *                    system's default trust store.
+     * @param dohPort     Also serve DNS over HTTPS (RFC 8484, HTTP/2 over TLS) on serverIp:dohPort
+     *                    at /dns-query, many requests per connection. 0 (the default) = off.
+     * @param dohCert     PEM certificate chain the DoH listener presents.
+     * @param dohKey      PEM private key of dohCert.
+     * @param ednsPayload UDP payload size queries advertise upstream in their OPT record, in
+     *                    [512, 4096]; a larger one the client sent is lowered to it, and a UDP
+     *                    answer with TC set is only asked again over TCP for clients that take
+     *                    more than this. Defaults to DNS::Limits::SAFE_EDNS_PAYLOAD (1232).
+     * @param classifyThreads Parse and check queries against the blocklist on a pool of this many
+     *                    threads shared by every worker, which hands each one back to its
+     *                    worker's event loop to be forwarded or answered. Each pool thread has
+     *                    its own queue and steals from the others when it runs dry (see
+     *                    Exec::ThreadPool). 0 (the default) does it inline on the worker.
+     * @param pipeline    Run UDP queries through a staged pipeline instead of thread-per-core:
+     *                    one thread each receives, classifies, talks to the resolvers (the
+     *                    event loop, which also keeps TCP and DoH) and sends answers, linked by
+     *                    bounded lock-free rings (see Pipeline). workers and the io_uring
+     *                    engine do not apply. Defaults to false.
+     * @param busyPoll_us Busy-poll mode: a worker (or the pipeline's receive stage) with nothing
+     *                    to do spins on non-blocking checks of its sockets for up to this many
+     *                    microseconds before it sleeps, so a query arriving meanwhile is picked
+     *                    up without a wakeup; SO_BUSY_POLL lets each check poll the NIC too.
+     *                    Costs a core per worker at 100%. 0 (the default) = off.
+     * @param firstCore   Worker i (and pipeline stage i) is pinned to core firstCore + i, e.g.
+     *                    the first of a range set aside with isolcpus= for busy polling.
+     *                    Defaults to 0.
      */
     struct Config {
         std::string serverIp   = "127.0.0.1";
         uint16_t  portServerIp = 53;
-        std::string upstreamIp = "8.8.8.8";
+        std::vector<std::string> upstreamIps = { "8.8.8.8" };
         uint32_t timeout_ms    = 5000;
+        uint32_t batchSize     = 1;
+        uint32_t workers       = 1;
+        bool     clientAffinity = false;
+        IoEngine engine        = IoEngine::POLL;
+        bool     hedging       = true;
+        uint32_t statsInterval_s = 60;
+        bool     tcp           = true;
+        bool     prefilter     = true;
+        bool     upstreamTcp   = false;
+        bool     upstreamTls   = false;
+        bool     upstreamDoh   = false;
+        std::string tlsCaFile;
+        uint16_t dohPort       = 0;
+        std::string dohCert;
+        std::string dohKey;
+        uint16_t ednsPayload   = DNS::Limits::SAFE_EDNS_PAYLOAD;
+        uint32_t classifyThreads = 0;
+        bool     pipeline      = false;
+        uint32_t busyPoll_us   = 0;
+        uint32_t firstCore     = 0;
     };
 
-    class Listener {
+    // A private FrameOwner: the resolve() coroutines take their frames from its pool.
+    class Listener : private FrameOwner {
     public:
         /**
-         * @brief Destructor. Closes both the listener and upstream sockets and shuts down Winsock.
+         * @brief Destructor. Stops any worker threads, closes both the listener and upstream sockets
+         *        and shuts down the socket library.
          *
-         * Ensures all sockets are released cleanly via closeSocket(), then calls WSACleanup()
-         * to free Winsock resources.
+         * Workers are asked to stop and joined first, then all sockets are released cleanly
+         * via closeSocket(), then Platform::cleanup() is called
+         * (WSACleanup() on Windows, no-op on Linux).
          */
         ~Listener() noexcept;
 
         /**
-         * @brief Initialises Winsock, binds the listener socket, and configures the upstream resolver socket.
+         * @brief Initialises the socket library, binds the listener socket, and configures the upstream resolver socket.
          *
          * Steps performed:
          *  - Stores the supplied configuration.
-         *  - Calls WSAStartup to initialise Winsock 2.2.
-         *  - Creates a UDP socket and binds it to cfg.serverIp:cfg.portServerIp.
-         *  - Creates a second UDP socket pointed at cfg.upstreamIp:53.
-         *  - Applies a receive timeout (cfg.timeout_ms) to the upstream socket so a
-         *    dead resolver never blocks indefinitely.
+         *  - Calls Platform::startup() (WSAStartup 2.2 on Windows).
+         *  - Creates a non-blocking UDP socket of cfg.serverIp's family (dual-stack if IPv6)
+         *    and binds it to cfg.serverIp:cfg.portServerIp (with SO_REUSEPORT when cfg.workers > 1).
+         *  - With cfg.tcp, also listens for TCP on the same address; if that fails the
+         *    listener carries on with UDP only.
+         *  - With cfg.dohPort, loads cfg.dohCert / cfg.dohKey and listens for DNS over HTTPS
+         *    on that port; if only the listening socket fails, it carries on without.
+         *  - Creates a second non-blocking UDP socket for talking to every resolver in
+         *    cfg.upstreamIps (port 53), dual-stack IPv6 if any of them is IPv6. The event loop
+         *    watches it alongside the listener socket, so forwarding never blocks on a slow
+         *    or dead resolver.
          *
          * @param cfg Configuration to use. If omitted the default Config{} is applied.
          * @return DNS::Error::OK on success, or one of:
-         *         SERVER_SOCKET_FAIL – WSAStartup or socket() failed.
-         *         INVALID_IP         – serverIp or upstreamIp is not a valid IPv4 address.
+         *         SERVER_SOCKET_FAIL – startup, socket() or switching to non-blocking failed.
+         *         INVALID_IP         – serverIp or an upstreamIps entry is not a valid IPv4 or IPv6 address
+         *                              (or upstreamIps is empty).
          *         SERVER_BIND_FAIL   – bind() failed on the listener socket.
+         *         UPSTREAM_TLS_FAIL  – cfg.upstreamTls or cfg.upstreamDoh, but TLS is not available
+         *                              in this build or cfg.tlsCaFile could not be loaded.
+         *         SERVER_TLS_FAIL    – cfg.dohPort, but TLS is not available in this build or
+         *                              cfg.dohCert / cfg.dohKey could not be loaded.
          */
         DNS::Error init(const Config &cfg = {}) noexcept;
 
         /**
          * @brief Enters the main event loop, processing incoming DNS queries indefinitely.
          *
-         * Calls handleQuery() in a tight loop. Non-fatal errors are logged as warnings
-         * and the loop continues. This function never returns under normal operation.
+         * With cfg.workers > 1, first starts workers 1..N-1 on their own threads pinned to
+         * cores cfg.firstCore + i, each a Listener with its own SO_REUSEPORT socket sharing
+         * this blocklist, then pins the calling thread to cfg.firstCore and serves as worker 0
+         * via serve(). A single worker is only pinned with cfg.firstCore or cfg.busyPoll_us.
+         * With cfg.clientAffinity, a reuseport BPF program then pins each client IP to one worker.
+         * With cfg.classifyThreads, first starts the classify pool every worker shares.
+         * With cfg.pipeline, runs servePipelined() instead of any workers.
+         * This function never returns under normal operation.
          *
-         * @return DNS::Error::SERVER_NOT_RUNNING if init() was never called (socket is invalid).
+         * @return DNS::Error::SERVER_NOT_RUNNING if init() was never called (socket is invalid),
+         *         DNS::Error::SERVER_SOCKET_FAIL if the poller could not be created.
          */
         DNS::Error run() noexcept;
 
@@ -81,56 +199,547 @@ namespace DNS::Server {
         DNS::Error loadBlocklist(const std::vector<std::string> &files) noexcept;
 
     private:
-        SOCKET      socket_   { INVALID_SOCKET };
-        SOCKET      upstream_ { INVALID_SOCKET };
-        sockaddr_in upstreamAddr_ {};
+        Platform::socket_t socket_   { Platform::INVALID_SOCK };
+        Platform::socket_t upstream_ { Platform::INVALID_SOCK };
+        Platform::socket_t tcp_      { Platform::INVALID_SOCK };
+        Platform::socket_t doh_      { Platform::INVALID_SOCK };
+        bool               prefiltered_ { false };  // the query filter is attached to socket_
+        UpstreamPool       upstreams_;
         Config      cfg_;
-        std::unordered_set<std::string> blocklist_;
+        // Shared read-only with worker Listeners once run() starts.
+        std::shared_ptr<std::unordered_set<std::string>> blocklist_ =
+            std::make_shared<std::unordered_set<std::string>>();
+        // The classify pool (cfg_.classifyThreads), shared by every worker once run() starts.
+        std::shared_ptr<Exec::ThreadPool> classifyPool_;
+        bool                              ownsClassifyPool_ { false };   // started it; logs its [STATS]
+
+        // Workers 1..N-1 (cfg_.workers > 1). threads_ is declared last so it is joined first.
+        static constexpr int STOP_POLL_MS = 250;
+        std::vector<std::unique_ptr<Listener>> workers_;
+        std::vector<std::jthread>              threads_;
+
+        // Every query forwarded upstream and not yet answered or timed out.
+        InflightTable inflight_;
+
+        // Accepted DNS-over-TCP clients and the TCP (or TLS) connections to each resolver,
+        // or the HTTP/2 ones with cfg_.upstreamDoh; idle ones are swept once a second.
+        TlsClient                             tls_;
+        TcpConnections                        tcpClients_;
+        TcpUpstreams                          tcpUpstreams_;
+        DohUpstreams                          dohUpstreams_;
+        std::chrono::steady_clock::time_point nextTcpSweep_ {};
+        std::vector<std::pair<uint8_t, uint16_t>> orphans_;  // scratch for resendOrphans()
+
+        // DNS-over-HTTPS clients on doh_, swept with the TCP ones.
+        TlsServer                             dohTls_;
+        DohConnections                        dohClients_;
+
+        // Listener reads (handleQuery()/handleBatch() calls) per fast-path pass before
+        // serve() turns to the slow path. Also the size of the upstream outbox in unbatched mode.
+        static constexpr uint32_t FAST_PATH_BUDGET = 64;
+
+        // Receive buffers of the unbatched path: handleQuery() and handleUpstream() each
+        // borrow one for the datagram they handle and hand it back once it is sent on.
+        static constexpr size_t PACKET_SLOTS = 4;
+        PacketPool                            packets_;
+
+        // Where resolve() parses and classifies (classifier_) and where it carries on after
+        // (home_): both inline, or the classify pool and loop_, which serve() drains.
+        Exec::Scheduler                       classifier_;
+        Exec::Scheduler                       home_;
+        Exec::RunLoop                         loop_;
+        size_t                                offloaded_ { 0 };  // queries on the classify pool
+
+        // serveUring()'s registered tx arena while its loop runs; flushUpstream() and
+        // flushClientTx() queue their outboxes on it instead of sending them.
+        struct RingTx;
+        RingTx                               *ringTx_ { nullptr };
+
+        // The stage threads and rings of cfg_.pipeline; null in thread-per-core mode.
+        std::unique_ptr<Pipeline>             pipeline_;
+
+        // Busy-poll mode (cfg_.busyPoll_us): waits that found work while spinning and waits
+        // that spun dry and slept. Atomic since the pipeline's receive stage counts as well.
+        std::atomic<uint64_t>                 spinHits_ { 0 };
+        std::atomic<uint64_t>                 spinMisses_ { 0 };
+
+        std::vector<uint16_t>                 retryDue_;     // scratch for retryInflight()
+        std::vector<uint8_t>                  probeDue_;     // scratch for probeUpstreams()
+        std::chrono::steady_clock::time_point nextStats_ {};
+
+        /*
+         *  Batched-mode state (cfg_.batchSize > 1), sized once in serve().
+         *
+         *      rx_          → queries drained from socket_
+         *      upstreamTx_  → queries flushed to the upstream resolver (also used unbatched,
+         *                     as the slow-path outbox)
+         *      upstreamRx_  → responses drained from upstream_
+         *      clientTx_    → answers to UDP clients, blocked, relayed or SERVFAIL, queued by
+         *                     resolve() coroutines and flushed by whoever resumed them (also
+         *                     used unbatched, and at the end of every pass)
+         */
+        DatagramBatch rx_;
+        DatagramBatch upstreamTx_;
+        DatagramBatch upstreamRx_;
+        DatagramBatch clientTx_;
+
+        /*
+         *  Outcome of classify() for one query:
+         *      DROP    → nothing to do (e.g. no questions)
+         *      ANSWER  → blocked; the encoded null response is ready to send
+         *      FORWARD → not blocked; relay the raw datagram upstream
+         */
+        enum class Verdict : uint8_t { DROP, ANSWER, FORWARD };
+
+        /**
+         * @brief Safely closes a socket and resets the handle to Platform::INVALID_SOCK.
+         *
+         * A no-op if the socket is already invalid, preventing double-close.
+         *
+         * @param s Reference to the socket handle to close. Set to Platform::INVALID_SOCK after closing.
+         */
+        void closeSocket(Platform::socket_t &s) noexcept;
+
+        /**
+         * @brief Busy-poll mode: calls @p ready (a non-blocking check) for up to
+         *        cfg_.busyPoll_us and counts whether it held in time.
+         * @return true if it did; false, also with busy polling off, to go on and sleep.
+         */
+        template <typename Ready>
+        bool busyPoll(Ready &&ready) noexcept {
+            if (cfg_.busyPoll_us == 0)
+                return false;
+            const bool hit = spinUntil(std::chrono::microseconds(cfg_.busyPoll_us), ready);
+            (hit ? spinHits_ : spinMisses_).fetch_add(1, std::memory_order_relaxed);
+            return hit;
+        }
 
         /**
-         * @brief Safely closes a socket and resets the handle to INVALID_SOCKET.
+         * @brief The per-worker event loop.
          *
-         * A no-op if the socket is already INVALID_SOCKET, preventing double-close.
+         * Sleeps in Platform::Poller::wait() (epoll on Linux) until the listener or the
+         * upstream socket is readable, or the oldest in-flight query is due; in busy-poll
+         * mode only after spinning on non-blocking waits (busyPoll()). Each wakeup
+         * then runs two phases:
+         *  - Fast path: up to FAST_PATH_BUDGET calls of handleQuery() (or handleBatch()
+         *    when cfg.batchSize > 1). Locally answerable queries are answered right there;
+         *    upstream-bound ones are only queued by forward().
+         *  - Queries back from the classify pool (loop_) are forwarded or answered, and in
+         *    pipeline mode (where the receive stage reads socket_ instead) so are those the
+         *    classify stage sends (takeClassified()).
+         *  - Slow path: flushUpstream(), then handleUpstream() until SERVER_WOULD_BLOCK,
+         *    then expireInflight().
+         * So a local answer never waits behind upstream I/O queued in the same wakeup.
+         * Non-fatal errors are logged as warnings and the loop continues.
          *
-         * @param s Reference to the SOCKET handle to close. Set to INVALID_SOCKET after closing.
+         * @param stop Stop token of the worker thread; a default token never stops.
+         * @return DNS::Error::OK once stop is requested, or
+         *         DNS::Error::SERVER_SOCKET_FAIL if the poller could not be created.
+         */
+        DNS::Error serve(std::stop_token stop) noexcept;
+
+        /**
+         * @brief The per-worker event loop for IoEngine::URING (see server_uring.cpp).
+         *
+         * Receives on both sockets through multishot RECVMSG with provided-buffer rings,
+         * sends from a registered tx arena, and forwards through inflight_ exactly like
+         * the poll loop.
+         * Called from serve(), which falls back to the poll loop if this fails to start.
+         *
+         * @param stop Stop token of the worker thread; a default token never stops.
+         * @return DNS::Error::OK once stop is requested, or
+         *         DNS::Error::SERVER_SOCKET_FAIL if the ring could not be set up or the kernel
+         *         rejects multishot RECVMSG (before Linux 6.0).
+         */
+        DNS::Error serveUring(std::stop_token stop) noexcept;
+
+        /**
+         * @brief io_uring engine: copies every datagram of @p out into the tx arena (ringTx_)
+         *        and queues its send on @p s, then clears @p out. Those that find the arena full
+         *        are dropped and counted, for one warning per pass.
+         */
+        void queueOnRing(DatagramBatch &out, Platform::socket_t s) noexcept;
+
+        /**
+         * @brief Runs cfg_.pipeline (see server_pipeline.cpp).
+         *
+         * Starts the receive, classify and send stages on cores firstCore + 1..3, then runs
+         * serve() on cfg_.firstCore as the upstream stage: it no longer reads socket_, but takes the queries the
+         * classify stage forwards (takeClassified()) and hands its answers to the send stage
+         * in flushClientTx(). Stops and joins the stages once serve() returns.
+         *
+         * @return whatever serve() returns, or DNS::Error::SERVER_SOCKET_FAIL if the upstream
+         *         stage's doorbell could not be created.
+         */
+        DNS::Error servePipelined() noexcept;
+
+        /**
+         * @brief Pipeline stage: drains socket_ in batches of up to cfg_.batchSize (or
+         *        FAST_PATH_BUDGET) datagrams into Pipeline::toClassify.
          */
-        void closeSocket(SOCKET &s) noexcept;
+        void receiveStage(std::stop_token stop) noexcept;
 
         /**
-         * @brief Receives a single DNS query, parses it, and forwards it upstream.
+         * @brief Pipeline stage: classify()s every query off Pipeline::toClassify, sending
+         *        blocked answers to Pipeline::toSend and the rest to Pipeline::toUpstream.
+         */
+        void classifyStage(std::stop_token stop) noexcept;
+
+        /**
+         * @brief Pipeline stage: sends the answers off Pipeline::toSend on socket_ in batches.
+         */
+        void sendStage(std::stop_token stop) noexcept;
+
+        /**
+         * @brief Starts a resolve() coroutine, with classification already done, for up to
+         *        FAST_PATH_BUDGET queries off Pipeline::toUpstream, and rings its own doorbell
+         *        again if more are left.
+         */
+        void takeClassified() noexcept;
+
+        /**
+         * @brief Receives a single DNS query, parses it, and answers or forwards it.
          *
          * Steps performed:
-         *  - Blocks on recvfrom() waiting for a UDP datagram on the listener socket.
+         *  - Reads one pending UDP datagram from the (non-blocking) listener socket.
          *  - Validates the minimum message length (>= 13 bytes).
-         *  - Parses the datagram into a DNS::Parser::Message.
-         *  - Logs and forwards each question in the message via forward().
+         *  - Starts the query's resolve() coroutine, which answers it or forwards it and
+         *    suspends until the upstream answer comes.
+         *  - Sends whatever answer that produced right away.
          *
          * @return DNS::Error::OK on success, or one of:
+         *         SERVER_WOULD_BLOCK – no datagram is queued; the caller should go back to polling.
          *         SERVER_RECV_FAIL – recvfrom() failed.
          *         PARSE_TOO_SHORT  – datagram is shorter than the minimum DNS header size.
-         *         Any error returned by the parser or forward().
+         *         SERVER_SEND_FAIL – the answer could not be handed to the kernel.
          */
         DNS::Error handleQuery() noexcept;
 
+        /**
+         * @brief Batched counterpart of handleQuery(), used when cfg_.batchSize > 1.
+         *
+         * Steps performed:
+         *  - Drains up to batchSize datagrams with one recvmmsg().
+         *  - Starts a resolve() coroutine for each; blocked answers land in clientTx_ and
+         *    upstream-bound queries wait in upstreamTx_ for the slow path.
+         *  - Flushes all blocked answers with one sendmmsg().
+         *
+         * @return DNS::Error::OK on success, or one of:
+         *         SERVER_WOULD_BLOCK   – nothing was queued on the listener socket.
+         *         SERVER_RECV_FAIL     – recvmmsg() failed.
+         *         SERVER_SEND_FAIL     – no reply could be handed to the kernel.
+         */
+        DNS::Error handleBatch() noexcept;
+
+        /**
+         * @brief Drains responses queued on the upstream socket and relays them to their clients.
+         *
+         * Each response is matched through matchReply(); unmatched ones are dropped.
+         * Uses one recvmmsg()/sendmmsg() pair when cfg_.batchSize > 1.
+         *
+         * @return DNS::Error::OK if something was received, or one of:
+         *         SERVER_WOULD_BLOCK – nothing is queued on the upstream socket.
+         *         SERVER_RECV_FAIL   – receiving from the upstream socket failed.
+         *         SERVER_SEND_FAIL   – a reply could not be handed to the kernel.
+         */
+        DNS::Error handleUpstream() noexcept;
+
+        /**
+         * @brief Creates a non-blocking TCP socket listening on @p addr (dual-stack if IPv6,
+         *        SO_REUSEPORT with several workers).
+         * @return the socket, or Platform::INVALID_SOCK if any step failed.
+         */
+        Platform::socket_t listenStream(const sockaddr_storage &addr) const noexcept;
+
+        /**
+         * @brief Services one ready TCP socket: accepts new clients on tcp_ or doh_, reads a
+         *        client's pipelined queries (each handed to handleTcpQuery()) or a DoH
+         *        client's requests (each handed to handleDohQuery()), or reads a
+         *        resolver's answers (each handed to handleStreamAnswer()), and writes out
+         *        whatever its socket buffer could not take before.
+         */
+        void handleTcp(Platform::socket_t s) noexcept;
 
+        /**
+         * @brief Relays one answer read off the TCP connection to resolver @p upstream.
+         *
+         * Matched through matchReply() like a datagram, which also cuts a UDP client's answer
+         * down to the payload size it advertised; the answer is then queued in clientTx_.
+         */
+        void handleStreamAnswer(uint8_t upstream, uint8_t *msg, size_t len) noexcept;
+
+        /**
+         * @brief Whether every query goes upstream over the stream connections (TCP, TLS or
+         *        HTTPS) rather than UDP.
+         */
+        bool streamOnly() const noexcept { return cfg_.upstreamTcp || cfg_.upstreamTls || cfg_.upstreamDoh; }
+
+        /**
+         * @brief What the stream connections to the resolvers speak, for log lines.
+         */
+        const char *streamTransport() const noexcept {
+            return cfg_.upstreamDoh ? "HTTPS" : cfg_.upstreamTls ? "TLS" : "TCP";
+        }
+
+        /**
+         * @brief Sends the in-flight attempt @p upstreamId to its resolver over TCP or TLS
+         *        (tcpUpstreams_), or HTTPS (dohUpstreams_), under the same upstream ID.
+         * @return false if the attempt is gone or no connection could take it.
+         */
+        bool streamQuery(uint16_t upstreamId) noexcept;
+
+        /**
+         * @brief Re-sends the queries stranded on a resolver connection that closed under
+         *        them (TcpUpstreams::takeOrphans()), if they are still in flight.
+         */
+        void resendOrphans() noexcept;
 
         /**
-         * @brief Forwards a raw DNS query to the upstream resolver and relays the response back to the client.
+         * @brief TCP counterpart of handleQuery() for one message read off connection @p conn.
+         *
+         * Starts the query's resolve() coroutine tagged with the connection's token: blocked
+         * names are answered on the connection straight away, everything else is written
+         * back whenever its answer comes, in any order.
+         */
+        void handleTcpQuery(TcpConnection &conn, uint8_t *msg, size_t len) noexcept;
+
+        /**
+         * @brief DNS-over-HTTPS counterpart of handleTcpQuery() for the query of request
+         *        @p stream on connection @p conn. A message that is no DNS query gets 400.
+         */
+        void handleDohQuery(DohConnection &conn, uint32_t stream, uint8_t *msg, size_t len) noexcept;
+
+        /**
+         * @brief Closes TCP and DoH clients idle for their IDLE_TIMEOUT and resolver
+         *        connections idle for TcpUpstreams::IDLE_TIMEOUT, at most once a second.
+         */
+        void sweepTcp() noexcept;
+
+        /**
+         * @brief Matches an upstream response to its in-flight query.
+         *
+         * Checks that the transaction ID is in flight and that @p from is the resolver it
+         * was sent to, releases the entry, feeds the RTT sample to upstreams_, restores
+         * the client's original ID in @p reply and resumes the query's resolve() coroutine
+         * with it, which relays it to the client.
+         * A datagram with TC set does not end the query if its client takes more than
+         * cfg_.ednsPayload: the same attempt is asked again over TCP (streamQuery()) and later
+         * attempts follow it there. Otherwise, or if no connection can be opened, the truncated
+         * answer is relayed as it is. An answer longer than a UDP client's EDNS0 payload size
+         * (512 without OPT) is cut down to its question with TC set (Edns::truncate()).
+         *
+         * @param reply  Response bytes, ID rewritten in place on success.
+         * @param len    Number of bytes in @p reply; the relayed length on return.
+         * @param from   Source address of the response.
+         * @param client Receives the address the response must be relayed to.
+         * @param stream The response was read off a resolver TCP connection.
+         * @return true if the response answered a client's query; @p client is then who asked.
+         */
+        bool matchReply(uint8_t *reply, size_t &len, const sockaddr_storage &from, sockaddr_storage &client,
+                        bool stream = false) noexcept;
+
+        /**
+         * @brief Releases every in-flight query whose timeout_ms has elapsed, logging each one,
+         *        resuming its coroutine with Outcome::Kind::TIMED_OUT and counting every
+         *        attempt not yet charged against its resolver.
+         */
+        void expireInflight() noexcept;
+
+        /**
+         * @brief Releases every query still in flight when the event loop stops, destroying
+         *        the coroutines waiting on them without an answer. Queries still on the
+         *        classify pool are waited for first, so none comes back to a closed worker.
+         */
+        void abandonInflight() noexcept;
+
+        /**
+         * @brief Sends the next attempt of every in-flight query whose retry is due.
          *
          * Steps performed:
-         *  - Sends the raw query buffer to the configured upstream resolver via sendto().
-         *  - Waits for the upstream response (subject to the configured timeout).
-         *  - Sends the upstream response back to the original client.
+         *  - A hedge (due at the resolver's p95 RTT) goes to the best other healthy resolver.
+         *  - A retransmit (due at the resolver's RTO) first counts the silent attempt as a
+         *    timeout, then goes to the best other healthy resolver, or the same one if none.
+         *  - With every circuit open there is nobody left to ask: the query's coroutine is
+         *    resumed with Outcome::Kind::FAILED right away rather than after timeout_ms.
+         *  - Arms the following retransmit at the new resolver's RTO, doubled per retransmit.
          *
-         * @param data   Pointer to the raw DNS query bytes to forward.
+         * The attempts are queued in upstreamTx_ (the caller flushes it) under their own
+         * upstream IDs; matchReply() relays whichever answer arrives first and drops the rest.
+         *
+         * @return number of attempts queued.
+         */
+        size_t retryInflight() noexcept;
+
+        /**
+         * @brief Counts one unanswered attempt against resolver @p upstream, logging when
+         *        its circuit breaker opens.
+         */
+        void chargeTimeout(uint8_t upstream, std::chrono::steady_clock::time_point now) noexcept;
+
+        /**
+         * @brief Queues a health probe (". NS") in upstreamTx_ for every resolver whose circuit
+         *        is open and whose next probe is due (over TLS or HTTPS when every query is).
+         *        An answer closes the circuit in matchReply(); a miss backs the next probe off
+         *        in expireInflight().
+         * @return number of probes queued in upstreamTx_.
+         */
+        size_t probeUpstreams() noexcept;
+
+        /**
+         * @brief Queues a SERVFAIL answer to @p query for @p client in clientTx_ (or on TCP
+         *        connection @p tcp, DoH stream @p stream), for a query no upstream can take.
+         * @return false if @p query does not parse or the answer could not be queued.
+         */
+        bool failFast(const uint8_t *query, size_t len, const sockaddr_storage &client, uint32_t tcp = 0,
+                      uint32_t stream = 0) noexcept;
+
+        /**
+         * @brief Writes answer @p msg to the TCP or DoH (request @p stream) connection behind
+         *        token @p tcp.
+         * @return false if that connection is gone or could not take it.
+         */
+        bool sendStream(uint32_t tcp, uint32_t stream, const uint8_t *msg, size_t len) noexcept;
+
+        /**
+         * @brief Marks one forwarded query of TCP or DoH connection @p tcp as done (no-op for 0
+         *        or a closed one).
+         */
+        void releaseTcp(uint32_t tcp) noexcept;
+
+        /**
+         * @brief Sends every answer queued in clientTx_ (by resolve() coroutines and failFast()) to its client.
+         *        In pipeline mode hands them to the send stage instead; any it has no room for
+         *        are dropped. Under the io_uring engine queues them on the ring (queueOnRing()).
+         */
+        DNS::Error flushClientTx() noexcept;
+
+        /**
+         * @brief Logs one [STATS] line per upstream every cfg_.statsInterval_s seconds, one
+         *        with the datagrams the kernel dropped on socket_ when the prefilter is attached,
+         *        and in pipeline mode one with each ring's occupancy: queued now, the peak
+         *        since the last line and how often its producer found it full.
+         */
+        void logStats() noexcept;
+
+        /**
+         * @brief How long the event loop may sleep: @p idleMs, shortened so the oldest
+         *        in-flight query is retried or expired (and stats are logged) on time (-1 = forever).
+         */
+        int waitBudget(int idleMs) const noexcept;
+
+        /**
+         * @brief Parses one query and decides what to do with it.
+         *
+         * Steps performed:
+         *  - Parses the datagram into a DNS::Parser::Message.
+         *  - Logs each question and checks it against the blocklist via search().
+         *  - For a blocked name, encodes a null-route response into @p answer.
+         *
+         * Touches nothing but the shared read-only blocklist, so it may run on the classify pool.
+         *
+         * @param data   Raw DNS query bytes.
+         * @param len    Number of bytes in @p data.
+         * @param client Sender address (used for logging only).
+         * @param answer Receives the encoded response when the verdict is ANSWER.
+         * @return The Verdict, or any error returned by the parser or encoder.
+         */
+        std::expected<Verdict, DNS::Error>
+        classify(const uint8_t *data, size_t len, const sockaddr_storage &client,
+                 std::vector<uint8_t> &answer) noexcept;
+
+
+
+        /**
+         * @brief Registers a query in inflight_ and picks its resolver.
+         *
+         * Takes a fresh upstream ID from inflight_ and writes it into @p data in place, and
+         * schedules its first retry: a hedge at the resolver's p95 RTT when cfg_.hedging allows
+         * it, otherwise a retransmit at the resolver's RTO.
+         * Shared by forward() and the io_uring engine, which then send the query their own way.
+         *
+         * @param data   Raw DNS query bytes (ID rewritten in place).
+         * @param len    Number of bytes in @p data; a copy is kept for retries.
+         * @param client The querying client.
+         * @param tcp    TcpConnections (or DohConnections) token if the query came over TCP
+         *               (or HTTPS), 0 for UDP.
+         * @param stream HTTP/2 stream of a DoH query, 0 otherwise.
+         * @return The UpstreamPool index to send to, or DNS::Error::UPSTREAM_BUSY, or
+         *         UPSTREAM_CIRCUIT_OPEN (nothing registered, @p data untouched).
+         */
+        std::expected<uint8_t, DNS::Error>
+        beginForward(uint8_t *data, size_t len, const sockaddr_storage &client, uint32_t tcp = 0,
+                     uint32_t stream = 0) noexcept;
+
+        /**
+         * @brief Queues a raw DNS query for the upstream resolver without waiting for the answer.
+         *
+         * Steps performed:
+         *  - Registers the query and picks the resolver via beginForward().
+         *  - Copies the query into upstreamTx_; flushUpstream() sends it on the slow path.
+         *    With cfg_.upstreamTcp it goes out on the resolver's TCP connection instead.
+         *
+         * The caller waits on the returned entry's waiter for the outcome.
+         *
+         * @param data   Pointer to the raw DNS query bytes to forward (ID rewritten in place).
          * @param len    Number of bytes in the query buffer.
-         * @param client The sockaddr_in of the original querying client, used to send the reply back.
-         * @return DNS::Error::OK on success, or one of:
-         *         UPSTREAM_UNREACHABLE – upstream socket is invalid or sendto() failed.
-         *         UPSTREAM_TIMEOUT     – the upstream resolver did not respond within timeout_ms.
-         *         SERVER_SEND_FAIL     – sending the response back to the client failed.
+         * @param client The address of the original querying client, used to send the reply back.
+         * @param tcp    TcpConnections (or DohConnections) token if the query came over TCP
+         *               (or HTTPS), 0 for UDP.
+         * @param stream HTTP/2 stream of a DoH query, 0 otherwise.
+         * @return The upstream ID the query is in flight under, or one of:
+         *         UPSTREAM_UNREACHABLE – upstream socket is invalid, the query did not fit the outbox
+         *                                or (cfg_.upstreamTcp) no connection could take it.
+         *         UPSTREAM_BUSY        – every upstream transaction ID is already in flight.
+         *         UPSTREAM_CIRCUIT_OPEN – every resolver's circuit is open.
+         */
+        std::expected<uint16_t, DNS::Error>
+        forward(uint8_t *data, size_t len, const sockaddr_storage &client, uint32_t tcp = 0,
+                uint32_t stream = 0) noexcept;
+
+        /**
+         * @brief The life of one query from any client, as a coroutine.
+         *
+         * Steps performed:
+         *  - Runs classify() as a sender on classifier_ and continues on home_: inline, or on
+         *    the classify pool and back on this worker's loop_. A blocked name is answered
+         *    through respond() straight away.
+         *  - Hands the query to forward() and suspends on its in-flight entry, so the worker
+         *    goes on serving while any number of queries wait for their resolvers.
+         *  - Resumed by matchReply() with the answer, by expireInflight() once timeout_ms
+         *    has passed, or by retryInflight() when every circuit is open, it relays the
+         *    answer or a SERVFAIL (failFast()) and releases the client's TCP or DoH slot.
+         *
+         * Runs synchronously up to the first suspension, so @p data (ID rewritten in place) is
+         * only read before it; a query sent to the classify pool is copied into the frame
+         * first. The frame comes from this Listener's FrameOwner pool.
+         *
+         * @param client Copied into the frame: the answer may come long after the datagram is gone.
+         * @param tcp    TcpConnections (or DohConnections) token if the query came over TCP
+         *               (or HTTPS), 0 for UDP.
+         * @param stream HTTP/2 stream of a DoH query, 0 otherwise.
+         * @param classified The pipeline's classify stage already found the query must be
+         *        forwarded: go straight to forward().
+         */
+        Task resolve(uint8_t *data, size_t len, sockaddr_storage client, uint32_t tcp = 0,
+                     uint32_t stream = 0, bool classified = false) noexcept;
+
+        /**
+         * @brief Sends answer @p msg to a UDP client through clientTx_, or on the TCP or DoH
+         *        connection behind @p tcp.
+         * @return false if it could not be queued or the connection is gone.
+         */
+        bool respond(const sockaddr_storage &client, uint32_t tcp, uint32_t stream, const uint8_t *msg,
+                     size_t len) noexcept;
+
+        /**
+         * @brief Sends every query queued by forward() with one sendmmsg() (sendto loop elsewhere),
+         *        or under the io_uring engine queues them on the ring (queueOnRing()).
+         *
+         * @return DNS::Error::OK on success (or if nothing was queued), or
+         *         UPSTREAM_UNREACHABLE if the first send failed; the affected queries
+         *         stay in flight and time out normally.
          */
-        DNS::Error forward(const uint8_t *data, size_t len, const sockaddr_in &client) noexcept;
+        DNS::Error flushUpstream() noexcept;
 
         /**
          * @brief Strips the scheme/protocol prefix from a URL in-place.
@@ -0,0 +1,305 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+#include <unordered_map>
+#include <vector>
+
+#include "platform.hpp"
+#include "tls.hpp"
+
+namespace DNS::Server {
+
+    /**
+     * @brief A non-blocking TCP socket carrying length-prefixed DNS messages (RFC 1035 4.2.2).
+     *
+     * @param sock       Connected, non-blocking socket.
+     * @param rx         Bytes read but not yet a complete length-prefixed message.
+     * @param tx         Framed messages the socket did not take yet; txOff of them are already sent.
+     * @param stalled    The socket buffer was full and the Poller watches for writability.
+     * @param lastActive Last time a message arrived or went out, for the idle timeout.
+     */
+    struct TcpStream {
+        Platform::socket_t sock { Platform::INVALID_SOCK };
+        std::vector<uint8_t> rx;
+        std::vector<uint8_t> tx;
+        size_t             txOff { 0 };
+        bool               stalled { false };
+        std::chrono::steady_clock::time_point lastActive {};
+    };
+
+    /**
+     * @brief One accepted DNS-over-TCP client connection.
+     *
+     * @param peer       Client address, for logging and the blocklist log lines.
+     * @param token      Handle that in-flight queries carry back to this connection (see TcpConnections).
+     * @param pending    Queries of this connection still waiting for the upstream.
+     */
+    struct TcpConnection : TcpStream {
+        sockaddr_storage   peer {};
+        uint32_t           token { 0 };
+        uint32_t           pending { 0 };
+    };
+
+    /**
+     * @brief The persistent TCP (or TLS) connection to one upstream resolver.
+     *
+     * @param connecting The non-blocking connect has not completed yet; tx waits for it.
+     * @param tls        TLS session on the socket (DNS over TLS), nullptr for plain TCP.
+     * @param handshaking The TLS handshake has not completed yet; tx waits for it.
+     * @param waiting    Upstream IDs sent on this connection and not answered yet.
+     * @param answered   Answers received on this connection.
+     */
+    struct UpstreamStream : TcpStream {
+        bool                  connecting { false };
+        ssl_st               *tls { nullptr };
+        bool                  handshaking { false };
+        std::vector<uint16_t> waiting;
+        uint64_t              answered { 0 };
+    };
+
+    /*
+     *  Framing shared by both kinds of stream.
+     *
+     *      fill(s)        → reads everything queued into s.rx; false on EOF or error
+     *      frame(s, ..)   → appends one message with its 2-byte length prefix to s.tx
+     *      write(s, p)    → writes s.tx, asking Poller p for writability while the socket
+     *                       buffer is full; false on error
+     *      drain(s, fn)   → calls fn(uint8_t *msg, size_t len) for every complete message in
+     *                       s.rx, then drops them; fn returns false to stop (stream closed)
+     */
+    namespace Stream {
+        bool fill(TcpStream &s) noexcept;
+        void frame(TcpStream &s, const uint8_t *msg, size_t len) noexcept;
+        bool write(TcpStream &s, Platform::Poller *poller) noexcept;
+
+        template <typename Fn>
+        void drain(TcpStream &s, Fn &&onMessage) {
+            size_t off = 0;
+            while (s.rx.size() - off >= 2) {
+                const size_t len = static_cast<size_t>(s.rx[off] << 8 | s.rx[off + 1]);
+                if (s.rx.size() - off - 2 < len)
+                    break;
+                if (!onMessage(s.rx.data() + off + 2, len))
+                    return;
+                off += 2 + len;
+            }
+            s.rx.erase(s.rx.begin(), s.rx.begin() + static_cast<std::ptrdiff_t>(off));
+        }
+    }
+
+    /*
+     *  The DNS-over-TCP clients of one worker (RFC 7766).
+     *
+     *      accept(..)  → takes every pending connection off the listening socket
+     *      read(..)    → drains a readable connection and hands each complete message on;
+     *                    pipelined queries are handed on one after another, never waited on
+     *      send(..)    → frames one answer (2-byte length prefix) and writes what the socket takes
+     *      flush(..)   → writes more of a connection's backlog once the socket is writable
+     *      find(token) → the connection an answer belongs to, or nullptr if it closed since
+     *      closeIdle() → drops connections idle for longer than IDLE_TIMEOUT
+     *
+     *  Answers go out in whatever order they complete, which RFC 7766 section 7 allows
+     *  because every answer carries its query's ID. A connection's token is its slot
+     *  index plus a generation, so an answer arriving after the client hung up (and the
+     *  slot was reused) is recognised as stale and dropped.
+     *  Every socket is registered with the Poller given to attach(); a connection with an
+     *  unsent backlog is also watched for writability until the backlog is gone.
+     *  Not thread-safe: each worker owns its own set.
+     */
+    class TcpConnections {
+    public:
+        using clock = std::chrono::steady_clock;
+
+        static constexpr size_t MAX_CONNECTIONS = 1024;
+        // RFC 7766 section 6.2.3 suggests idle timeouts of the order of seconds.
+        static constexpr auto   IDLE_TIMEOUT    = std::chrono::seconds(10);
+        // A client that stops reading its answers is cut off rather than buffered forever.
+        static constexpr size_t MAX_BACKLOG     = 256 * 1024;
+
+        /**
+         * @brief Sets the Poller every accepted socket is registered with (nullptr = none,
+         *        once the event loop that owns it has ended).
+         */
+        void attach(Platform::Poller *poller) noexcept { poller_ = poller; }
+
+        /**
+         * @brief Accepts every connection queued on @p listener (closing any beyond MAX_CONNECTIONS).
+         * @return number of connections accepted.
+         */
+        size_t accept(Platform::socket_t listener) noexcept;
+
+        /**
+         * @brief Reads everything queued on connection @p s and calls
+         *        @p onMessage(TcpConnection&, uint8_t *msg, size_t len) for each complete message.
+         *        Closes the connection on EOF or error.
+         * @return false if @p s is not one of these connections.
+         */
+        template <typename Fn>
+        bool read(Platform::socket_t s, Fn &&onMessage) {
+            const auto it = bySocket_.find(s);
+            if (it == bySocket_.end())
+                return false;
+            TcpConnection &c = slots_[it->second];
+            if (!Stream::fill(c)) {
+                // Orderly shutdown or a hard error; answers still pending are dropped.
+                close(c);
+                return true;
+            }
+
+            // Every complete message in the buffer, in arrival order.
+            Stream::drain(c, [&](uint8_t *msg, size_t len) {
+                onMessage(c, msg, len);
+                // onMessage() may have closed the connection.
+                return c.sock != Platform::INVALID_SOCK;
+            });
+            return true;
+        }
+
+        /**
+         * @brief Queues @p msg on connection @p c with its length prefix and writes as much as
+         *        the socket takes.
+         * @return false if the connection is gone: closed before, failed on write, or closed
+         *         now because its backlog would exceed MAX_BACKLOG.
+         */
+        bool send(TcpConnection &c, const uint8_t *msg, size_t len) noexcept;
+
+        /**
+         * @brief Writes more of the backlog of connection @p s (after the Poller reported it writable).
+         */
+        void flush(Platform::socket_t s) noexcept;
+
+        /**
+         * @brief Returns the open connection holding @p token, or nullptr.
+         */
+        TcpConnection *find(uint32_t token) noexcept;
+
+        /**
+         * @brief Closes every connection idle for IDLE_TIMEOUT with no query pending.
+         */
+        void closeIdle(clock::time_point now) noexcept;
+
+        /**
+         * @brief Closes connection @p c and frees its slot.
+         */
+        void close(TcpConnection &c) noexcept;
+
+        /**
+         * @brief Closes every connection.
+         */
+        void closeAll() noexcept;
+
+        size_t size() const noexcept { return bySocket_.size(); }
+
+    private:
+        std::vector<TcpConnection>  slots_;
+        std::vector<uint16_t>       generations_;
+        std::vector<uint32_t>       free_;
+        std::unordered_map<Platform::socket_t, uint32_t> bySocket_;
+        Platform::Poller           *poller_ { nullptr };
+    };
+
+    /*
+     *  Persistent, pipelined TCP connections to the upstream resolvers of one worker,
+     *  one per resolver, opened on first use and kept open between queries (RFC 7766).
+     *
+     *      send(i, ..)   → queues a query for resolver i, connecting first if needed
+     *      read(s, fn)   → drains a readable connection, fn(upstream, msg, len) per answer
+     *      flush(s)      → completes a pending connect and writes the backlog
+     *      takeOrphans() → queries stranded on a connection the resolver closed
+     *      closeIdle()   → closes connections idle for IDLE_TIMEOUT with nothing waiting
+     *
+     *  Queries are told apart by their upstream ID, so any number can be outstanding on a
+     *  connection and answers may come back in any order. Resolvers close idle or busy
+     *  connections whenever they like; if one closes a connection that had already
+     *  answered something, the queries still waiting on it are handed back through
+     *  takeOrphans() to be sent again on a new one. A connection that never answered is
+     *  not retried, so a resolver refusing TCP cannot cause a reconnect loop.
+     *  Given a TlsClient, every connection runs DNS over TLS (RFC 7858) instead: the
+     *  handshake follows the connect, and queries queued meanwhile go out once it is done.
+     *  Not thread-safe: each worker owns its own set.
+     */
+    class TcpUpstreams {
+    public:
+        using clock = std::chrono::steady_clock;
+
+        static constexpr auto IDLE_TIMEOUT = std::chrono::seconds(20);
+
+        /**
+         * @brief Sizes the set for @p upstreams resolvers, closing any open connection.
+         *        With @p tls (which must outlive the set) every connection speaks TLS.
+         */
+        void init(size_t upstreams, TlsClient *tls = nullptr);
+
+        void attach(Platform::Poller *poller) noexcept { poller_ = poller; }
+
+        /**
+         * @brief Queues query @p msg for resolver @p upstream at @p addr, with its ID field
+         *        replaced by upstream ID @p id on the wire.
+         * @return false if no connection could be opened or the connection failed on write.
+         */
+        bool send(uint8_t upstream, const sockaddr_storage &addr, uint16_t id, const uint8_t *msg, size_t len) noexcept;
+
+        /**
+         * @brief Reads everything queued on connection @p s and calls
+         *        @p onAnswer(uint8_t upstream, uint8_t *msg, size_t len) for each complete answer.
+         * @return false if @p s is not one of these connections.
+         */
+        template <typename Fn>
+        bool read(Platform::socket_t s, Fn &&onAnswer) {
+            const auto it = bySocket_.find(s);
+            if (it == bySocket_.end())
+                return false;
+            const uint8_t upstream = it->second;
+            UpstreamStream &c = streams_[upstream];
+            if (c.connecting || c.handshaking)
+                return true;
+            // Answers that arrived just before the resolver closed are still good.
+            const bool open = c.tls ? Tls::fill(c.tls, c) : Stream::fill(c);
+            Stream::drain(c, [&](uint8_t *msg, size_t len) {
+                if (len >= 2)
+                    answered(c, static_cast<uint16_t>(msg[0] << 8 | msg[1]));
+                onAnswer(upstream, msg, len);
+                return true;
+            });
+            if (!open)
+                close(upstream);
+            return true;
+        }
+
+        /**
+         * @brief Completes a pending connect (and TLS handshake) on @p s and writes its backlog.
+         * @return false if @p s is not one of these connections.
+         */
+        bool flush(Platform::socket_t s) noexcept;
+
+        /**
+         * @brief Whether query @p id is still waiting for its answer on an open connection
+         *        to resolver @p upstream (TCP delivers it; sending it again would not help).
+         */
+        bool waiting(uint8_t upstream, uint16_t id) const noexcept;
+
+        /**
+         * @brief Moves the (upstream, ID) pairs stranded by a closed connection into @p out.
+         */
+        void takeOrphans(std::vector<std::pair<uint8_t, uint16_t>> &out) noexcept;
+
+        void closeIdle(clock::time_point now) noexcept;
+        void closeAll() noexcept;
+
+        size_t size() const noexcept { return bySocket_.size(); }
+
+    private:
+        std::vector<UpstreamStream>                      streams_;
+        std::unordered_map<Platform::socket_t, uint8_t>  bySocket_;
+        std::vector<std::pair<uint8_t, uint16_t>>        orphans_;
+        Platform::Poller                                *poller_ { nullptr };
+        TlsClient                                       *tls_ { nullptr };
+
+        bool handshake(uint8_t upstream) noexcept;
+        bool write(UpstreamStream &c) noexcept;
+        void answered(UpstreamStream &c, uint16_t id) noexcept;
+        void close(uint8_t upstream) noexcept;
+    };
+
+} // namespace DNS::Server
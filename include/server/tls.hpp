@@ -0,0 +1,167 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "../parser/common.hpp"
+#include "platform.hpp"
+
+// DNS over TLS and HTTPS need OpenSSL (link with -lssl -lcrypto); without its headers the
+// classes below still compile but their init() reports failure.
+#if __has_include(<openssl/ssl.h>)
+#define DNS_HAVE_TLS 1
+#endif
+
+// OpenSSL's types, forward-declared so only tls.cpp includes its headers.
+struct ssl_st;
+struct ssl_ctx_st;
+struct ssl_session_st;
+
+namespace DNS::Server {
+
+    struct TcpStream;
+
+    /*
+     *  TLS record I/O shared by the client and server sides, on non-blocking sockets.
+     *
+     *      handshake(tls)    → advances the handshake without blocking
+     *      fill(tls, s)      → decrypts everything queued into s.rx; false on close or error
+     *      write(tls, s, p)  → encrypts and writes s.tx, asking Poller p for writability while
+     *                          the socket buffer is full; false on error
+     *      close(tls)        → sends close_notify (best effort) and frees the session
+     *
+     *  fill() and write() behave like Stream::fill() and Stream::write(), so the same
+     *  framing and pipelining run over either transport.
+     */
+    namespace Tls {
+        enum class Step : uint8_t { DONE, WANT_READ, WANT_WRITE, FAILED };
+
+        /**
+         * @brief Advances the handshake of @p tls. WANT_READ / WANT_WRITE: call again once the
+         *        socket is readable / writable.
+         */
+        Step handshake(ssl_st *tls) noexcept;
+
+        bool fill(ssl_st *tls, TcpStream &s) noexcept;
+        bool write(ssl_st *tls, TcpStream &s, Platform::Poller *poller) noexcept;
+
+        /**
+         * @brief Shuts @p tls down and frees it; sets @p tls to nullptr. The socket stays open.
+         */
+        void close(ssl_st *&tls) noexcept;
+    }
+
+    /*
+     *  Client side of DNS over TLS (RFC 7858) and HTTPS (RFC 8484) for the resolver
+     *  connections of one worker.
+     *
+     *      init(..)          → client context: TLS 1.2 or later, every resolver's certificate
+     *                          verified against a CA file (or the system store) and its name
+     *      open(s, i)        → starts a session on connected socket s to resolver i,
+     *                          offering the session resolver i handed out last time
+     *      handshake(tls)    → Tls::handshake(), counted on the resolver
+     *
+     *  Resumption: every session ticket a resolver issues is kept (one per resolver,
+     *  the latest wins) and offered on the next connection to it, so reconnecting after
+     *  the resolver closed an idle connection skips the certificate exchange and its
+     *  verification (RFC 8446 section 2.2). Each resolver is authenticated by the name
+     *  given after '#' in its address ("1.1.1.1#cloudflare-dns.com", also sent as SNI),
+     *  or, without one, by its IP address in the certificate's subjectAltName.
+     *  Not thread-safe: each worker owns its own client.
+     */
+    class TlsClient {
+    public:
+        using Step = Tls::Step;
+
+        /**
+         * @brief One resolver as TLS sees it.
+         *
+         * @param ip         Its address as text, checked against the certificate without a host.
+         * @param host       Name to authenticate and send as SNI; empty = authenticate ip.
+         * @param session    Last session it issued, offered on the next connection (or nullptr).
+         * @param handshakes Handshakes completed with it.
+         * @param resumed    ... of which resumed an earlier session.
+         * @param failed     Handshakes that failed: refused, or a certificate that is not
+         *                   trusted or not the resolver's.
+         */
+        struct Peer {
+            std::string     ip;
+            std::string     host;
+            ssl_session_st *session    { nullptr };
+            uint64_t        handshakes { 0 };
+            uint64_t        resumed    { 0 };
+            uint64_t        failed     { 0 };
+        };
+
+        TlsClient() = default;
+        TlsClient(const TlsClient &) = delete;
+        TlsClient &operator=(const TlsClient &) = delete;
+        ~TlsClient() noexcept;
+
+        /**
+         * @brief Creates the client context for @p peers, trusting the CAs in PEM file @p caFile
+         *        (empty = the system's default trust store). With @p http2 every session offers
+         *        ALPN "h2", for DNS over HTTPS.
+         * @return DNS::Error::OK, or UPSTREAM_TLS_FAIL if TLS is unavailable in this build or
+         *         the context or CA file could not be set up.
+         */
+        DNS::Error init(std::vector<Peer> peers, const std::string &caFile, bool http2 = false) noexcept;
+
+        bool enabled() const noexcept { return ctx_ != nullptr; }
+
+        /**
+         * @brief Starts a client session to resolver @p upstream on connected socket @p s.
+         * @return the session, or nullptr if it could not be created.
+         */
+        ssl_st *open(Platform::socket_t s, uint8_t upstream) noexcept;
+
+        /**
+         * @brief Tls::handshake() on @p tls; DONE and FAILED are counted on its resolver.
+         */
+        Step handshake(ssl_st *tls) noexcept;
+
+        const Peer &peer(uint8_t upstream) const noexcept { return peers_[upstream]; }
+
+    private:
+        ssl_ctx_st        *ctx_ { nullptr };
+        std::vector<Peer>  peers_;
+
+        // OpenSSL's new-session callback: keeps the ticket for the connection's resolver.
+        static int onSession(ssl_st *tls, ssl_session_st *session);
+        void reset() noexcept;
+    };
+
+    /*
+     *  Server side of TLS for the DNS-over-HTTPS listener: one certificate chain and key,
+     *  ALPN "h2" only (RFC 8484 section 5.2 wants HTTP/2), session tickets on so clients
+     *  resume. Not thread-safe: each worker owns its own server context.
+     */
+    class TlsServer {
+    public:
+        TlsServer() = default;
+        TlsServer(const TlsServer &) = delete;
+        TlsServer &operator=(const TlsServer &) = delete;
+        ~TlsServer() noexcept;
+
+        /**
+         * @brief Loads the PEM certificate chain @p certFile and its private key @p keyFile.
+         * @return DNS::Error::OK, or SERVER_TLS_FAIL if TLS is unavailable in this build or
+         *         either file could not be loaded.
+         */
+        DNS::Error init(const std::string &certFile, const std::string &keyFile) noexcept;
+
+        bool enabled() const noexcept { return ctx_ != nullptr; }
+
+        /**
+         * @brief Starts the server side of a session on accepted socket @p s; the handshake
+         *        then runs through Tls::handshake().
+         * @return the session, or nullptr if it could not be created.
+         */
+        ssl_st *accept(Platform::socket_t s) noexcept;
+
+    private:
+        ssl_ctx_st *ctx_ { nullptr };
+    };
+
+} // namespace DNS::Server
@@ -0,0 +1,187 @@
+#pragma once
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "../parser/common.hpp"
+#include "platform.hpp"
+
+namespace DNS::Server {
+
+    /**
+     * @brief One upstream resolver and what this worker has learned about it.
+     *
+     * @param addr      Resolver address (port 53, or 853 for DNS over TLS); IPv4 resolvers are
+     *                  held IPv4-mapped when the pool also has IPv6 ones (see UpstreamPool::family()).
+     * @param name      Dotted address, kept for logging.
+     * @param tlsName   Name its TLS certificate must carry (given as "address#name"); empty =
+     *                  the certificate must carry its address.
+     * @param srttMs    EWMA of the round-trip time in ms (TCP's SRTT); 0 until the first answer.
+     * @param rttvarMs  EWMA of the RTT deviation in ms (TCP's RTTVAR), for the retransmit timeout.
+     * @param loss      EWMA of the timeout rate, 0.0 (always answers) .. 1.0 (never answers).
+     * @param failures  Consecutive timeouts since the last answer.
+     * @param open      Circuit breaker state: while open the resolver gets no client traffic,
+     *                  only probes, until one of them (or any late answer) is answered.
+     * @param probing   A probe is in flight.
+     * @param nextProbe When the next probe is due while open.
+     * @param probeMisses Probes in a row that went unanswered, for the probe backoff.
+     * @param rtts      The last RTT_WINDOW RTT samples in ms (ring), for p95Ms.
+     * @param p95Ms     95th percentile of rtts; 0 until MIN_P95_SAMPLES answers arrived.
+     */
+    struct Upstream {
+        using clock = std::chrono::steady_clock;
+        static constexpr size_t RTT_WINDOW      = 64;
+        static constexpr size_t MIN_P95_SAMPLES = 8;
+
+        sockaddr_storage  addr {};
+        std::string       name;
+        std::string       tlsName;
+        double            srttMs   { 0.0 };
+        double            rttvarMs { 0.0 };
+        double            loss     { 0.0 };
+        uint32_t          failures { 0 };
+        bool              open     { false };
+        bool              probing  { false };
+        clock::time_point nextProbe {};
+        uint32_t          probeMisses { 0 };
+        std::array<float, RTT_WINDOW> rtts {};
+        double            p95Ms    { 0.0 };
+
+        uint64_t sent      { 0 };
+        uint64_t answered  { 0 };
+        uint64_t timedOut  { 0 };
+        uint64_t hedged    { 0 };   // duplicates sent here because another resolver was slow
+        uint64_t hedgeWins { 0 };   // ... and answered first
+        uint64_t retransmits { 0 }; // attempts sent here after an earlier attempt missed its RTO
+        uint64_t opened    { 0 };   // times the circuit breaker opened
+        uint64_t probes    { 0 };   // probe queries sent while open
+        uint64_t truncated { 0 };   // UDP answers with TC set, asked again over TCP
+    };
+
+    /*
+     *  The upstream resolvers of one worker and the routing policy between them.
+     *
+     *      pick()       → the fastest resolver with a closed circuit: lowest srtt / (1 - loss)
+     *      onAnswer()   → feeds an RTT sample, clears the failure streak, closes the circuit
+     *      onTimeout()  → feeds a loss sample; OPEN_AFTER timeouts in a row open the circuit
+     *      dueProbes()  → open resolvers due for a probe (PROBE_INTERVAL, doubling per
+     *                     unanswered probe up to PROBE_MAX_INTERVAL)
+     *      hedgeDelay() → how long to wait for resolver i before asking a second one (its p95)
+     *      rto()        → how long to wait for resolver i before retransmitting, RFC 6298
+     *                     style: srtt + 4 * rttvar, clamped to [RTO_FLOOR, RTO_CEILING]
+     *      pickOther()  → the best healthy resolver other than i, for hedges and retransmits
+     *
+     *  Resolvers without an RTT sample yet score best, so each one is measured early on,
+     *  and every EXPLORE_EVERY-th pick goes round-robin so estimates of the slower ones
+     *  do not go stale. An open circuit only closes on an answer, so client queries never
+     *  pay for finding out that a dead resolver is still dead; if every circuit is open,
+     *  pick() has nothing to offer and the caller answers SERVFAIL straight away.
+     *  Not thread-safe: each worker owns its own pool.
+     */
+    class UpstreamPool {
+    public:
+        using clock = Upstream::clock;
+
+        // Upstream indices travel in one byte (InflightTable::Entry::upstream).
+        static constexpr size_t   MAX_UPSTREAMS  = 255;
+        static constexpr double   RTT_ALPHA      = 0.125;   // same gain as TCP's SRTT
+        static constexpr double   LOSS_ALPHA     = 0.1;
+        static constexpr uint32_t OPEN_AFTER     = 3;
+        static constexpr auto     PROBE_INTERVAL = std::chrono::milliseconds(500);
+        static constexpr auto     PROBE_MAX_INTERVAL = std::chrono::seconds(8);
+        static constexpr uint32_t EXPLORE_EVERY  = 64;
+        static constexpr double   RTTVAR_BETA    = 0.25;    // same gain as TCP's RTTVAR
+        // Hedging earlier than this costs more duplicate traffic than it saves latency.
+        static constexpr auto     HEDGE_FLOOR    = std::chrono::milliseconds(10);
+        // A recursive resolver answering from its cache replies in a few ms; a cache miss
+        // can legitimately take a few hundred. The floor keeps retransmits from racing
+        // the miss, the ceiling keeps a noisy estimate from pushing retries out to seconds.
+        static constexpr auto     RTO_INITIAL    = std::chrono::milliseconds(1000);
+        static constexpr auto     RTO_FLOOR      = std::chrono::milliseconds(50);
+        static constexpr auto     RTO_CEILING    = std::chrono::milliseconds(2000);
+
+        /**
+         * @brief Parses @p ips ("address" or "address#tls-name") into the pool, replacing its
+         *        contents; every resolver is reached on @p port.
+         * @return DNS::Error::OK, or INVALID_IP if the list is empty, too long or holds
+         *         something that is not an IPv4 or IPv6 address.
+         */
+        DNS::Error init(const std::vector<std::string> &ips, uint16_t port = DNS::Port::DNS) noexcept;
+
+        /**
+         * @brief Address family of the socket that reaches every resolver: AF_INET6 (dual-stack)
+         *        as soon as one of them is IPv6, AF_INET otherwise.
+         */
+        int family() const noexcept { return family_; }
+
+        /**
+         * @brief Chooses the resolver for the next query and counts it as sent.
+         * @return std::nullopt if every circuit is open.
+         */
+        std::optional<uint8_t> pick() noexcept;
+
+        /**
+         * @brief Records an answer (to a query or a probe) from resolver @p i that took @p rtt.
+         * @return true if this answer just closed the resolver's circuit.
+         */
+        bool onAnswer(uint8_t i, clock::duration rtt) noexcept;
+
+        /**
+         * @brief Records a query to resolver @p i that went unanswered.
+         * @return true if this timeout just opened the resolver's circuit.
+         */
+        bool onTimeout(uint8_t i, clock::time_point now) noexcept;
+
+        /**
+         * @brief Appends to @p out every open resolver whose next probe is due, marks
+         *        each one as probing and counts the probe.
+         * @return number of resolvers appended.
+         */
+        size_t dueProbes(clock::time_point now, std::vector<uint8_t> &out) noexcept;
+
+        /**
+         * @brief Records a probe to resolver @p i that went unanswered and backs off the next one.
+         */
+        void onProbeTimeout(uint8_t i, clock::time_point now) noexcept;
+
+        /**
+         * @brief Milliseconds until the next probe is due (0 if already due), or -1 if none is.
+         */
+        int msUntilNextProbe(clock::time_point now) const noexcept;
+
+        /**
+         * @brief Chooses a healthy resolver other than @p exclude and counts it as sent.
+         * @return std::nullopt if there is no other healthy resolver.
+         */
+        std::optional<uint8_t> pickOther(uint8_t exclude) noexcept;
+
+        /**
+         * @brief The hedge delay for resolver @p i: its p95 RTT, at least HEDGE_FLOOR.
+         * @return std::nullopt while fewer than Upstream::MIN_P95_SAMPLES answers are known.
+         */
+        std::optional<clock::duration> hedgeDelay(uint8_t i) const noexcept;
+
+        /**
+         * @brief The retransmit timeout for resolver @p i, doubled @p backoff times and
+         *        clamped to [RTO_FLOOR, RTO_CEILING]. RTO_INITIAL until the first answer.
+         */
+        clock::duration rto(uint8_t i, uint8_t backoff = 0) const noexcept;
+
+        Upstream       &operator[](uint8_t i) noexcept       { return upstreams_[i]; }
+        const Upstream &operator[](uint8_t i) const noexcept { return upstreams_[i]; }
+        size_t size() const noexcept { return upstreams_.size(); }
+
+    private:
+        std::vector<Upstream> upstreams_;
+        std::array<float, Upstream::RTT_WINDOW> scratch_ {};
+        uint32_t              picks_ { 0 };
+        int                   family_ { AF_INET };
+
+        // Lower is better: expected time to an answer, srtt inflated by the loss rate.
+        static double score(const Upstream &u) noexcept;
+    };
+
+} // namespace DNS::Server
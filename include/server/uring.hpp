@@ -0,0 +1,185 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+#include "platform.hpp"
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#define DNS_HAVE_URING 1
+#include <linux/io_uring.h>
+#endif
+
+namespace DNS::Server {
+
+    /*
+     *  Minimal io_uring wrapper over the raw syscalls (no liburing dependency).
+     *
+     *  Only the pieces the Listener needs:
+     *      init(n)              → io_uring_setup + mmap of the SQ/CQ rings and SQE array
+     *      addBufferRing(g,...) → provided-buffer ring for group g; the kernel picks a
+     *                             buffer per datagram, so a multishot recv needs no re-arming
+     *      registerBuffers(..)  → one fixed region for outgoing datagrams (IORING_REGISTER_BUFFERS)
+     *      recvMultishot(..)    → one RECVMSG SQE that keeps producing a CQE per datagram
+     *      sendTo(..)           → SEND_ZC from the registered region, plain SEND as fallback
+     *      submitAndWait(..)    → one io_uring_enter() that submits and waits, with a timeout
+     *      hasCompletions()     → whether forEachCompletion() has anything, without a syscall
+ *      forEachCompletion(f) → walks all ready CQEs and advances the CQ head once
+     *
+     *  The ring is single-threaded: create it and drive it from the same worker thread.
+     */
+    class Uring {
+    public:
+        // Bytes the kernel prepends in a provided buffer for a multishot recvmsg:
+        // io_uring_recvmsg_out, then room for the source address (IPv4 or IPv6), then the payload.
+        static constexpr size_t RECV_HEADROOM = 16 + sizeof(sockaddr_storage);
+
+        Uring() = default;
+        Uring(const Uring &) = delete;
+        Uring &operator=(const Uring &) = delete;
+        ~Uring() noexcept;
+
+        /**
+         * @brief Creates the ring with @p entries SQEs (CQ sized 4x for multishot bursts).
+         * @return false if io_uring is unavailable (old kernel, seccomp, non-Linux).
+         */
+        bool init(unsigned entries) noexcept;
+
+        /**
+         * @brief Registers a provided-buffer ring for group @p bgid with @p count buffers of @p size bytes.
+         * @param count Must be a power of two.
+         * @return false if the kernel rejects the registration.
+         */
+        bool addBufferRing(uint16_t bgid, uint16_t count, uint32_t size) noexcept;
+
+        /**
+         * @brief Returns buffer @p bid of group @p bgid.
+         */
+        uint8_t *buffer(uint16_t bgid, uint16_t bid) noexcept;
+
+        /**
+         * @brief Hands buffer @p bid back to group @p bgid so the kernel can fill it again.
+         */
+        void recycle(uint16_t bgid, uint16_t bid) noexcept;
+
+        /**
+         * @brief Registers [base, base+len) as fixed buffer index 0 for sendTo().
+         */
+        bool registerBuffers(uint8_t *base, size_t len) noexcept;
+
+        /**
+         * @brief Queues a multishot RECVMSG on @p s selecting buffers from group @p bgid.
+         * @return false if the SQ is full.
+         */
+        bool recvMultishot(Platform::socket_t s, uint16_t bgid, uint64_t tag) noexcept;
+
+        /**
+         * @brief Queues a one-shot POLL_ADD waiting for @p fd to become readable (re-arm after
+         *        each completion). Lets the ring wake up for a descriptor it does not drive
+         *        itself, such as an epoll instance.
+         * @return false if the SQ is full.
+         */
+        bool pollReadable(int fd, uint64_t tag) noexcept;
+
+        /**
+         * @brief Queues a sendto of @p len bytes at @p data (inside the registered region) to @p to.
+         *
+         * @p to must stay valid until the completion arrives. With zero-copy enabled the
+         * buffer must also stay untouched until the IORING_CQE_F_NOTIF completion.
+         *
+         * @return false if the SQ is full.
+         */
+        bool sendTo(Platform::socket_t s, const uint8_t *data, size_t len,
+                    const sockaddr_storage *to, uint64_t tag) noexcept;
+
+        /**
+         * @brief Submits queued SQEs and waits for at least one completion or @p timeout_ms.
+         * @return number of SQEs submitted, or a negative errno.
+         */
+        int submitAndWait(int timeout_ms) noexcept;
+
+        bool zeroCopy() const noexcept { return zeroCopy_; }
+        void disableZeroCopy() noexcept { zeroCopy_ = false; }
+
+        /**
+         * @brief true if a CQE is ready; looks at the CQ ring only, without entering the kernel.
+         */
+        bool hasCompletions() const noexcept {
+#ifdef DNS_HAVE_URING
+            return *cqHead_ != __atomic_load_n(cqTail_, __ATOMIC_ACQUIRE);
+#else
+            return false;
+#endif
+        }
+
+        struct Completion {
+            uint64_t tag;
+            int32_t  res;
+            uint32_t flags;
+        };
+
+        /**
+         * @brief Calls @p fn(const Completion&) for every ready CQE, then releases them.
+         * @return number of completions processed.
+         */
+        template <typename Fn>
+        unsigned forEachCompletion(Fn &&fn) noexcept {
+#ifdef DNS_HAVE_URING
+            unsigned head = *cqHead_;
+            const unsigned tail = __atomic_load_n(cqTail_, __ATOMIC_ACQUIRE);
+            unsigned n = 0;
+            for (; head != tail; ++head, ++n) {
+                const io_uring_cqe &cqe = cqes_[head & cqMask_];
+                fn(Completion{ cqe.user_data, cqe.res, cqe.flags });
+            }
+            __atomic_store_n(cqHead_, head, __ATOMIC_RELEASE);
+            return n;
+#else
+            (void)fn;
+            return 0;
+#endif
+        }
+
+    private:
+#ifdef DNS_HAVE_URING
+        struct BufferRing {
+            uint16_t         bgid   { 0 };
+            uint16_t         mask   { 0 };
+            uint32_t         size   { 0 };
+            io_uring_buf_ring *ring { nullptr };
+            size_t           ringBytes { 0 };
+            std::vector<uint8_t> storage;
+        };
+
+        int       fd_ { -1 };
+        void     *sqMap_ { nullptr };
+        size_t    sqMapLen_ { 0 };
+        void     *cqMap_ { nullptr };
+        size_t    cqMapLen_ { 0 };
+        io_uring_sqe *sqes_ { nullptr };
+        size_t    sqesLen_ { 0 };
+
+        unsigned *sqHead_ { nullptr };
+        unsigned *sqTail_ { nullptr };
+        unsigned *sqArray_ { nullptr };
+        unsigned  sqMask_ { 0 };
+        unsigned  sqEntries_ { 0 };
+        unsigned  sqLocalTail_ { 0 };
+
+        unsigned *cqHead_ { nullptr };
+        unsigned *cqTail_ { nullptr };
+        unsigned  cqMask_ { 0 };
+        io_uring_cqe *cqes_ { nullptr };
+
+        std::vector<BufferRing> rings_;
+        msghdr    recvHdr_ {};
+
+        io_uring_sqe *nextSqe() noexcept;
+        BufferRing   *ring(uint16_t bgid) noexcept;
+        static io_uring_buf *entries(BufferRing &br) noexcept;
+#endif
+        uint8_t  *fixedBase_ { nullptr };
+        bool      zeroCopy_ { true };
+    };
+
+} // namespace DNS::Server
@@ -4,6 +4,8 @@
 #include <string_view>
 #include <filesystem>
 #include <cstdlib>
+#include <algorithm>
+#include <thread>
 
 namespace fs = std::filesystem;
 
@@ -11,10 +13,32 @@ void printUsage(std::string_view progName) {
     std::println("Usage: {} [OPTIONS] [BLOCKLIST_FILES...]", progName);
     std::println("");
     std::println("Options:");
-    std::println("  --ip <addr>       Local IP to bind to        (default: 0.0.0.0)");
+    std::println("  --ip <addr>       Local IPv4/IPv6 to bind to, :: = dual-stack (default: 0.0.0.0)");
     std::println("  --port <port>     UDP port to listen on      (default: 53)");
-    std::println("  --upstream <addr> Upstream resolver IP       (default: 8.8.8.8)");
-    std::println("  --timeout <ms>    Upstream timeout (ms)      (default: 5000)");
+    std::println("  --upstream <addr> Upstream resolver IP, repeat or comma-separate for several (default: 8.8.8.8)");
+    std::println("  --timeout <ms>    Total upstream time per query, retransmits included (ms) (default: 5000)");
+    std::println("  --batch <n>       Datagrams per syscall      (default: 1, max: 256)");
+    std::println("  --workers <n>     Worker threads, 0 = cores  (default: 1)");
+    std::println("  --affinity        Pin each client IP to one worker (Linux, with --workers)");
+    std::println("  --io-uring        Use the io_uring I/O engine (Linux 6.0+)");
+    std::println("  --classify-threads <n>");
+    std::println("                    Parse and check queries on a pool of n threads, 0 = inline (default: 0)");
+    std::println("  --pipeline        Run receive, classify, upstream and send as pipelined threads");
+    std::println("  --busy-poll <us>  Spin this long on the sockets before sleeping, 0 = off (default: 0)");
+    std::println("  --first-core <n>  Pin workers (or pipeline stages) to cores n, n+1, ... (default: 0)");
+    std::println("  --no-hedge        Never send hedged duplicates to a second upstream");
+    std::println("  --no-tcp          Do not accept DNS over TCP on the same port");
+    std::println("  --no-prefilter    Do not drop junk datagrams in the kernel (BPF socket filter, Linux)");
+    std::println("  --upstream-tcp    Send every query upstream over persistent TCP connections");
+    std::println("  --upstream-tls    Send every query upstream over DNS over TLS (port 853);");
+    std::println("                    --upstream <addr>#<name> checks the certificate against <name>");
+    std::println("  --upstream-doh    Send every query upstream over DNS over HTTPS (port 443, HTTP/2)");
+    std::println("  --tls-ca <file>   PEM CA file for --upstream-tls/-doh (default: system trust store)");
+    std::println("  --doh <port>      Also serve DNS over HTTPS (HTTP/2) on this port at /dns-query");
+    std::println("  --doh-cert <file> PEM certificate chain for --doh");
+    std::println("  --doh-key <file>  PEM private key for --doh");
+    std::println("  --edns-size <n>   EDNS0 UDP payload size advertised upstream, 512-4096 (default: 1232)");
+    std::println("  --stats <s>       Upstream stats interval, 0 = off (default: 60)");
     std::println("  --help            Show this message");
     std::println("");
     std::println("Blocklist path shorthands:");
@@ -80,11 +104,28 @@ int main(int argc, char* argv[]) {
     DNS::Server::Config config{
         .serverIp     = "0.0.0.0",
         .portServerIp = 53,
-        .upstreamIp   = "8.8.8.8",
+        .upstreamIps  = { "8.8.8.8" },
         .timeout_ms   = 5000,
+        .batchSize    = 1,
+        .workers      = 1,
+        .clientAffinity = false,
+        .engine       = DNS::Server::IoEngine::POLL,
+        .hedging      = true,
+        .statsInterval_s = 60,
+        .tcp          = true,
+        .prefilter    = true,
+        .upstreamTcp  = false,
+        .upstreamTls  = false,
+        .upstreamDoh  = false,
+        .tlsCaFile    = {},
+        .dohPort      = 0,
+        .dohCert      = {},
+        .dohKey       = {},
+        .ednsPayload  = DNS::Limits::SAFE_EDNS_PAYLOAD,
     };
 
     std::vector<std::string> blocklistFiles;
+    bool upstreamGiven = false;
     auto args = std::span(argv, argc);
 
     for (int i = 1; i < argc; ++i) {
@@ -104,13 +145,109 @@ int main(int argc, char* argv[]) {
         }
         else if (arg == "--upstream") {
             if (++i >= argc) { std::println(stderr, "[ERROR] --upstream requires an argument."); return 1; }
-            config.upstreamIp = args[i];
+            // Repeatable and comma-separated; the first use replaces the default.
+            if (!upstreamGiven) config.upstreamIps.clear();
+            upstreamGiven = true;
+            std::string_view list = args[i];
+            while (!list.empty()) {
+                const size_t comma = list.find(',');
+                if (auto ip = list.substr(0, comma); !ip.empty())
+                    config.upstreamIps.emplace_back(ip);
+                list = comma == std::string_view::npos ? std::string_view{} : list.substr(comma + 1);
+            }
         }
         else if (arg == "--timeout") {
             if (++i >= argc) { std::println(stderr, "[ERROR] --timeout requires an argument."); return 1; }
             try { config.timeout_ms = static_cast<uint32_t>(std::stoul(args[i])); }
             catch (...) { std::println(stderr, "[ERROR] Invalid timeout: {}", args[i]);          return 1; }
         }
+        else if (arg == "--batch") {
+            if (++i >= argc) { std::println(stderr, "[ERROR] --batch requires an argument.");   return 1; }
+            try { config.batchSize = static_cast<uint32_t>(std::stoul(args[i])); }
+            catch (...) { std::println(stderr, "[ERROR] Invalid batch size: {}", args[i]);       return 1; }
+        }
+        else if (arg == "--affinity") {
+            config.clientAffinity = true;
+        }
+        else if (arg == "--io-uring") {
+            config.engine = DNS::Server::IoEngine::URING;
+        }
+        else if (arg == "--pipeline") {
+            config.pipeline = true;
+        }
+        else if (arg == "--no-hedge") {
+            config.hedging = false;
+        }
+        else if (arg == "--no-tcp") {
+            config.tcp = false;
+        }
+        else if (arg == "--no-prefilter") {
+            config.prefilter = false;
+        }
+        else if (arg == "--upstream-tcp") {
+            config.upstreamTcp = true;
+        }
+        else if (arg == "--upstream-tls") {
+            config.upstreamTls = true;
+        }
+        else if (arg == "--upstream-doh") {
+            config.upstreamDoh = true;
+        }
+        else if (arg == "--tls-ca") {
+            if (++i >= argc) { std::println(stderr, "[ERROR] --tls-ca requires an argument.");  return 1; }
+            config.tlsCaFile = args[i];
+        }
+        else if (arg == "--doh") {
+            if (++i >= argc) { std::println(stderr, "[ERROR] --doh requires an argument.");     return 1; }
+            try { config.dohPort = static_cast<uint16_t>(std::stoul(args[i])); }
+            catch (...) { std::println(stderr, "[ERROR] Invalid port: {}", args[i]);             return 1; }
+        }
+        else if (arg == "--doh-cert") {
+            if (++i >= argc) { std::println(stderr, "[ERROR] --doh-cert requires an argument."); return 1; }
+            config.dohCert = args[i];
+        }
+        else if (arg == "--doh-key") {
+            if (++i >= argc) { std::println(stderr, "[ERROR] --doh-key requires an argument.");  return 1; }
+            config.dohKey = args[i];
+        }
+        else if (arg == "--edns-size") {
+            if (++i >= argc) { std::println(stderr, "[ERROR] --edns-size requires an argument."); return 1; }
+            unsigned long size = 0;
+            try { size = std::stoul(args[i]); }
+            catch (...) { std::println(stderr, "[ERROR] Invalid EDNS payload size: {}", args[i]); return 1; }
+            if (size < DNS::Limits::MAX_UDP_PACKET || size > DNS::Limits::MAX_EDNS_PAYLOAD) {
+                std::println(stderr, "[ERROR] EDNS payload size must be 512-4096: {}", args[i]);
+                return 1;
+            }
+            config.ednsPayload = static_cast<uint16_t>(size);
+        }
+        else if (arg == "--stats") {
+            if (++i >= argc) { std::println(stderr, "[ERROR] --stats requires an argument.");   return 1; }
+            try { config.statsInterval_s = static_cast<uint32_t>(std::stoul(args[i])); }
+            catch (...) { std::println(stderr, "[ERROR] Invalid stats interval: {}", args[i]);   return 1; }
+        }
+        else if (arg == "--classify-threads") {
+            if (++i >= argc) { std::println(stderr, "[ERROR] --classify-threads requires an argument."); return 1; }
+            try { config.classifyThreads = static_cast<uint32_t>(std::stoul(args[i])); }
+            catch (...) { std::println(stderr, "[ERROR] Invalid classify thread count: {}", args[i]); return 1; }
+        }
+        else if (arg == "--busy-poll") {
+            if (++i >= argc) { std::println(stderr, "[ERROR] --busy-poll requires an argument."); return 1; }
+            try { config.busyPoll_us = static_cast<uint32_t>(std::stoul(args[i])); }
+            catch (...) { std::println(stderr, "[ERROR] Invalid busy-poll budget: {}", args[i]); return 1; }
+        }
+        else if (arg == "--first-core") {
+            if (++i >= argc) { std::println(stderr, "[ERROR] --first-core requires an argument."); return 1; }
+            try { config.firstCore = static_cast<uint32_t>(std::stoul(args[i])); }
+            catch (...) { std::println(stderr, "[ERROR] Invalid core: {}", args[i]);             return 1; }
+        }
+        else if (arg == "--workers") {
+            if (++i >= argc) { std::println(stderr, "[ERROR] --workers requires an argument."); return 1; }
+            try { config.workers = static_cast<uint32_t>(std::stoul(args[i])); }
+            catch (...) { std::println(stderr, "[ERROR] Invalid worker count: {}", args[i]);     return 1; }
+            if (config.workers == 0)
+                config.workers = std::max(1u, std::thread::hardware_concurrency());
+        }
         else if (arg.starts_with("--")) {
             std::println(stderr, "[ERROR] Unknown option: {}", arg);
             printUsage(args[0]); return 1;
@@ -128,8 +265,33 @@ int main(int argc, char* argv[]) {
     }
 
     std::println("[INFO] Binding to        {}:{}", config.serverIp, config.portServerIp);
-    std::println("[INFO] Upstream resolver {}", config.upstreamIp);
+    for (const auto &ip : config.upstreamIps)
+        std::println("[INFO] Upstream resolver {}", ip);
     std::println("[INFO] Upstream timeout  {} ms", config.timeout_ms);
+    std::println("[INFO] Hedging           {}", config.hedging ? "on" : "off");
+    std::println("[INFO] DNS over TCP      {}", config.tcp ? "on" : "off");
+    std::println("[INFO] Query prefilter   {}", config.prefilter ? "on" : "off");
+    if (config.dohPort != 0)
+        std::println("[INFO] DNS over HTTPS    port {}", config.dohPort);
+    std::println("[INFO] Upstream over     {}", config.upstreamDoh ? "HTTPS (HTTP/2)" : config.upstreamTls ? "TLS" :
+                 config.upstreamTcp ? "TCP" : "UDP (TCP for truncated answers)");
+    std::println("[INFO] EDNS payload      {} bytes", config.ednsPayload);
+    std::println("[INFO] I/O engine        {}", config.engine == DNS::Server::IoEngine::URING ? "io_uring" : "poll");
+    std::println("[INFO] Batch size        {}", config.batchSize);
+    std::println("[INFO] Workers           {}{}", config.workers,
+                 config.clientAffinity ? " (client affinity)" : "");
+    if (config.pipeline)
+        std::println("[INFO] Pipeline          receive / classify / upstream / send threads");
+    if (config.classifyThreads > 0)
+        std::println("[INFO] Classify pool     {} thread(s)", config.classifyThreads);
+    else
+        std::println("[INFO] Classify pool     off (inline)");
+    if (config.busyPoll_us > 0)
+        std::println("[INFO] Busy poll         {} us before sleeping", config.busyPoll_us);
+    else
+        std::println("[INFO] Busy poll         off");
+    if (config.firstCore > 0)
+        std::println("[INFO] First core        {}", config.firstCore);
 
     DNS::Server::Listener server;
 
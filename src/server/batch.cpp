@@ -0,0 +1,130 @@
+#include "../../include/server/batch.hpp"
+#include "../../include/parser/common.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+namespace DNS::Server {
+
+    void DatagramBatch::reset(size_t capacity) {
+        capacity = std::clamp<size_t>(capacity, 1, MAX_CAPACITY);
+        storage_.reset(capacity);
+        lens_.assign(capacity, 0);
+        addrs_.assign(capacity, sockaddr_storage{});
+#if defined(__linux__)
+        hdrs_.assign(capacity, mmsghdr{});
+        iov_.assign(capacity, iovec{});
+#endif
+        count_ = 0;
+    }
+
+    uint8_t *DatagramBatch::data(size_t i) noexcept {
+        return storage_.data(static_cast<uint32_t>(i));
+    }
+
+    bool DatagramBatch::push(const uint8_t *data, size_t len, const sockaddr_storage &to) noexcept {
+        if (count_ >= capacity() || len > DNS::Limits::MAX_EDNS_PAYLOAD)
+            return false;
+        std::memcpy(this->data(count_), data, len);
+        lens_[count_]  = len;
+        addrs_[count_] = to;
+        ++count_;
+        return true;
+    }
+
+#if defined(__linux__)
+
+    void DatagramBatch::prepare(size_t n, bool forRecv) noexcept {
+        for (size_t i = 0; i < n; ++i) {
+            iov_[i].iov_base = data(i);
+            iov_[i].iov_len  = forRecv ? DNS::Limits::MAX_EDNS_PAYLOAD : lens_[i];
+
+            msghdr &h = hdrs_[i].msg_hdr;
+            h = msghdr{};
+            h.msg_name    = &addrs_[i];
+            h.msg_namelen = forRecv ? sizeof(sockaddr_storage) : Platform::addressLength(addrs_[i]);
+            h.msg_iov     = &iov_[i];
+            h.msg_iovlen  = 1;
+            hdrs_[i].msg_len = 0;
+        }
+    }
+
+    int DatagramBatch::recv(Platform::socket_t s) noexcept {
+        count_ = 0;
+        prepare(capacity(), true);
+
+        const int n = recvmmsg(s, hdrs_.data(), static_cast<unsigned>(capacity()), MSG_DONTWAIT, nullptr);
+        if (n < 0)
+            return Platform::isWouldBlock(Platform::lastError()) ? 0 : -1;
+
+        for (int i = 0; i < n; ++i)
+            lens_[i] = hdrs_[i].msg_len;
+        count_ = static_cast<size_t>(n);
+        return n;
+    }
+
+    int DatagramBatch::send(Platform::socket_t s) noexcept {
+        const size_t total = count_;
+        size_t done = 0;
+        prepare(total, false);
+
+        // sendmmsg may stop early (e.g. the send buffer filled up); resume from where it left off.
+        while (done < total) {
+            const int n = sendmmsg(s, hdrs_.data() + done, static_cast<unsigned>(total - done), MSG_DONTWAIT);
+            if (n <= 0) {
+                const int err = Platform::lastError();
+                if (n < 0 && Platform::isInterrupted(err))
+                    continue;
+                // An ICMP error queued by an earlier send aborts only this slot; skip it.
+                if (n < 0 && Platform::isConnReset(err)) {
+                    ++done;
+                    continue;
+                }
+                break;
+            }
+            done += static_cast<size_t>(n);
+        }
+
+        count_ = 0;
+        return (done == 0 && total > 0) ? -1 : static_cast<int>(done);
+    }
+
+#else
+
+    int DatagramBatch::recv(Platform::socket_t s) noexcept {
+        count_ = 0;
+        while (count_ < capacity()) {
+            Platform::socklen_t fromLen = sizeof(sockaddr_storage);
+            const int n = static_cast<int>(recvfrom(s, reinterpret_cast<char *>(data(count_)),
+                    static_cast<int>(DNS::Limits::MAX_EDNS_PAYLOAD), 0,
+                    reinterpret_cast<sockaddr *>(&addrs_[count_]), &fromLen));
+            if (n == Platform::SOCK_ERR) {
+                const int err = Platform::lastError();
+                if (Platform::isConnReset(err))
+                    continue;
+                if (Platform::isWouldBlock(err) || count_ > 0)
+                    break;
+                return -1;
+            }
+            lens_[count_++] = static_cast<size_t>(n);
+        }
+        return static_cast<int>(count_);
+    }
+
+    int DatagramBatch::send(Platform::socket_t s) noexcept {
+        const size_t total = count_;
+        size_t done = 0;
+        for (size_t i = 0; i < total; ++i) {
+            const int n = static_cast<int>(sendto(s, reinterpret_cast<const char *>(data(i)),
+                    static_cast<int>(lens_[i]), 0,
+                    reinterpret_cast<const sockaddr *>(&addrs_[i]), Platform::addressLength(addrs_[i])));
+            if (n != Platform::SOCK_ERR)
+                ++done;
+        }
+        count_ = 0;
+        return (done == 0 && total > 0) ? -1 : static_cast<int>(done);
+    }
+
+#endif
+
+} // namespace DNS::Server
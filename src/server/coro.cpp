@@ -0,0 +1,40 @@
+#include "../../include/server/coro.hpp"
+
+#include <new>
+
+namespace DNS::Server {
+
+    void *FramePool::allocate(size_t n) {
+        if (n + sizeof(Header) > SLOT_SIZE)
+            return allocateUnpooled(n);
+
+        if (!free_) {
+            // A whole chunk at a time; the slots are threaded onto the free list in order.
+            auto &chunk = chunks_.emplace_back(std::make_unique_for_overwrite<std::byte[]>(CHUNK_SLOTS * SLOT_SIZE));
+            for (size_t i = CHUNK_SLOTS; i-- > 0;) {
+                auto *slot = new (chunk.get() + i * SLOT_SIZE) Free{ free_ };
+                free_ = slot;
+            }
+        }
+        std::byte *slot = reinterpret_cast<std::byte *>(std::exchange(free_, free_->next));
+        new (slot) Header{ this };
+        return slot + sizeof(Header);
+    }
+
+    void *FramePool::allocateUnpooled(size_t n) {
+        auto *block = static_cast<std::byte *>(::operator new(n + sizeof(Header)));
+        new (block) Header{ nullptr };
+        return block + sizeof(Header);
+    }
+
+    void FramePool::release(void *p) noexcept {
+        std::byte *block = static_cast<std::byte *>(p) - sizeof(Header);
+        FramePool *pool = reinterpret_cast<Header *>(block)->pool;
+        if (!pool) {
+            ::operator delete(block);
+            return;
+        }
+        pool->free_ = new (block) Free{ pool->free_ };
+    }
+
+} // namespace DNS::Server
@@ -0,0 +1,794 @@
+#include "../../include/server/doh.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <string>
+#include <string_view>
+
+namespace DNS::Server {
+
+    using namespace Http2;
+
+    namespace {
+
+        // Connection-level receive window either side grants on top of the default 65535.
+        constexpr uint32_t RECEIVE_WINDOW   = 1024 * 1024;
+        // A DoH header block is a few hundred bytes, a GET's ?dns= included.
+        constexpr size_t   MAX_HEADER_BLOCK = 16 * 1024;
+        constexpr uint32_t MAX_STREAM_ID    = 0x7FFFFFFF;
+
+        uint32_t read32(const uint8_t *p) noexcept {
+            return (static_cast<uint32_t>(p[0]) << 24) | (static_cast<uint32_t>(p[1]) << 16) |
+                   (static_cast<uint32_t>(p[2]) << 8) | p[3];
+        }
+
+        // The value of parameter @p name in the query string of @p path ("" if absent).
+        std::string_view queryParam(std::string_view path, std::string_view name) noexcept {
+            const size_t q = path.find('?');
+            if (q == std::string_view::npos)
+                return {};
+            std::string_view query = path.substr(q + 1);
+            while (!query.empty()) {
+                const size_t amp = query.find('&');
+                const std::string_view param = query.substr(0, amp);
+                if (param.size() > name.size() && param.starts_with(name) && param[name.size()] == '=')
+                    return param.substr(name.size() + 1);
+                query = amp == std::string_view::npos ? std::string_view{} : query.substr(amp + 1);
+            }
+            return {};
+        }
+
+        // Our SETTINGS (stream limit only if @p maxStreams), then the larger connection window.
+        void greet(Http2Session &c, uint32_t maxStreams) {
+            std::vector<uint8_t> settings;
+            if (maxStreams != 0)
+                appendSetting(settings, Setting::MAX_CONCURRENT_STREAMS, maxStreams);
+            appendSetting(settings, Setting::ENABLE_PUSH, 0);
+            appendFrame(c.tx, Frame::SETTINGS, 0, 0, settings.data(), settings.size());
+            appendWindowUpdate(c.tx, 0, RECEIVE_WINDOW - DEFAULT_WINDOW);
+        }
+
+        // Frames as much of st.out as both windows admit; true once all of it is framed.
+        bool sendData(Http2Session &c, uint32_t stream, DohStream &st) {
+            while (st.outOff < st.out.size()) {
+                const int64_t room = std::min({ c.sendWindow, st.sendWindow, static_cast<int64_t>(c.peerMaxFrame) });
+                if (room <= 0)
+                    return false;
+                const size_t n    = std::min(st.out.size() - st.outOff, static_cast<size_t>(room));
+                const bool   last = st.outOff + n == st.out.size();
+                appendFrame(c.tx, Frame::DATA, last ? Flag::END_STREAM : 0, stream, st.out.data() + st.outOff, n);
+                st.outOff    += n;
+                c.sendWindow  -= static_cast<int64_t>(n);
+                st.sendWindow -= static_cast<int64_t>(n);
+            }
+            return true;
+        }
+
+        // Sends what the windows admit now; a stream both sides have ended is closed.
+        void unblock(Http2Session &c) {
+            size_t kept = 0;
+            for (const uint32_t id : c.blocked) {
+                const auto it = c.streams.find(id);
+                if (it == c.streams.end())
+                    continue;
+                if (!sendData(c, id, it->second))
+                    c.blocked[kept++] = id;
+                else if (!it->second.receiving)
+                    c.streams.erase(it);
+            }
+            c.blocked.resize(kept);
+        }
+
+        // Hands the DATA consumed so far back to the peer's connection window.
+        void replenish(Http2Session &c) {
+            if (c.unacked < RECEIVE_WINDOW / 2)
+                return;
+            appendWindowUpdate(c.tx, 0, c.unacked);
+            c.unacked = 0;
+        }
+
+        // Best effort: the caller closes the connection either way.
+        bool fail(Http2Session &c, uint32_t code, uint32_t lastStream) {
+            appendGoaway(c.tx, lastStream, code);
+            Tls::write(c.tls, c, nullptr);
+            return false;
+        }
+
+        /*
+         *  Handles one frame the way both sides do: padding, header blocks (collected across
+         *  CONTINUATION and decoded in order), SETTINGS, PING, flow control, RST_STREAM and
+         *  GOAWAY. What is specific to a side is left to
+         *      onHeaders(stream, flags)                  → a header block, decoded into headers
+         *      onData(stream, DohStream&, p, len, end)   → DATA of a stream still receiving
+         *  both returning an HTTP/2 error code, 0 = fine, and
+         *      onReset(stream, DohStream&, code)         → the peer reset an open stream, which
+         *                                                  is dropped right after
+         *  Returns the connection error to close with, 0 = fine.
+         */
+        template <typename OnHeaders, typename OnData, typename OnReset>
+        uint32_t frame(Http2Session &c, const FrameHeader &h, const uint8_t *p, std::vector<Header> &headers,
+                       OnHeaders &&onHeaders, OnData &&onData, OnReset &&onReset) {
+            // A header block arrives in one piece, nothing in between (RFC 9113 section 6.10).
+            if (c.headerStream != 0 && (h.type != Frame::CONTINUATION || h.stream != c.headerStream))
+                return Code::PROTOCOL_ERROR;
+
+            // The block is complete: decode it even if its stream is gone, or the dynamic
+            // table falls out of step with the peer's encoder.
+            auto complete = [&](uint32_t stream, uint8_t flags) -> uint32_t {
+                c.headerStream = 0;
+                headers.clear();
+                const bool decoded = c.hpack.decode(c.headerBlock.data(), c.headerBlock.size(), headers);
+                c.headerBlock.clear();
+                return decoded ? onHeaders(stream, flags) : Code::COMPRESSION_ERROR;
+            };
+
+            switch (h.type) {
+                case Frame::DATA: {
+                    if (h.stream == 0)
+                        return Code::PROTOCOL_ERROR;
+                    // Flow control counts the whole payload, padding included.
+                    c.unacked += h.length;
+                    size_t len = h.length;
+                    if (h.flags & Flag::PADDED) {
+                        if (len == 0 || p[0] >= len)
+                            return Code::PROTOCOL_ERROR;
+                        len -= 1 + p[0];
+                        ++p;
+                    }
+                    // DATA of a stream already ended or reset is dropped.
+                    const auto it = c.streams.find(h.stream);
+                    if (it == c.streams.end() || !it->second.receiving)
+                        return 0;
+                    return onData(h.stream, it->second, p, len, (h.flags & Flag::END_STREAM) != 0);
+                }
+
+                case Frame::HEADERS: {
+                    if (h.stream == 0)
+                        return Code::PROTOCOL_ERROR;
+                    size_t len = h.length;
+                    size_t pad = 0;
+                    if (h.flags & Flag::PADDED) {
+                        if (len == 0)
+                            return Code::PROTOCOL_ERROR;
+                        pad = p[0];
+                        ++p;
+                        --len;
+                    }
+                    if (h.flags & Flag::PRIORITY) {
+                        if (len < 5)
+                            return Code::PROTOCOL_ERROR;
+                        p   += 5;
+                        len -= 5;
+                    }
+                    if (pad > len)
+                        return Code::PROTOCOL_ERROR;
+                    c.headerBlock.assign(p, p + (len - pad));
+                    c.headerStream = h.stream;
+                    c.headerFlags  = h.flags;
+                    return (h.flags & Flag::END_HEADERS) ? complete(h.stream, h.flags) : 0;
+                }
+
+                case Frame::CONTINUATION:
+                    if (c.headerStream == 0 || c.headerBlock.size() + h.length > MAX_HEADER_BLOCK)
+                        return Code::PROTOCOL_ERROR;
+                    c.headerBlock.insert(c.headerBlock.end(), p, p + h.length);
+                    return (h.flags & Flag::END_HEADERS) ? complete(c.headerStream, c.headerFlags) : 0;
+
+                case Frame::PRIORITY:
+                    return 0;
+
+                case Frame::RST_STREAM:
+                    if (h.stream == 0)
+                        return Code::PROTOCOL_ERROR;
+                    if (h.length != 4)
+                        return Code::FRAME_SIZE_ERROR;
+                    if (const auto it = c.streams.find(h.stream); it != c.streams.end()) {
+                        onReset(h.stream, it->second, read32(p));
+                        c.streams.erase(it);
+                    }
+                    return 0;
+
+                case Frame::SETTINGS:
+                    if (h.stream != 0)
+                        return Code::PROTOCOL_ERROR;
+                    if (h.flags & Flag::ACK)
+                        return 0;
+                    if (h.length % 6 != 0)
+                        return Code::FRAME_SIZE_ERROR;
+                    for (size_t i = 0; i < h.length; i += 6) {
+                        const uint16_t id    = static_cast<uint16_t>(p[i] << 8 | p[i + 1]);
+                        const uint32_t value = read32(p + i + 2);
+                        if (id == Setting::INITIAL_WINDOW_SIZE) {
+                            if (value > MAX_WINDOW)
+                                return Code::FLOW_CONTROL_ERROR;
+                            // Applies to every open stream, possibly driving windows negative.
+                            const int64_t delta = static_cast<int64_t>(value) - c.peerWindow;
+                            for (auto &[stream, st] : c.streams)
+                                st.sendWindow += delta;
+                            c.peerWindow = value;
+                        } else if (id == Setting::MAX_FRAME_SIZE) {
+                            if (value < DEFAULT_MAX_FRAME || value > 0xFFFFFF)
+                                return Code::PROTOCOL_ERROR;
+                            c.peerMaxFrame = value;
+                        } else if (id == Setting::MAX_CONCURRENT_STREAMS) {
+                            c.peerMaxStreams = value;
+                        }
+                    }
+                    appendFrame(c.tx, Frame::SETTINGS, Flag::ACK, 0, nullptr, 0);
+                    unblock(c);
+                    return 0;
+
+                case Frame::PING:
+                    if (h.stream != 0)
+                        return Code::PROTOCOL_ERROR;
+                    if (h.length != 8)
+                        return Code::FRAME_SIZE_ERROR;
+                    if (!(h.flags & Flag::ACK))
+                        appendFrame(c.tx, Frame::PING, Flag::ACK, 0, p, 8);
+                    return 0;
+
+                case Frame::GOAWAY:
+                    if (h.stream != 0)
+                        return Code::PROTOCOL_ERROR;
+                    if (h.length < 8)
+                        return Code::FRAME_SIZE_ERROR;
+                    c.goaway     = true;
+                    c.goawayLast = read31(p);
+                    return 0;
+
+                case Frame::WINDOW_UPDATE: {
+                    if (h.length != 4)
+                        return Code::FRAME_SIZE_ERROR;
+                    const uint32_t increment = read31(p);
+                    if (h.stream == 0) {
+                        if (increment == 0)
+                            return Code::PROTOCOL_ERROR;
+                        if (c.sendWindow + increment > MAX_WINDOW)
+                            return Code::FLOW_CONTROL_ERROR;
+                        c.sendWindow += increment;
+                    } else if (const auto it = c.streams.find(h.stream); it != c.streams.end()) {
+                        if (increment == 0 || it->second.sendWindow + increment > MAX_WINDOW) {
+                            appendRstStream(c.tx, h.stream, increment == 0 ? Code::PROTOCOL_ERROR
+                                                                           : Code::FLOW_CONTROL_ERROR);
+                            c.streams.erase(it);
+                            return 0;
+                        }
+                        it->second.sendWindow += increment;
+                    }
+                    unblock(c);
+                    return 0;
+                }
+
+                // Neither side accepts pushes: clients never send them and we disable them.
+                case Frame::PUSH_PROMISE:
+                    return Code::PROTOCOL_ERROR;
+
+                // Unknown frame types are ignored (RFC 9113 section 4.1).
+                default:
+                    return 0;
+            }
+        }
+
+    } // namespace
+
+    size_t DohConnections::accept(Platform::socket_t listener) noexcept {
+        size_t accepted = 0;
+        for (;;) {
+            sockaddr_storage peer{};
+            Platform::socklen_t peerLen = sizeof(peer);
+            Platform::socket_t s = ::accept(listener, reinterpret_cast<sockaddr *>(&peer), &peerLen);
+            if (s == Platform::INVALID_SOCK)
+                return accepted;
+
+            ssl_st *tls = nullptr;
+            if (bySocket_.size() >= MAX_CONNECTIONS || !Platform::setNonBlocking(s) || !tls_ ||
+                !(tls = tls_->accept(s)) || (poller_ && !poller_->add(s))) {
+                Tls::close(tls);
+                Platform::closeSocket(s);
+                continue;
+            }
+
+            uint32_t slot;
+            if (!free_.empty()) {
+                slot = free_.back();
+                free_.pop_back();
+            } else {
+                slot = static_cast<uint32_t>(slots_.size());
+                slots_.emplace_back();
+                generations_.push_back(0);
+            }
+            if (++generations_[slot] == 0)
+                generations_[slot] = 1;
+
+            DohConnection &c = slots_[slot];
+            c = DohConnection{};
+            c.sock        = s;
+            c.peer        = peer;
+            c.token       = TOKEN_TAG | slot << 16 | generations_[slot];
+            c.tls         = tls;
+            c.handshaking = true;
+            c.lastActive  = clock::now();
+            bySocket_.emplace(s, slot);
+            ++accepted;
+        }
+    }
+
+    bool DohConnections::process(DohConnection &c) noexcept {
+        if (c.handshaking) {
+            const Tls::Step step = Tls::handshake(c.tls);
+            if (step == Tls::Step::FAILED)
+                return false;
+            const bool writable = step == Tls::Step::WANT_WRITE;
+            if (poller_ && c.stalled != writable)
+                poller_->setWritable(c.sock, writable);
+            c.stalled = writable;
+            if (step != Tls::Step::DONE)
+                return true;
+            c.handshaking = false;
+            // Our half of the connection preface, and room for many requests in flight.
+            greet(c, MAX_STREAMS);
+        }
+
+        if (!Tls::fill(c.tls, c))
+            return false;
+
+        size_t off = 0;
+        if (!c.preface) {
+            const size_t n = std::min(c.rx.size(), PREFACE.size());
+            if (!std::equal(c.rx.begin(), c.rx.begin() + static_cast<std::ptrdiff_t>(n), PREFACE.begin()))
+                return false;
+            if (n < PREFACE.size())
+                return Tls::write(c.tls, c, poller_);
+            c.preface = true;
+            off = PREFACE.size();
+        }
+
+        auto onHeaders = [&](uint32_t stream, uint8_t flags) { return request(c, stream, flags); };
+        auto onData = [&](uint32_t stream, DohStream &st, const uint8_t *p, size_t len, bool end) -> uint32_t {
+            if (st.body.size() + len > UINT16_MAX) {
+                reject(c, stream, 413);
+                return 0;
+            }
+            st.body.insert(st.body.end(), p, p + len);
+            if (end) {
+                st.receiving = false;
+                ready_.push_back(stream);
+            }
+            return 0;
+        };
+        // A reset request is simply gone; its answer, if one comes, finds no stream.
+        auto onReset = [](uint32_t, DohStream &, uint32_t) {};
+
+        while (c.rx.size() - off >= FRAME_HEADER_SIZE) {
+            const FrameHeader h = parseHeader(c.rx.data() + off);
+            // We never raise SETTINGS_MAX_FRAME_SIZE.
+            if (h.length > DEFAULT_MAX_FRAME)
+                return fail(c, Code::FRAME_SIZE_ERROR, c.lastStream);
+            if (c.rx.size() - off - FRAME_HEADER_SIZE < h.length)
+                break;
+            if (const uint32_t code = frame(c, h, c.rx.data() + off + FRAME_HEADER_SIZE, headers_, onHeaders, onData, onReset))
+                return fail(c, code, c.lastStream);
+            off += FRAME_HEADER_SIZE + h.length;
+        }
+        c.rx.erase(c.rx.begin(), c.rx.begin() + static_cast<std::ptrdiff_t>(off));
+
+        replenish(c);
+        return Tls::write(c.tls, c, poller_);
+    }
+
+    uint32_t DohConnections::request(DohConnection &c, uint32_t stream, uint8_t flags) noexcept {
+        const bool endStream = flags & Flag::END_STREAM;
+        if (const auto it = c.streams.find(stream); it != c.streams.end()) {
+            // Trailers: all they may do is end the body.
+            if (!endStream)
+                return Code::PROTOCOL_ERROR;
+            if (it->second.receiving) {
+                it->second.receiving = false;
+                ready_.push_back(stream);
+            }
+            return 0;
+        }
+        if ((stream & 1) == 0 || stream <= c.lastStream)
+            return Code::PROTOCOL_ERROR;
+        c.lastStream = stream;
+        if (c.streams.size() >= MAX_STREAMS) {
+            appendRstStream(c.tx, stream, Code::REFUSED_STREAM);
+            return 0;
+        }
+
+        std::string_view method, path, type;
+        for (const Header &f : headers_) {
+            if (f.name == ":method")
+                method = f.value;
+            else if (f.name == ":path")
+                path = f.value;
+            else if (f.name == "content-type")
+                type = f.value;
+        }
+
+        DohStream &st = c.streams[stream];
+        st.sendWindow = c.peerWindow;
+        if (path.substr(0, path.find('?')) != "/dns-query") {
+            reject(c, stream, 404);
+        } else if (method == "POST") {
+            if (type != "application/dns-message")
+                reject(c, stream, 415);
+            else if (endStream)
+                reject(c, stream, 400);
+            else
+                st.receiving = true;
+        } else if (method == "GET") {
+            const std::string_view dns = queryParam(path, "dns");
+            if (dns.empty() || !endStream || !base64UrlDecode(dns, st.body))
+                reject(c, stream, 400);
+            else
+                ready_.push_back(stream);
+        } else {
+            reject(c, stream, 405);
+        }
+        return 0;
+    }
+
+    bool DohConnections::respond(DohConnection &c, uint32_t stream, const uint8_t *msg, size_t len) noexcept {
+        const auto it = c.streams.find(stream);
+        if (c.sock == Platform::INVALID_SOCK || it == c.streams.end())
+            return false;
+        if (c.tx.size() - c.txOff + len > MAX_BACKLOG) {
+            close(c);
+            return false;
+        }
+
+        std::vector<uint8_t> block;
+        Hpack::indexed(block, 8);                                   // :status: 200
+        Hpack::literal(block, 31, "application/dns-message");       // content-type
+        Hpack::literal(block, 28, std::to_string(len));             // content-length
+        appendFrame(c.tx, Frame::HEADERS, Flag::END_HEADERS, stream, block.data(), block.size());
+
+        DohStream &st = it->second;
+        st.out.assign(msg, msg + len);
+        st.outOff = 0;
+        if (sendData(c, stream, st))
+            c.streams.erase(it);
+        else
+            c.blocked.push_back(stream);
+        c.lastActive = clock::now();
+
+        // With a backlog already waiting for writability, the Poller will call read().
+        if (c.stalled || Tls::write(c.tls, c, poller_))
+            return true;
+        close(c);
+        return false;
+    }
+
+    void DohConnections::reject(DohConnection &c, uint32_t stream, uint16_t status) noexcept {
+        const auto it = c.streams.find(stream);
+        if (c.sock == Platform::INVALID_SOCK || it == c.streams.end())
+            return;
+        std::vector<uint8_t> block;
+        // 400 and 404 are in the static table; other statuses are literals named ":status".
+        if (status == 400)
+            Hpack::indexed(block, 12);
+        else if (status == 404)
+            Hpack::indexed(block, 13);
+        else
+            Hpack::literal(block, 8, std::to_string(status));
+        appendFrame(c.tx, Frame::HEADERS, Flag::END_HEADERS | Flag::END_STREAM, stream, block.data(), block.size());
+        // Answered before the request ended: tell the client to stop sending (RFC 9113 section 8.1).
+        if (it->second.receiving)
+            appendRstStream(c.tx, stream, Code::NO_ERROR);
+        c.streams.erase(it);
+    }
+
+    DohConnection *DohConnections::find(uint32_t token) noexcept {
+        const uint32_t slot = (token & ~TOKEN_TAG) >> 16;
+        if (!owns(token) || slot >= slots_.size())
+            return nullptr;
+        DohConnection &c = slots_[slot];
+        return c.sock != Platform::INVALID_SOCK && c.token == token ? &c : nullptr;
+    }
+
+    void DohConnections::closeIdle(clock::time_point now) noexcept {
+        for (DohConnection &c : slots_) {
+            if (c.sock == Platform::INVALID_SOCK || c.pending != 0)
+                continue;
+            if (now - c.lastActive >= IDLE_TIMEOUT || (c.goaway && c.streams.empty())) {
+                // A graceful GOAWAY tells the client none of its requests were lost.
+                if (!c.handshaking)
+                    fail(c, Code::NO_ERROR, c.lastStream);
+                close(c);
+            }
+        }
+    }
+
+    void DohConnections::close(DohConnection &c) noexcept {
+        if (c.sock == Platform::INVALID_SOCK)
+            return;
+        Tls::close(c.tls);
+        if (poller_)
+            poller_->remove(c.sock);
+        bySocket_.erase(c.sock);
+        Platform::closeSocket(c.sock);
+        c.rx.clear();
+        c.tx.clear();
+        c.txOff   = 0;
+        c.pending = 0;
+        c.stalled = false;
+        c.streams.clear();
+        c.blocked.clear();
+        free_.push_back((c.token & ~TOKEN_TAG) >> 16);
+    }
+
+    void DohConnections::closeAll() noexcept {
+        for (DohConnection &c : slots_)
+            close(c);
+    }
+
+    void DohUpstreams::init(size_t upstreams, TlsClient *tls) {
+        closeAll();
+        tls_ = tls;
+        streams_.assign(upstreams, DohUpstream{});
+        authorities_.clear();
+        for (size_t i = 0; i < upstreams; ++i) {
+            const TlsClient::Peer &p = tls->peer(static_cast<uint8_t>(i));
+            if (!p.host.empty())
+                authorities_.push_back(p.host);
+            else if (p.ip.find(':') != std::string::npos)
+                authorities_.push_back("[" + p.ip + "]");
+            else
+                authorities_.push_back(p.ip);
+        }
+        orphans_.clear();
+    }
+
+    bool DohUpstreams::send(uint8_t upstream, const sockaddr_storage &addr, uint16_t id,
+                            const uint8_t *msg, size_t len) noexcept {
+        if (upstream >= streams_.size() || len < 12 || len > UINT16_MAX)
+            return false;
+        DohUpstream &c = streams_[upstream];
+
+        if (c.sock == Platform::INVALID_SOCK) {
+            Platform::socket_t s = Platform::connectStream(addr);
+            if (s == Platform::INVALID_SOCK)
+                return false;
+            if (poller_ && !poller_->add(s)) {
+                Platform::closeSocket(s);
+                return false;
+            }
+            c.sock       = s;
+            c.connecting = true;
+            // The connect completes when the socket turns writable.
+            c.stalled    = true;
+            if (poller_)
+                poller_->setWritable(s, true);
+            bySocket_.emplace(s, upstream);
+        }
+
+        // On a connection winding down (GOAWAY, or out of stream IDs) the query waits for
+        // its last stream to finish; close() then hands it on to the next connection.
+        if (c.queued.size() >= MAX_QUEUED)
+            return false;
+        std::vector<uint8_t> query(msg, msg + len);
+        query[0] = query[1] = 0;
+        c.queued.emplace_back(id, std::move(query));
+        c.lastActive = clock::now();
+        start(upstream);
+        if (c.connecting || c.handshaking || c.stalled || Tls::write(c.tls, c, poller_))
+            return true;
+        close(upstream);
+        return false;
+    }
+
+    void DohUpstreams::start(uint8_t upstream) noexcept {
+        DohUpstream &c = streams_[upstream];
+        if (c.connecting || c.handshaking || c.goaway)
+            return;
+        while (!c.queued.empty() && c.streams.size() < c.peerMaxStreams && c.nextStream <= MAX_STREAM_ID) {
+            auto [id, query] = std::move(c.queued.front());
+            c.queued.pop_front();
+            const uint32_t stream = c.nextStream;
+            c.nextStream += 2;
+
+            std::vector<uint8_t> block;
+            Hpack::indexed(block, 3);                                   // :method: POST
+            Hpack::indexed(block, 7);                                   // :scheme: https
+            Hpack::literal(block, 4, PATH);                             // :path
+            Hpack::literal(block, 1, authorities_[upstream]);           // :authority
+            Hpack::literal(block, 31, "application/dns-message");       // content-type
+            Hpack::literal(block, 19, "application/dns-message");       // accept
+            Hpack::literal(block, 28, std::to_string(query.size()));    // content-length
+            appendFrame(c.tx, Frame::HEADERS, Flag::END_HEADERS, stream, block.data(), block.size());
+
+            DohStream &st = c.streams[stream];
+            st.id         = id;
+            st.out        = std::move(query);
+            st.sendWindow = c.peerWindow;
+            st.receiving  = true;
+            if (!sendData(c, stream, st))
+                c.blocked.push_back(stream);
+        }
+    }
+
+    bool DohUpstreams::process(uint8_t upstream) noexcept {
+        DohUpstream &c = streams_[upstream];
+        bool open = Tls::fill(c.tls, c);
+
+        // Only 200 with a body that can be a DNS message counts as an answer; anything
+        // else leaves the query to its retransmit.
+        auto finish = [&](uint32_t stream, DohStream &st) {
+            if (st.status == 200 && st.body.size() >= 12) {
+                answers_.emplace_back(st.id, std::move(st.body));
+                ++c.answered;
+            }
+            c.streams.erase(stream);
+        };
+        auto onHeaders = [&](uint32_t stream, uint8_t flags) -> uint32_t {
+            const auto it = c.streams.find(stream);
+            if (it == c.streams.end())
+                return stream >= c.nextStream ? Code::PROTOCOL_ERROR : 0;
+            DohStream &st = it->second;
+            if (st.status == 0 || st.status / 100 == 1) {
+                st.status = 0;
+                for (const Header &f : headers_)
+                    if (f.name == ":status")
+                        st.status = static_cast<uint16_t>(std::atoi(f.value.c_str()));
+            }
+            if (flags & Flag::END_STREAM)
+                finish(stream, st);
+            return 0;
+        };
+        auto onData = [&](uint32_t stream, DohStream &st, const uint8_t *p, size_t len, bool end) -> uint32_t {
+            if (st.body.size() + len > UINT16_MAX) {
+                appendRstStream(c.tx, stream, Code::CANCEL);
+                c.streams.erase(stream);
+                return 0;
+            }
+            st.body.insert(st.body.end(), p, p + len);
+            if (end)
+                finish(stream, st);
+            return 0;
+        };
+        // Streams opened before the resolver's SETTINGS told us its limit come back refused,
+        // unprocessed (RFC 9113 section 8.7): they go back to the front of the queue. A
+        // refusal below the limit is the resolver's own business and left to the retransmit.
+        auto onReset = [&](uint32_t, DohStream &st, uint32_t code) {
+            if (code == Code::REFUSED_STREAM && c.streams.size() > c.peerMaxStreams)
+                c.queued.emplace_front(st.id, std::move(st.out));
+        };
+
+        size_t off = 0;
+        while (c.rx.size() - off >= FRAME_HEADER_SIZE) {
+            const FrameHeader h = parseHeader(c.rx.data() + off);
+            if (h.length > DEFAULT_MAX_FRAME)
+                return fail(c, Code::FRAME_SIZE_ERROR, 0);
+            if (c.rx.size() - off - FRAME_HEADER_SIZE < h.length)
+                break;
+            if (const uint32_t code = frame(c, h, c.rx.data() + off + FRAME_HEADER_SIZE, headers_, onHeaders, onData, onReset))
+                return fail(c, code, 0);
+            off += FRAME_HEADER_SIZE + h.length;
+        }
+        c.rx.erase(c.rx.begin(), c.rx.begin() + static_cast<std::ptrdiff_t>(off));
+
+        if (c.goaway) {
+            // Streams beyond the GOAWAY's last one were never processed and can be asked
+            // again on a new connection; those it covers still get their answers here.
+            if (c.answered > 0)
+                for (const auto &[stream, st] : c.streams)
+                    if (stream > c.goawayLast)
+                        orphans_.emplace_back(upstream, st.id);
+            std::erase_if(c.streams, [&](const auto &kv) { return kv.first > c.goawayLast; });
+        }
+        // Done with a connection that can open no more streams once its last one finished.
+        if ((c.goaway || c.nextStream > MAX_STREAM_ID) && c.streams.empty())
+            return false;
+
+        start(upstream);
+        replenish(c);
+        return Tls::write(c.tls, c, poller_) && open;
+    }
+
+    bool DohUpstreams::flush(Platform::socket_t s) noexcept {
+        const auto it = bySocket_.find(s);
+        if (it == bySocket_.end())
+            return false;
+        const uint8_t upstream = it->second;
+        DohUpstream &c = streams_[upstream];
+
+        if (c.connecting) {
+            if (Platform::connectError(s) != 0) {
+                close(upstream);
+                return true;
+            }
+            c.connecting = false;
+            c.tls = tls_->open(s, upstream);
+            if (!c.tls) {
+                close(upstream);
+                return true;
+            }
+            c.handshaking = true;
+        }
+        if (c.handshaking && !handshake(upstream))
+            return true;
+        if (!Tls::write(c.tls, c, poller_))
+            close(upstream);
+        return true;
+    }
+
+    bool DohUpstreams::handshake(uint8_t upstream) noexcept {
+        DohUpstream &c = streams_[upstream];
+        const TlsClient::Step step = tls_->handshake(c.tls);
+        if (step == TlsClient::Step::FAILED) {
+            close(upstream);
+            return false;
+        }
+        const bool writable = step == TlsClient::Step::WANT_WRITE;
+        if (poller_ && c.stalled != writable)
+            poller_->setWritable(c.sock, writable);
+        c.stalled = writable;
+        if (step != TlsClient::Step::DONE)
+            return false;
+        c.handshaking = false;
+
+        // The client's connection preface, then every query that queued meanwhile.
+        c.tx.insert(c.tx.end(), PREFACE.begin(), PREFACE.end());
+        greet(c, 0);
+        start(upstream);
+        return true;
+    }
+
+    bool DohUpstreams::waiting(uint8_t upstream, uint16_t id) const noexcept {
+        if (upstream >= streams_.size() || streams_[upstream].sock == Platform::INVALID_SOCK)
+            return false;
+        const DohUpstream &c = streams_[upstream];
+        for (const auto &[stream, st] : c.streams)
+            if (st.id == id)
+                return true;
+        for (const auto &[queued, query] : c.queued)
+            if (queued == id)
+                return true;
+        return false;
+    }
+
+    void DohUpstreams::takeOrphans(std::vector<std::pair<uint8_t, uint16_t>> &out) noexcept {
+        out.insert(out.end(), orphans_.begin(), orphans_.end());
+        orphans_.clear();
+    }
+
+    void DohUpstreams::closeIdle(clock::time_point now) noexcept {
+        for (size_t i = 0; i < streams_.size(); ++i) {
+            DohUpstream &c = streams_[i];
+            if (c.sock == Platform::INVALID_SOCK || !c.streams.empty() || !c.queued.empty() ||
+                now - c.lastActive < IDLE_TIMEOUT)
+                continue;
+            if (!c.connecting && !c.handshaking)
+                fail(c, Code::NO_ERROR, 0);
+            close(static_cast<uint8_t>(i));
+        }
+    }
+
+    void DohUpstreams::close(uint8_t upstream) noexcept {
+        DohUpstream &c = streams_[upstream];
+        if (c.sock == Platform::INVALID_SOCK)
+            return;
+        if (poller_)
+            poller_->remove(c.sock);
+        bySocket_.erase(c.sock);
+        Tls::close(c.tls);
+        Platform::closeSocket(c.sock);
+
+        // As with TcpUpstreams: only a connection that worked before gets its queries retried.
+        if (c.answered > 0) {
+            for (const auto &[stream, st] : c.streams)
+                orphans_.emplace_back(upstream, st.id);
+            for (const auto &[id, query] : c.queued)
+                orphans_.emplace_back(upstream, id);
+        }
+        c = DohUpstream{};
+    }
+
+    void DohUpstreams::closeAll() noexcept {
+        for (size_t i = 0; i < streams_.size(); ++i)
+            close(static_cast<uint8_t>(i));
+        orphans_.clear();
+    }
+
+} // namespace DNS::Server
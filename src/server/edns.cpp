@@ -0,0 +1,128 @@
+#include "../../include/server/edns.hpp"
+
+#include <algorithm>
+
+namespace DNS::Server::Edns {
+
+    namespace {
+
+        uint16_t read16(const uint8_t *p) noexcept {
+            return static_cast<uint16_t>(p[0] << 8 | p[1]);
+        }
+
+        // Offset just past the (possibly compressed) name at @p off, or 0 if it runs off the end.
+        size_t skipName(const uint8_t *msg, size_t len, size_t off) noexcept {
+            while (off < len) {
+                const uint8_t b = msg[off];
+                if (b == 0)
+                    return off + 1;
+                if ((b & DNS::Limits::COMPRESSION_MASK) == DNS::Limits::COMPRESSION_MASK)
+                    return off + 2 <= len ? off + 2 : 0;
+                if (b & DNS::Limits::COMPRESSION_MASK)
+                    return 0;
+                off += 1 + b;
+            }
+            return 0;
+        }
+
+        // Offset just past the resource record at @p off, or 0 if it runs off the end.
+        size_t skipRecord(const uint8_t *msg, size_t len, size_t off) noexcept {
+            off = skipName(msg, len, off);
+            if (off == 0 || off + 10 > len)
+                return 0;
+            off += 10 + read16(msg + off + 8);
+            return off <= len ? off : 0;
+        }
+
+    } // namespace
+
+    std::optional<Opt> findOpt(const uint8_t *msg, size_t len) noexcept {
+        if (len < 12)
+            return std::nullopt;
+        const uint16_t questions = read16(msg + 4);
+        const size_t   records   = static_cast<size_t>(read16(msg + 6)) + read16(msg + 8);
+        const uint16_t additional = read16(msg + 10);
+
+        size_t off = 12;
+        for (uint16_t i = 0; i < questions; ++i) {
+            off = skipName(msg, len, off);
+            if (off == 0 || off + 4 > len)
+                return std::nullopt;
+            off += 4;
+        }
+        for (size_t i = 0; i < records; ++i)
+            if ((off = skipRecord(msg, len, off)) == 0)
+                return std::nullopt;
+
+        for (uint16_t i = 0; i < additional; ++i) {
+            // OPT is owned by the root: a single zero byte, then TYPE 41.
+            if (off + 11 <= len && msg[off] == 0 && read16(msg + off + 1) == static_cast<uint16_t>(DNS::QType::OPT)) {
+                const uint8_t *p = msg + off + 1;
+                return Opt{ .offset  = off + 1,
+                            .payload = read16(p + 2),
+                            .ttl     = static_cast<uint32_t>(read16(p + 4)) << 16 | read16(p + 6) };
+            }
+            if ((off = skipRecord(msg, len, off)) == 0)
+                return std::nullopt;
+        }
+        return std::nullopt;
+    }
+
+    uint16_t payloadSize(const uint8_t *msg, size_t len) noexcept {
+        const auto opt = findOpt(msg, len);
+        if (!opt)
+            return static_cast<uint16_t>(DNS::Limits::MAX_UDP_PACKET);
+        return static_cast<uint16_t>(std::clamp<size_t>(opt->payload, DNS::Limits::MAX_UDP_PACKET,
+                                                        DNS::Limits::MAX_EDNS_PAYLOAD));
+    }
+
+    void clampPayload(uint8_t *msg, size_t len, uint16_t limit) noexcept {
+        const auto opt = findOpt(msg, len);
+        if (!opt || opt->payload <= limit)
+            return;
+        msg[opt->offset + 2] = static_cast<uint8_t>(limit >> 8);
+        msg[opt->offset + 3] = static_cast<uint8_t>(limit & 0xFF);
+    }
+
+    size_t truncate(uint8_t *msg, size_t len, size_t limit, uint16_t advertise) noexcept {
+        if (len <= limit)
+            return len;
+        if (len < 12)
+            return 0;
+
+        // Header and the first question; resolvers never ask more than one.
+        size_t end = 12;
+        if (read16(msg + 4) > 0) {
+            end = skipName(msg, len, end);
+            if (end == 0 || end + 4 > len)
+                return 0;
+            end += 4;
+        }
+        const auto opt = findOpt(msg, len);
+        if (end + (opt ? 11 : 0) > limit)
+            return 0;
+
+        msg[2] |= 0x02;                                             // TC
+        msg[4] = 0; msg[5] = end > 12 ? 1 : 0;                      // QDCOUNT
+        std::fill(msg + 6, msg + 12, uint8_t{0});                   // ANCOUNT, NSCOUNT, ARCOUNT
+        if (!opt)
+            return end;
+
+        // RFC 6891 section 7: a truncated answer keeps its OPT record, minus the options.
+        msg[11] = 1;
+        uint8_t *p = msg + end;
+        p[0]  = 0;                                                  // root
+        p[1]  = 0;
+        p[2]  = static_cast<uint8_t>(DNS::QType::OPT);
+        p[3]  = static_cast<uint8_t>(advertise >> 8);
+        p[4]  = static_cast<uint8_t>(advertise & 0xFF);
+        p[5]  = static_cast<uint8_t>(opt->ttl >> 24);
+        p[6]  = static_cast<uint8_t>(opt->ttl >> 16);
+        p[7]  = static_cast<uint8_t>(opt->ttl >> 8);
+        p[8]  = static_cast<uint8_t>(opt->ttl);
+        p[9]  = 0;                                                  // RDLENGTH
+        p[10] = 0;
+        return end + 11;
+    }
+
+} // namespace DNS::Server::Edns
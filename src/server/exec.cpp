@@ -0,0 +1,211 @@
+#include "../../include/server/exec.hpp"
+#include "../../include/server/ring.hpp"
+
+#include <algorithm>
+
+namespace DNS::Server::Exec {
+
+    // ThreadPool
+
+    namespace {
+        // The queue a thread posts to: its own for a pool thread, a fixed one for any other.
+        thread_local const ThreadPool *homePool = nullptr;
+        thread_local unsigned          homeQueue = 0;
+    }
+
+    ThreadPool::~ThreadPool() noexcept {
+        for (auto &t : threads_)
+            t.request_stop();
+        epoch_.fetch_add(1, std::memory_order_release);
+        epoch_.notify_all();
+        threads_.clear();
+    }
+
+    void ThreadPool::start(unsigned threads) {
+        count_  = std::max(1u, threads);
+        queues_ = std::make_unique<Queue[]>(count_);
+        threads_.reserve(count_);
+        for (unsigned i = 0; i < count_; ++i)
+            threads_.emplace_back([this, i](std::stop_token stop) { loop(i, stop); });
+    }
+
+    void ThreadPool::post(Work *work) noexcept {
+        if (homePool != this) {
+            homePool  = this;
+            homeQueue = nextHome_.fetch_add(1, std::memory_order_relaxed) % count_;
+        }
+        work->next = nullptr;
+        push(queues_[homeQueue], work, work, 1);
+
+        // Pairs with the fence in loop(): either a sleeper sees this work or we see it asleep.
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (sleepers_.load(std::memory_order_relaxed) > 0) {
+            epoch_.fetch_add(1, std::memory_order_release);
+            epoch_.notify_one();
+        }
+    }
+
+    ThreadPool::Stats ThreadPool::stats(bool reset) noexcept {
+        Stats s;
+        for (unsigned i = 0; i < count_; ++i) {
+            Queue &q = queues_[i];
+            s.ran    += reset ? q.ran.exchange(0, std::memory_order_relaxed)    : q.ran.load(std::memory_order_relaxed);
+            s.stolen += reset ? q.stolen.exchange(0, std::memory_order_relaxed) : q.stolen.load(std::memory_order_relaxed);
+            s.queued += q.size.load(std::memory_order_relaxed);
+        }
+        return s;
+    }
+
+    void ThreadPool::push(Queue &q, Work *first, Work *last, size_t n) noexcept {
+        std::lock_guard lock(q.mutex);
+        if (q.tail) q.tail->next = first;
+        else        q.head = first;
+        q.tail = last;
+        q.size.fetch_add(n, std::memory_order_release);
+    }
+
+    Work *ThreadPool::pop(Queue &q) noexcept {
+        if (q.size.load(std::memory_order_acquire) == 0)
+            return nullptr;
+        std::lock_guard lock(q.mutex);
+        Work *work = q.head;
+        if (!work)
+            return nullptr;
+        q.head = work->next;
+        if (!q.head)
+            q.tail = nullptr;
+        q.size.fetch_sub(1, std::memory_order_relaxed);
+        return work;
+    }
+
+    Work *ThreadPool::steal(unsigned self) noexcept {
+        // The longest queue is where a burst is waiting.
+        unsigned victim = self;
+        size_t   most   = 0;
+        for (unsigned i = 1; i < count_; ++i) {
+            const unsigned j = (self + i) % count_;
+            if (const size_t n = queues_[j].size.load(std::memory_order_relaxed); n > most) {
+                most   = n;
+                victim = j;
+            }
+        }
+        if (most == 0)
+            return nullptr;
+
+        // Take the older half in one go (at least one), so a thief does not come back for
+        // every item; the first is run, the rest become the thief's own queue.
+        Queue &q = queues_[victim];
+        Work  *first = nullptr, *last = nullptr;
+        size_t taken = 0;
+        {
+            std::lock_guard lock(q.mutex);
+            const size_t n = q.size.load(std::memory_order_relaxed);
+            if (n == 0)
+                return nullptr;
+            const size_t want = (n + 1) / 2;
+            first = last = q.head;
+            for (taken = 1; taken < want; ++taken)
+                last = last->next;
+            q.head = last->next;
+            if (!q.head)
+                q.tail = nullptr;
+            q.size.fetch_sub(taken, std::memory_order_relaxed);
+        }
+        last->next = nullptr;
+
+        Queue &own = queues_[self];
+        own.stolen.fetch_add(taken, std::memory_order_relaxed);
+        if (first != last)
+            push(own, first->next, last, taken - 1);
+        first->next = nullptr;
+        return first;
+    }
+
+    bool ThreadPool::anyQueued() const noexcept {
+        for (unsigned i = 0; i < count_; ++i)
+            if (queues_[i].size.load(std::memory_order_relaxed) > 0)
+                return true;
+        return false;
+    }
+
+    void ThreadPool::loop(unsigned self, std::stop_token stop) noexcept {
+        homePool  = this;
+        homeQueue = self;
+        Queue &own = queues_[self];
+
+        int idle = 0;
+        for (;;) {
+            Work *work = pop(own);
+            if (!work)
+                work = steal(self);
+            if (work) {
+                idle = 0;
+                own.ran.fetch_add(1, std::memory_order_relaxed);
+                work->run(work);
+                continue;
+            }
+
+            // Nothing anywhere. Only leave once stopped and every queue is drained.
+            if (stop.stop_requested())
+                return;
+            if (++idle < SPINS) {
+                cpuRelax();
+                continue;
+            }
+            idle = 0;
+            const uint32_t seen = epoch_.load(std::memory_order_acquire);
+            sleepers_.fetch_add(1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (!anyQueued() && !stop.stop_requested())
+                epoch_.wait(seen, std::memory_order_acquire);
+            sleepers_.fetch_sub(1, std::memory_order_relaxed);
+        }
+    }
+
+    // RunLoop
+
+    RunLoop::~RunLoop() noexcept {
+        Platform::closeSocket(wakeup_);
+    }
+
+    bool RunLoop::open() noexcept {
+        if (wakeup_ == Platform::INVALID_SOCK)
+            wakeup_ = Platform::openWakeup();
+        return wakeup_ != Platform::INVALID_SOCK;
+    }
+
+    void RunLoop::post(Work *work) noexcept {
+        work->next = nullptr;
+        std::lock_guard lock(mutex_);
+        if (tail_) tail_->next = work;
+        else       head_ = work;
+        tail_ = work;
+        if (!signalled_) {
+            signalled_ = true;
+            Platform::signalWakeup(wakeup_);
+        }
+    }
+
+    size_t RunLoop::drain() noexcept {
+        Work *work = nullptr;
+        {
+            std::lock_guard lock(mutex_);
+            work  = std::exchange(head_, nullptr);
+            tail_ = nullptr;
+            if (signalled_) {
+                signalled_ = false;
+                Platform::clearWakeup(wakeup_);
+            }
+        }
+        size_t n = 0;
+        while (work) {
+            // run() may end the operation work lives in; read next first.
+            Work *next = work->next;
+            work->run(work);
+            work = next;
+            ++n;
+        }
+        return n;
+    }
+
+} // namespace DNS::Server::Exec
@@ -0,0 +1,369 @@
+#include "../../include/server/http2.hpp"
+
+#include <array>
+
+namespace DNS::Server::Http2 {
+
+    namespace {
+        // RFC 7541 Appendix A.
+        constexpr std::string_view STATIC_TABLE[][2] = {
+            { ":authority", "" },                           // 1
+            { ":method", "GET" },                           // 2
+            { ":method", "POST" },                          // 3
+            { ":path", "/" },                               // 4
+            { ":path", "/index.html" },                     // 5
+            { ":scheme", "http" },                          // 6
+            { ":scheme", "https" },                         // 7
+            { ":status", "200" },                           // 8
+            { ":status", "204" },                           // 9
+            { ":status", "206" },                           // 10
+            { ":status", "304" },                           // 11
+            { ":status", "400" },                           // 12
+            { ":status", "404" },                           // 13
+            { ":status", "500" },                           // 14
+            { "accept-charset", "" },                       // 15
+            { "accept-encoding", "gzip, deflate" },         // 16
+            { "accept-language", "" },                      // 17
+            { "accept-ranges", "" },                        // 18
+            { "accept", "" },                               // 19
+            { "access-control-allow-origin", "" },          // 20
+            { "age", "" },                                  // 21
+            { "allow", "" },                                // 22
+            { "authorization", "" },                        // 23
+            { "cache-control", "" },                        // 24
+            { "content-disposition", "" },                  // 25
+            { "content-encoding", "" },                     // 26
+            { "content-language", "" },                     // 27
+            { "content-length", "" },                       // 28
+            { "content-location", "" },                     // 29
+            { "content-range", "" },                        // 30
+            { "content-type", "" },                         // 31
+            { "cookie", "" },                               // 32
+            { "date", "" },                                 // 33
+            { "etag", "" },                                 // 34
+            { "expect", "" },                               // 35
+            { "expires", "" },                              // 36
+            { "from", "" },                                 // 37
+            { "host", "" },                                 // 38
+            { "if-match", "" },                             // 39
+            { "if-modified-since", "" },                    // 40
+            { "if-none-match", "" },                        // 41
+            { "if-range", "" },                             // 42
+            { "if-unmodified-since", "" },                  // 43
+            { "last-modified", "" },                        // 44
+            { "link", "" },                                 // 45
+            { "location", "" },                             // 46
+            { "max-forwards", "" },                         // 47
+            { "proxy-authenticate", "" },                   // 48
+            { "proxy-authorization", "" },                  // 49
+            { "range", "" },                                // 50
+            { "referer", "" },                              // 51
+            { "refresh", "" },                              // 52
+            { "retry-after", "" },                          // 53
+            { "server", "" },                               // 54
+            { "set-cookie", "" },                           // 55
+            { "strict-transport-security", "" },            // 56
+            { "transfer-encoding", "" },                    // 57
+            { "user-agent", "" },                           // 58
+            { "vary", "" },                                 // 59
+            { "via", "" },                                  // 60
+            { "www-authenticate", "" },                     // 61
+        };
+        constexpr size_t STATIC_ENTRIES = std::size(STATIC_TABLE);
+
+        // RFC 7541 Appendix B, code lengths of symbols 0..255. The code is canonical
+        // (codes of one length are consecutive, in symbol order), so the lengths are
+        // all it takes to rebuild it; EOS (30 bits of 1) comes last and is never decoded.
+        constexpr uint8_t HUFFMAN_LENGTHS[256] = {
+            13, 23, 28, 28, 28, 28, 28, 28, 28, 24, 30, 28, 28, 30, 28, 28,
+            28, 28, 28, 28, 28, 28, 30, 28, 28, 28, 28, 28, 28, 28, 28, 28,
+             6, 10, 10, 12, 13,  6,  8, 11, 10, 10,  8, 11,  8,  6,  6,  6,
+             5,  5,  5,  6,  6,  6,  6,  6,  6,  6,  7,  8, 15,  6, 12, 10,
+            13,  6,  7,  7,  7,  7,  7,  7,  7,  7,  7,  7,  7,  7,  7,  7,
+             7,  7,  7,  7,  7,  7,  7,  7,  8,  7,  8, 13, 19, 13, 14,  6,
+            15,  5,  6,  5,  6,  5,  6,  6,  6,  5,  7,  7,  6,  6,  6,  5,
+             6,  7,  6,  5,  5,  6,  7,  7,  7,  7,  7, 15, 11, 14, 13, 28,
+            20, 22, 20, 20, 22, 22, 22, 23, 22, 23, 23, 23, 23, 23, 24, 23,
+            24, 24, 22, 23, 24, 23, 23, 23, 23, 21, 22, 23, 22, 23, 23, 24,
+            22, 21, 20, 22, 22, 23, 23, 21, 23, 22, 22, 24, 21, 22, 23, 23,
+            21, 21, 22, 21, 23, 22, 23, 23, 20, 22, 22, 22, 23, 22, 22, 23,
+            26, 26, 20, 19, 22, 23, 22, 25, 26, 26, 26, 27, 27, 26, 24, 25,
+            19, 21, 26, 27, 27, 26, 27, 24, 21, 21, 26, 26, 28, 27, 27, 27,
+            20, 24, 20, 21, 22, 21, 21, 23, 22, 22, 25, 25, 24, 24, 26, 23,
+            26, 27, 26, 26, 27, 27, 27, 27, 27, 28, 27, 27, 27, 27, 27, 26,
+        };
+        constexpr int HUFFMAN_MAX_BITS = 30;
+
+        // Canonical decoding tables: the first code of each length, how many codes have
+        // that length, and the symbols sorted by (length, symbol).
+        struct Huffman {
+            std::array<uint32_t, HUFFMAN_MAX_BITS + 1> first {};
+            std::array<uint16_t, HUFFMAN_MAX_BITS + 1> count {};
+            std::array<uint16_t, HUFFMAN_MAX_BITS + 1> offset {};
+            std::array<uint8_t, 256>                   symbols {};
+
+            constexpr Huffman() {
+                for (const uint8_t len : HUFFMAN_LENGTHS)
+                    ++count[len];
+                uint32_t code = 0;
+                uint16_t at   = 0;
+                for (int len = 1; len <= HUFFMAN_MAX_BITS; ++len) {
+                    code        = (code + count[len - 1]) << 1;
+                    first[len]  = code;
+                    offset[len] = at;
+                    at = static_cast<uint16_t>(at + count[len]);
+                }
+                std::array<uint16_t, HUFFMAN_MAX_BITS + 1> next = offset;
+                for (int s = 0; s < 256; ++s)
+                    symbols[next[HUFFMAN_LENGTHS[s]]++] = static_cast<uint8_t>(s);
+            }
+        };
+        constexpr Huffman HUFFMAN {};
+
+        bool huffmanDecode(const uint8_t *p, size_t len, std::string &out) {
+            uint32_t code = 0;
+            int      bits = 0;
+            for (size_t i = 0; i < len; ++i) {
+                for (int b = 7; b >= 0; --b) {
+                    code = code << 1 | ((p[i] >> b) & 1);
+                    if (++bits > HUFFMAN_MAX_BITS)
+                        return false;
+                    const uint32_t k = code - HUFFMAN.first[bits];
+                    if (code >= HUFFMAN.first[bits] && k < HUFFMAN.count[bits]) {
+                        out.push_back(static_cast<char>(HUFFMAN.symbols[HUFFMAN.offset[bits] + k]));
+                        code = 0;
+                        bits = 0;
+                    }
+                }
+            }
+            // What is left must be padding: fewer than 8 bits, all of them 1 (the EOS prefix).
+            return bits < 8 && code == (1u << bits) - 1;
+        }
+
+        // Prefix-coded integer (RFC 7541 section 5.1) with an N-bit prefix in p[pos].
+        bool readInt(const uint8_t *p, size_t len, size_t &pos, int prefix, uint64_t &value) {
+            if (pos >= len)
+                return false;
+            const uint8_t mask = static_cast<uint8_t>((1u << prefix) - 1);
+            value = p[pos++] & mask;
+            if (value < mask)
+                return true;
+            for (int shift = 0; shift <= 28; shift += 7) {
+                if (pos >= len)
+                    return false;
+                const uint8_t b = p[pos++];
+                value += static_cast<uint64_t>(b & 0x7F) << shift;
+                if (!(b & 0x80))
+                    return true;
+            }
+            return false;
+        }
+
+        bool readString(const uint8_t *p, size_t len, size_t &pos, std::string &out) {
+            if (pos >= len)
+                return false;
+            const bool huffman = p[pos] & 0x80;
+            uint64_t n;
+            if (!readInt(p, len, pos, 7, n) || n > len - pos)
+                return false;
+            out.clear();
+            const bool ok = huffman ? huffmanDecode(p + pos, n, out)
+                                    : (out.assign(reinterpret_cast<const char *>(p + pos), n), true);
+            pos += n;
+            return ok;
+        }
+
+        void writeInt(std::vector<uint8_t> &out, uint8_t pattern, int prefix, uint64_t value) {
+            const uint8_t mask = static_cast<uint8_t>((1u << prefix) - 1);
+            if (value < mask) {
+                out.push_back(static_cast<uint8_t>(pattern | value));
+                return;
+            }
+            out.push_back(static_cast<uint8_t>(pattern | mask));
+            value -= mask;
+            while (value >= 0x80) {
+                out.push_back(static_cast<uint8_t>((value & 0x7F) | 0x80));
+                value >>= 7;
+            }
+            out.push_back(static_cast<uint8_t>(value));
+        }
+    }
+
+    FrameHeader parseHeader(const uint8_t *p) noexcept {
+        FrameHeader h;
+        h.length = static_cast<uint32_t>(p[0]) << 16 | static_cast<uint32_t>(p[1]) << 8 | p[2];
+        h.type   = static_cast<Frame>(p[3]);
+        h.flags  = p[4];
+        h.stream = read31(p + 5);
+        return h;
+    }
+
+    void appendFrame(std::vector<uint8_t> &out, Frame type, uint8_t flags, uint32_t stream,
+                     const uint8_t *payload, size_t len) {
+        const uint8_t header[FRAME_HEADER_SIZE] = {
+            static_cast<uint8_t>(len >> 16), static_cast<uint8_t>(len >> 8), static_cast<uint8_t>(len),
+            static_cast<uint8_t>(type), flags,
+            static_cast<uint8_t>((stream >> 24) & 0x7F), static_cast<uint8_t>(stream >> 16),
+            static_cast<uint8_t>(stream >> 8), static_cast<uint8_t>(stream),
+        };
+        out.insert(out.end(), header, header + FRAME_HEADER_SIZE);
+        if (len > 0)
+            out.insert(out.end(), payload, payload + len);
+    }
+
+    void appendSetting(std::vector<uint8_t> &payload, uint16_t id, uint32_t value) {
+        const uint8_t setting[6] = {
+            static_cast<uint8_t>(id >> 8), static_cast<uint8_t>(id),
+            static_cast<uint8_t>(value >> 24), static_cast<uint8_t>(value >> 16),
+            static_cast<uint8_t>(value >> 8), static_cast<uint8_t>(value),
+        };
+        payload.insert(payload.end(), setting, setting + sizeof(setting));
+    }
+
+    void appendWindowUpdate(std::vector<uint8_t> &out, uint32_t stream, uint32_t increment) {
+        const uint8_t payload[4] = {
+            static_cast<uint8_t>((increment >> 24) & 0x7F), static_cast<uint8_t>(increment >> 16),
+            static_cast<uint8_t>(increment >> 8), static_cast<uint8_t>(increment),
+        };
+        appendFrame(out, Frame::WINDOW_UPDATE, 0, stream, payload, sizeof(payload));
+    }
+
+    void appendRstStream(std::vector<uint8_t> &out, uint32_t stream, uint32_t code) {
+        const uint8_t payload[4] = {
+            static_cast<uint8_t>(code >> 24), static_cast<uint8_t>(code >> 16),
+            static_cast<uint8_t>(code >> 8), static_cast<uint8_t>(code),
+        };
+        appendFrame(out, Frame::RST_STREAM, 0, stream, payload, sizeof(payload));
+    }
+
+    void appendGoaway(std::vector<uint8_t> &out, uint32_t lastStream, uint32_t code) {
+        const uint8_t payload[8] = {
+            static_cast<uint8_t>((lastStream >> 24) & 0x7F), static_cast<uint8_t>(lastStream >> 16),
+            static_cast<uint8_t>(lastStream >> 8), static_cast<uint8_t>(lastStream),
+            static_cast<uint8_t>(code >> 24), static_cast<uint8_t>(code >> 16),
+            static_cast<uint8_t>(code >> 8), static_cast<uint8_t>(code),
+        };
+        appendFrame(out, Frame::GOAWAY, 0, 0, payload, sizeof(payload));
+    }
+
+    bool HpackDecoder::lookup(uint64_t index, Header &out) const {
+        if (index == 0)
+            return false;
+        if (index <= STATIC_ENTRIES) {
+            out.name.assign(STATIC_TABLE[index - 1][0]);
+            out.value.assign(STATIC_TABLE[index - 1][1]);
+            return true;
+        }
+        index -= STATIC_ENTRIES + 1;
+        if (index >= dynamic_.size())
+            return false;
+        out = dynamic_[index];
+        return true;
+    }
+
+    void HpackDecoder::evict(size_t limit) {
+        while (size_ > limit && !dynamic_.empty()) {
+            size_ -= dynamic_.back().name.size() + dynamic_.back().value.size() + 32;
+            dynamic_.pop_back();
+        }
+    }
+
+    void HpackDecoder::insert(Header h) {
+        // Entry size is name + value + 32 (RFC 7541 section 4.1); one too large empties the table.
+        const size_t size = h.name.size() + h.value.size() + 32;
+        evict(size <= maxSize_ ? maxSize_ - size : 0);
+        if (size > maxSize_)
+            return;
+        size_ += size;
+        dynamic_.push_front(std::move(h));
+    }
+
+    bool HpackDecoder::decode(const uint8_t *block, size_t len, std::vector<Header> &out) {
+        size_t pos = 0;
+        bool   fieldSeen = false;
+        while (pos < len) {
+            const uint8_t b = block[pos];
+            uint64_t index;
+
+            if (b & 0x80) {
+                // Indexed field.
+                Header h;
+                if (!readInt(block, len, pos, 7, index) || !lookup(index, h))
+                    return false;
+                out.push_back(std::move(h));
+                fieldSeen = true;
+                continue;
+            }
+
+            if ((b & 0xE0) == 0x20) {
+                // Dynamic table size update: only at the start of a block, within our setting.
+                if (fieldSeen || !readInt(block, len, pos, 5, index) || index > MAX_TABLE_SIZE)
+                    return false;
+                maxSize_ = index;
+                evict(maxSize_);
+                continue;
+            }
+
+            // Literal: with incremental indexing (6-bit index), or without / never indexed (4-bit).
+            const bool indexing = (b & 0xC0) == 0x40;
+            if (!readInt(block, len, pos, indexing ? 6 : 4, index))
+                return false;
+            Header h;
+            if (index == 0) {
+                if (!readString(block, len, pos, h.name))
+                    return false;
+            } else {
+                Header named;
+                if (!lookup(index, named))
+                    return false;
+                h.name = std::move(named.name);
+            }
+            if (!readString(block, len, pos, h.value))
+                return false;
+            if (indexing)
+                insert(h);
+            out.push_back(std::move(h));
+            fieldSeen = true;
+        }
+        return true;
+    }
+
+    namespace Hpack {
+
+        void indexed(std::vector<uint8_t> &out, uint8_t index) {
+            writeInt(out, 0x80, 7, index);
+        }
+
+        void literal(std::vector<uint8_t> &out, uint8_t nameIndex, std::string_view value) {
+            writeInt(out, 0x00, 4, nameIndex);
+            writeInt(out, 0x00, 7, value.size());
+            out.insert(out.end(), value.begin(), value.end());
+        }
+
+    } // namespace Hpack
+
+    bool base64UrlDecode(std::string_view in, std::vector<uint8_t> &out) {
+        while (!in.empty() && in.back() == '=')
+            in.remove_suffix(1);
+        uint32_t acc  = 0;
+        int      bits = 0;
+        for (const char c : in) {
+            uint32_t v;
+            if (c >= 'A' && c <= 'Z')      v = static_cast<uint32_t>(c - 'A');
+            else if (c >= 'a' && c <= 'z') v = static_cast<uint32_t>(c - 'a' + 26);
+            else if (c >= '0' && c <= '9') v = static_cast<uint32_t>(c - '0' + 52);
+            else if (c == '-')             v = 62;
+            else if (c == '_')             v = 63;
+            else return false;
+            acc = acc << 6 | v;
+            bits += 6;
+            if (bits >= 8) {
+                bits -= 8;
+                out.push_back(static_cast<uint8_t>(acc >> bits));
+            }
+        }
+        // A single leftover character carries fewer than 8 bits of data.
+        return bits < 6;
+    }
+
+} // namespace DNS::Server::Http2
@@ -0,0 +1,166 @@
+#include "../../include/server/inflight.hpp"
+
+namespace DNS::Server {
+
+    InflightTable::InflightTable()
+        : entries_(UINT16_MAX + 1), queries_(UINT16_MAX + 1) {}
+
+    bool InflightTable::nextId(uint16_t &id) noexcept {
+        if (idsLeft_ == 0) {
+            if (!Platform::randomBytes(ids_.data(), sizeof(ids_)))
+                return false;
+            idsLeft_ = ids_.size();
+        }
+        id = ids_[--idsLeft_];
+        return true;
+    }
+
+    std::expected<uint16_t, DNS::Error> InflightTable::claim(const Entry &entry) noexcept {
+        if (size_ > UINT16_MAX)
+            return std::unexpected(DNS::Error::UPSTREAM_BUSY);
+
+        // Drawn again when busy: stepping to the next free ID would make the IDs that
+        // follow a run of busy ones predictable. Only a nearly full table runs out of draws.
+        for (int draw = 0; draw < MAX_DRAWS; ++draw) {
+            uint16_t upstreamId = 0;
+            if (!nextId(upstreamId))
+                break;
+            if (entries_[upstreamId].active)
+                continue;
+
+            entries_[upstreamId] = entry;
+            entries_[upstreamId].active = true;
+            deadlines_.emplace(entry.deadline, upstreamId);
+            ++size_;
+            return upstreamId;
+        }
+        return std::unexpected(DNS::Error::UPSTREAM_BUSY);
+    }
+
+    std::expected<uint16_t, DNS::Error>
+    InflightTable::insert(const Entry &entry, const uint8_t *query, size_t len) noexcept {
+        const auto upstreamId = claim(entry);
+        if (!upstreamId)
+            return upstreamId;
+
+        Entry &e = entries_[*upstreamId];
+        e.primary     = *upstreamId;
+        e.charged     = false;
+        e.retransmits = 0;
+        e.attempts    = 1;
+        e.ids[0]      = *upstreamId;
+        // assign() reuses the slot's capacity, so after warm-up this does not allocate.
+        queries_[*upstreamId].assign(query, query + len);
+
+        scheduleRetry(*upstreamId, entry.retryAt, entry.hedgeNext);
+        return upstreamId;
+    }
+
+    std::expected<uint16_t, DNS::Error>
+    InflightTable::addAttempt(uint16_t primaryId, uint8_t upstream, bool hedge, clock::time_point now) noexcept {
+        Entry &p = entries_[primaryId];
+        if (!p.active || p.attempts >= MAX_ATTEMPTS)
+            return std::unexpected(DNS::Error::UPSTREAM_BUSY);
+        p.retryAt = {};
+
+        Entry attempt;
+        attempt.client   = p.client;
+        attempt.id       = p.id;
+        attempt.upstream = upstream;
+        attempt.sent     = now;
+        attempt.deadline = p.deadline;
+        attempt.primary  = primaryId;
+        attempt.tcp      = p.tcp;
+        attempt.stream   = p.stream;
+        attempt.udpSize  = p.udpSize;
+        attempt.waiter   = p.waiter;
+        attempt.hedge    = hedge;
+
+        const auto upstreamId = claim(attempt);
+        if (!upstreamId)
+            return upstreamId;
+
+        p.ids[p.attempts++] = *upstreamId;
+        if (!hedge)
+            ++p.retransmits;
+        queries_[*upstreamId].assign(queries_[primaryId].begin(), queries_[primaryId].end());
+        return upstreamId;
+    }
+
+    void InflightTable::scheduleRetry(uint16_t primaryId, clock::time_point at, bool hedge) noexcept {
+        Entry &p = entries_[primaryId];
+        if (at == clock::time_point{} || at >= p.deadline || p.attempts >= MAX_ATTEMPTS) {
+            p.retryAt = {};
+            return;
+        }
+        p.retryAt   = at;
+        p.hedgeNext = hedge;
+        retries_.emplace(at, primaryId);
+    }
+
+    std::span<const uint8_t> InflightTable::query(uint16_t upstreamId) const noexcept {
+        return queries_[upstreamId];
+    }
+
+    size_t InflightTable::dueRetries(clock::time_point now, std::vector<uint16_t> &out) noexcept {
+        size_t n = 0;
+        while (!retries_.empty() && retries_.top().first <= now) {
+            const auto [at, upstreamId] = retries_.top();
+            retries_.pop();
+            Entry &e = entries_[upstreamId];
+            // Skip queries answered (or IDs reused) since the retry was armed.
+            if (!e.active || e.primary != upstreamId || e.retryAt != at)
+                continue;
+            e.retryAt = {};
+            out.push_back(upstreamId);
+            ++n;
+        }
+        return n;
+    }
+
+    const InflightTable::Entry *InflightTable::find(uint16_t upstreamId) const noexcept {
+        const Entry &e = entries_[upstreamId];
+        return e.active ? &e : nullptr;
+    }
+
+    InflightTable::Entry *InflightTable::find(uint16_t upstreamId) noexcept {
+        Entry &e = entries_[upstreamId];
+        return e.active ? &e : nullptr;
+    }
+
+    std::optional<InflightTable::Entry> InflightTable::take(uint16_t upstreamId) noexcept {
+        Entry &e = entries_[upstreamId];
+        if (!e.active)
+            return std::nullopt;
+        const Entry matched = e;
+
+        // Release the whole query: every attempt listed by its primary that still belongs to it.
+        const Entry &p = entries_[matched.primary];
+        if (p.active && p.primary == matched.primary) {
+            const Entry primary = p;
+            for (uint8_t i = 0; i < primary.attempts; ++i) {
+                Entry &a = entries_[primary.ids[i]];
+                if (a.active && a.primary == matched.primary) {
+                    a.active = false;
+                    --size_;
+                }
+            }
+        }
+        if (e.active) {
+            e.active = false;
+            --size_;
+        }
+        return matched;
+    }
+
+    int InflightTable::msUntilNextDeadline(clock::time_point now) const noexcept {
+        if (deadlines_.empty())
+            return -1;
+        auto next = deadlines_.top().first;
+        if (!retries_.empty() && retries_.top().first < next)
+            next = retries_.top().first;
+        const auto left = std::chrono::ceil<std::chrono::milliseconds>(next - now).count();
+        return left > 0 ? static_cast<int>(left) : 0;
+    }
+
+} // namespace DNS::Server
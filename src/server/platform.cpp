@@ -0,0 +1,529 @@
+#include "../../include/server/platform.hpp"
+
+#include <algorithm>
+#include <cstdlib>  // arc4random_buf() on the BSDs and macOS
+#include <cstring>
+#include <iterator>
+#include <limits>
+
+#ifdef _WIN32
+#pragma comment(lib, "ws2_32.lib")
+#pragma comment(lib, "bcrypt.lib")
+#include <bcrypt.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <poll.h>
+#include <netinet/tcp.h>
+#endif
+#if defined(__linux__)
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <linux/filter.h>
+#include <linux/sock_diag.h>
+#include <sys/random.h>
+#endif
+
+namespace DNS::Server::Platform {
+
+    bool startup() noexcept {
+#ifdef _WIN32
+        WSADATA wsa{};
+        return WSAStartup(MAKEWORD(2, 2), &wsa) == 0;
+#else
+        return true;
+#endif
+    }
+
+    bool parseAddress(const std::string &ip, uint16_t port, sockaddr_storage &out) noexcept {
+        out = sockaddr_storage{};
+        auto *v4 = reinterpret_cast<sockaddr_in *>(&out);
+        if (inet_pton(AF_INET, ip.c_str(), &v4->sin_addr) == 1) {
+            v4->sin_family = AF_INET;
+            v4->sin_port   = htons(port);
+            return true;
+        }
+        auto *v6 = reinterpret_cast<sockaddr_in6 *>(&out);
+        if (inet_pton(AF_INET6, ip.c_str(), &v6->sin6_addr) == 1) {
+            v6->sin6_family = AF_INET6;
+            v6->sin6_port   = htons(port);
+            return true;
+        }
+        out = sockaddr_storage{};
+        return false;
+    }
+
+    void mapToV6(sockaddr_storage &a) noexcept {
+        if (a.ss_family != AF_INET)
+            return;
+        const sockaddr_in v4 = *reinterpret_cast<const sockaddr_in *>(&a);
+        a = sockaddr_storage{};
+        auto *v6 = reinterpret_cast<sockaddr_in6 *>(&a);
+        v6->sin6_family = AF_INET6;
+        v6->sin6_port   = v4.sin_port;
+        v6->sin6_addr.s6_addr[10] = 0xFF;
+        v6->sin6_addr.s6_addr[11] = 0xFF;
+        std::memcpy(&v6->sin6_addr.s6_addr[12], &v4.sin_addr, 4);
+    }
+
+    bool sameAddress(const sockaddr_storage &a, const sockaddr_storage &b) noexcept {
+        if (a.ss_family != b.ss_family)
+            return false;
+        if (a.ss_family == AF_INET) {
+            const auto &x = reinterpret_cast<const sockaddr_in &>(a);
+            const auto &y = reinterpret_cast<const sockaddr_in &>(b);
+            return x.sin_addr.s_addr == y.sin_addr.s_addr && x.sin_port == y.sin_port;
+        }
+        if (a.ss_family == AF_INET6) {
+            const auto &x = reinterpret_cast<const sockaddr_in6 &>(a);
+            const auto &y = reinterpret_cast<const sockaddr_in6 &>(b);
+            return x.sin6_port == y.sin6_port &&
+                   std::memcmp(&x.sin6_addr, &y.sin6_addr, sizeof(x.sin6_addr)) == 0;
+        }
+        return false;
+    }
+
+    std::string formatAddress(const sockaddr_storage &a) {
+        char text[INET6_ADDRSTRLEN] = "?";
+        if (a.ss_family == AF_INET)
+            inet_ntop(AF_INET, &reinterpret_cast<const sockaddr_in &>(a).sin_addr, text, sizeof(text));
+        else if (a.ss_family == AF_INET6)
+            inet_ntop(AF_INET6, &reinterpret_cast<const sockaddr_in6 &>(a).sin6_addr, text, sizeof(text));
+        return text;
+    }
+
+    void cleanup() noexcept {
+#ifdef _WIN32
+        WSACleanup();
+#endif
+    }
+
+    void closeSocket(socket_t &s) noexcept {
+        if (s != INVALID_SOCK) {
+#ifdef _WIN32
+            closesocket(s);
+#else
+            ::close(s);
+#endif
+            s = INVALID_SOCK;
+        }
+    }
+
+    int lastError() noexcept {
+#ifdef _WIN32
+        return WSAGetLastError();
+#else
+        return errno;
+#endif
+    }
+
+    bool isWouldBlock(int err) noexcept {
+#ifdef _WIN32
+        return err == WSAEWOULDBLOCK;
+#else
+        return err == EAGAIN || err == EWOULDBLOCK;
+#endif
+    }
+
+    bool isConnReset(int err) noexcept {
+#ifdef _WIN32
+        return err == WSAECONNRESET;
+#else
+        return err == ECONNREFUSED;
+#endif
+    }
+
+    bool isInterrupted(int err) noexcept {
+#ifdef _WIN32
+        return err == WSAEINTR;
+#else
+        return err == EINTR;
+#endif
+    }
+
+    bool setNonBlocking(socket_t s) noexcept {
+#ifdef _WIN32
+        u_long mode = 1;
+        return ioctlsocket(s, FIONBIO, &mode) == 0;
+#else
+        const int flags = fcntl(s, F_GETFL, 0);
+        if (flags < 0)
+            return false;
+        return fcntl(s, F_SETFL, flags | O_NONBLOCK) == 0;
+#endif
+    }
+
+    bool setReusePort(socket_t s) noexcept {
+#ifdef SO_REUSEPORT
+        const int on = 1;
+        return setsockopt(s, SOL_SOCKET, SO_REUSEPORT,
+                          reinterpret_cast<const char *>(&on), sizeof(on)) == 0;
+#else
+        (void)s;
+        return false;
+#endif
+    }
+
+    bool setDualStack(socket_t s) noexcept {
+        const int off = 0;
+        return setsockopt(s, IPPROTO_IPV6, IPV6_V6ONLY,
+                          reinterpret_cast<const char *>(&off), sizeof(off)) == 0;
+    }
+
+    bool setReuseAddr(socket_t s) noexcept {
+        const int on = 1;
+        return setsockopt(s, SOL_SOCKET, SO_REUSEADDR,
+                          reinterpret_cast<const char *>(&on), sizeof(on)) == 0;
+    }
+
+    int sendStream(socket_t s, const uint8_t *data, size_t len) noexcept {
+#ifdef _WIN32
+        return ::send(s, reinterpret_cast<const char *>(data), static_cast<int>(len), 0);
+#else
+        // A peer that already closed would otherwise raise SIGPIPE and kill the process.
+        return static_cast<int>(::send(s, data, len, MSG_NOSIGNAL));
+#endif
+    }
+
+    socket_t connectStream(const sockaddr_storage &to) noexcept {
+        socket_t s = ::socket(to.ss_family, SOCK_STREAM, IPPROTO_TCP);
+        if (s == INVALID_SOCK)
+            return INVALID_SOCK;
+        // IPv4 resolvers behind a dual-stack upstream socket are held as ::ffff:a.b.c.d.
+        if (to.ss_family == AF_INET6)
+            setDualStack(s);
+
+        // Queries are small and latency-bound; never hold one back to coalesce it.
+        const int on = 1;
+        setsockopt(s, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char *>(&on), sizeof(on));
+
+        if (!setNonBlocking(s)) {
+            closeSocket(s);
+            return INVALID_SOCK;
+        }
+        if (::connect(s, reinterpret_cast<const sockaddr *>(&to), addressLength(to)) == SOCK_ERR) {
+            const int err = lastError();
+#ifdef _WIN32
+            const bool inProgress = err == WSAEWOULDBLOCK;
+#else
+            const bool inProgress = err == EINPROGRESS;
+#endif
+            if (!inProgress) {
+                closeSocket(s);
+                return INVALID_SOCK;
+            }
+        }
+        return s;
+    }
+
+    int connectError(socket_t s) noexcept {
+        int err = 0;
+        socklen_t len = sizeof(err);
+        if (getsockopt(s, SOL_SOCKET, SO_ERROR, reinterpret_cast<char *>(&err), &len) != 0)
+            return lastError();
+        return err;
+    }
+
+    bool attachClientSteering(socket_t s, uint32_t groupSize) noexcept {
+#if defined(__linux__) && defined(SO_ATTACH_REUSEPORT_CBPF)
+        if (groupSize == 0)
+            return false;
+
+        // For reuseport programs the packet data starts at the UDP header, so the
+        // source address is reached through the network-header offset. A dual-stack
+        // socket sees both IP versions; the version nibble picks the layout.
+        //   IPv4: A = saddr
+        //   IPv6: A = saddr[0] ^ saddr[1] ^ saddr[2] ^ saddr[3]
+        //   X = A; A >>= 16; A ^= X; A %= groupSize; return A
+        const uint32_t net = static_cast<uint32_t>(SKF_NET_OFF);
+        sock_filter code[] = {
+            BPF_STMT(BPF_LD  | BPF_B   | BPF_ABS, net),
+            BPF_STMT(BPF_ALU | BPF_AND | BPF_K,   0xF0),
+            BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K,   0x60, 2, 0),
+            BPF_STMT(BPF_LD  | BPF_W   | BPF_ABS, net + 12),
+            BPF_JUMP(BPF_JMP | BPF_JA,            10, 0, 0),
+            BPF_STMT(BPF_LD  | BPF_W   | BPF_ABS, net + 8),
+            BPF_STMT(BPF_MISC| BPF_TAX, 0),
+            BPF_STMT(BPF_LD  | BPF_W   | BPF_ABS, net + 12),
+            BPF_STMT(BPF_ALU | BPF_XOR | BPF_X,   0),
+            BPF_STMT(BPF_MISC| BPF_TAX, 0),
+            BPF_STMT(BPF_LD  | BPF_W   | BPF_ABS, net + 16),
+            BPF_STMT(BPF_ALU | BPF_XOR | BPF_X,   0),
+            BPF_STMT(BPF_MISC| BPF_TAX, 0),
+            BPF_STMT(BPF_LD  | BPF_W   | BPF_ABS, net + 20),
+            BPF_STMT(BPF_ALU | BPF_XOR | BPF_X,   0),
+            BPF_STMT(BPF_MISC| BPF_TAX, 0),
+            BPF_STMT(BPF_ALU | BPF_RSH | BPF_K,   16),
+            BPF_STMT(BPF_ALU | BPF_XOR | BPF_X,   0),
+            BPF_STMT(BPF_ALU | BPF_MOD | BPF_K,   groupSize),
+            BPF_STMT(BPF_RET | BPF_A,             0),
+        };
+        sock_fprog prog{ static_cast<unsigned short>(std::size(code)), code };
+        return setsockopt(s, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog)) == 0;
+#else
+        (void)s; (void)groupSize;
+        return false;
+#endif
+    }
+
+    bool attachQueryFilter(socket_t s) noexcept {
+#if defined(__linux__)
+        // A UDP socket filter sees the datagram from its UDP header on; the DNS header
+        // follows at offset 8. The return value is how many bytes to keep, 0 drops.
+        //   if (len < 8 + 13)        drop       runt: header plus one byte of question
+        //   if (flags & QR)          drop       a response, not a query
+        //   if (QDCOUNT == 0)        drop       nothing to ask
+        //   accept
+        constexpr uint32_t dns = 8;
+        sock_filter code[] = {
+            BPF_STMT(BPF_LD  | BPF_W   | BPF_LEN, 0),
+            BPF_JUMP(BPF_JMP | BPF_JGE | BPF_K,   dns + 13, 0, 5),
+            BPF_STMT(BPF_LD  | BPF_B   | BPF_ABS, dns + 2),
+            BPF_JUMP(BPF_JMP | BPF_JSET| BPF_K,   0x80, 3, 0),
+            BPF_STMT(BPF_LD  | BPF_H   | BPF_ABS, dns + 4),
+            BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K,   0, 1, 0),
+            BPF_STMT(BPF_RET | BPF_K,             0xFFFFFFFF),
+            BPF_STMT(BPF_RET | BPF_K,             0),
+        };
+        sock_fprog prog{ static_cast<unsigned short>(std::size(code)), code };
+        return setsockopt(s, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog)) == 0;
+#else
+        (void)s;
+        return false;
+#endif
+    }
+
+    bool receiveDrops(socket_t s, uint32_t &drops) noexcept {
+#if defined(__linux__) && defined(SO_MEMINFO)
+        uint32_t info[SK_MEMINFO_VARS]{};
+        socklen_t len = sizeof(info);
+        if (getsockopt(s, SOL_SOCKET, SO_MEMINFO, info, &len) != 0 || len <= SK_MEMINFO_DROPS * sizeof(uint32_t))
+            return false;
+        drops = info[SK_MEMINFO_DROPS];
+        return true;
+#else
+        (void)s; (void)drops;
+        return false;
+#endif
+    }
+
+    bool setBusyPoll(socket_t s, uint32_t usec) noexcept {
+#if defined(__linux__) && defined(SO_BUSY_POLL)
+        const int value = static_cast<int>(std::min<uint32_t>(usec, std::numeric_limits<int>::max()));
+        if (setsockopt(s, SOL_SOCKET, SO_BUSY_POLL, &value, sizeof(value)) != 0)
+            return false;
+#ifdef SO_PREFER_BUSY_POLL
+        // Linux 5.11+: keep the NIC's interrupts off while we poll; best effort.
+        const int on = 1;
+        setsockopt(s, SOL_SOCKET, SO_PREFER_BUSY_POLL, &on, sizeof(on));
+#endif
+        return true;
+#else
+        (void)s; (void)usec;
+        return false;
+#endif
+    }
+
+    bool pinThisThread(unsigned cpu) noexcept {
+#if defined(_WIN32)
+        return SetThreadAffinityMask(GetCurrentThread(), DWORD_PTR{1} << (cpu % (sizeof(DWORD_PTR) * 8))) != 0;
+#elif defined(__linux__)
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu % CPU_SETSIZE, &set);
+        return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+        (void)cpu;
+        return false;
+#endif
+    }
+
+    int waitReadable(socket_t s, uint32_t timeout_ms) noexcept {
+#ifdef _WIN32
+        WSAPOLLFD pfd{ s, POLLRDNORM, 0 };
+        const int rc = WSAPoll(&pfd, 1, static_cast<INT>(timeout_ms));
+#else
+        pollfd pfd{ s, POLLIN, 0 };
+        int rc;
+        do {
+            rc = ::poll(&pfd, 1, static_cast<int>(timeout_ms));
+        } while (rc < 0 && errno == EINTR);
+#endif
+        if (rc < 0)  return -1;
+        return rc == 0 ? 0 : 1;
+    }
+
+    bool randomBytes(void *out, size_t len) noexcept {
+#if defined(_WIN32)
+        return BCryptGenRandom(nullptr, static_cast<PUCHAR>(out), static_cast<ULONG>(len),
+                               BCRYPT_USE_SYSTEM_PREFERRED_RNG) == 0;
+#elif defined(__linux__)
+        auto *p = static_cast<uint8_t *>(out);
+        while (len > 0) {
+            const ssize_t n = getrandom(p, len, 0);
+            if (n < 0) {
+                if (errno == EINTR)
+                    continue;
+                return false;
+            }
+            p   += n;
+            len -= static_cast<size_t>(n);
+        }
+        return true;
+#else
+        arc4random_buf(out, len);
+        return true;
+#endif
+    }
+
+    socket_t openWakeup() noexcept {
+#if defined(__linux__)
+        const int fd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        return fd >= 0 ? fd : INVALID_SOCK;
+#else
+        // No eventfd: a datagram to ourselves does the same, and any poller can watch it.
+        socket_t s = ::socket(AF_INET, SOCK_DGRAM, 0);
+        if (s == INVALID_SOCK)
+            return INVALID_SOCK;
+        sockaddr_in addr{};
+        addr.sin_family      = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t addrLen    = sizeof(addr);
+        if (::bind(s, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0 ||
+            ::getsockname(s, reinterpret_cast<sockaddr *>(&addr), &addrLen) != 0 ||
+            ::connect(s, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0 || !setNonBlocking(s)) {
+            closeSocket(s);
+            return INVALID_SOCK;
+        }
+        return s;
+#endif
+    }
+
+    void signalWakeup(socket_t s) noexcept {
+#if defined(__linux__)
+        const uint64_t one = 1;
+        [[maybe_unused]] const auto n = ::write(s, &one, sizeof(one));
+#else
+        const char byte = 0;
+        ::send(s, &byte, 1, 0);
+#endif
+    }
+
+    void clearWakeup(socket_t s) noexcept {
+#if defined(__linux__)
+        uint64_t count = 0;
+        [[maybe_unused]] const auto n = ::read(s, &count, sizeof(count));
+#else
+        char buf[64];
+        while (::recv(s, buf, sizeof(buf), 0) > 0) {}
+#endif
+    }
+
+    // Poller
+
+#if defined(__linux__)
+
+    Poller::~Poller() noexcept {
+        if (epfd_ >= 0)
+            ::close(epfd_);
+    }
+
+    bool Poller::open() noexcept {
+        if (epfd_ >= 0)
+            ::close(epfd_);
+        epfd_ = epoll_create1(EPOLL_CLOEXEC);
+        ready_.reserve(MAX_EVENTS);
+        return epfd_ >= 0;
+    }
+
+    bool Poller::add(socket_t s) noexcept {
+        epoll_event ev{};
+        ev.events  = EPOLLIN;
+        ev.data.fd = s;
+        return epoll_ctl(epfd_, EPOLL_CTL_ADD, s, &ev) == 0;
+    }
+
+    bool Poller::setWritable(socket_t s, bool on) noexcept {
+        epoll_event ev{};
+        ev.events  = EPOLLIN | (on ? EPOLLOUT : 0u);
+        ev.data.fd = s;
+        return epoll_ctl(epfd_, EPOLL_CTL_MOD, s, &ev) == 0;
+    }
+
+    void Poller::remove(socket_t s) noexcept {
+        epoll_ctl(epfd_, EPOLL_CTL_DEL, s, nullptr);
+    }
+
+    int Poller::wait(int timeout_ms) noexcept {
+        epoll_event events[MAX_EVENTS];
+        const int n = epoll_wait(epfd_, events, MAX_EVENTS, timeout_ms);
+        ready_.clear();
+        for (int i = 0; i < n; ++i)
+            ready_.push_back(events[i].data.fd);
+        return n;
+    }
+
+#else
+
+    Poller::~Poller() noexcept = default;
+
+    bool Poller::open() noexcept {
+        watched_.clear();
+        writable_.clear();
+        ready_.clear();
+        return true;
+    }
+
+    bool Poller::add(socket_t s) noexcept {
+        watched_.push_back(s);
+        writable_.push_back(false);
+        return true;
+    }
+
+    bool Poller::setWritable(socket_t s, bool on) noexcept {
+        for (size_t i = 0; i < watched_.size(); ++i)
+            if (watched_[i] == s) {
+                writable_[i] = on;
+                return true;
+            }
+        return false;
+    }
+
+    void Poller::remove(socket_t s) noexcept {
+        for (size_t i = 0; i < watched_.size(); ++i)
+            if (watched_[i] == s) {
+                watched_.erase(watched_.begin() + static_cast<std::ptrdiff_t>(i));
+                writable_.erase(writable_.begin() + static_cast<std::ptrdiff_t>(i));
+                return;
+            }
+    }
+
+    int Poller::wait(int timeout_ms) noexcept {
+#ifdef _WIN32
+        std::vector<WSAPOLLFD> fds;
+        for (size_t i = 0; i < watched_.size(); ++i)
+            fds.push_back({ watched_[i], static_cast<SHORT>(POLLRDNORM | (writable_[i] ? POLLWRNORM : 0)), 0 });
+        const int n = WSAPoll(fds.data(), static_cast<ULONG>(fds.size()), timeout_ms);
+#else
+        std::vector<pollfd> fds;
+        for (size_t i = 0; i < watched_.size(); ++i)
+            fds.push_back({ watched_[i], static_cast<short>(POLLIN | (writable_[i] ? POLLOUT : 0)), 0 });
+        const int n = ::poll(fds.data(), fds.size(), timeout_ms);
+#endif
+        ready_.clear();
+        if (n <= 0)
+            return n;
+        for (const auto &fd : fds)
+            if (fd.revents != 0) ready_.push_back(fd.fd);
+        return static_cast<int>(ready_.size());
+    }
+
+#endif
+
+    socket_t Poller::ready(int i) const noexcept {
+        return ready_[static_cast<size_t>(i)];
+    }
+
+} // namespace DNS::Server::Platform
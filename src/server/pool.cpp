@@ -0,0 +1,49 @@
+#include "../../include/server/pool.hpp"
+
+#include <algorithm>
+#include <utility>
+
+namespace DNS::Server {
+
+    PacketPool::Buffer &PacketPool::Buffer::operator=(Buffer &&other) noexcept {
+        if (this != &other) {
+            release();
+            pool_ = std::exchange(other.pool_, nullptr);
+            slot_ = other.slot_;
+        }
+        return *this;
+    }
+
+    void PacketPool::Buffer::release() noexcept {
+        if (pool_)
+            pool_->put(slot_);
+        pool_ = nullptr;
+    }
+
+    void PacketPool::reset(size_t slots) {
+        slots = std::max<size_t>(slots, 1);
+        // Default-initialised: every byte is written by a recv or a memcpy before it is read.
+        storage_.reset(static_cast<uint8_t *>(::operator new[](slots * SLOT_SIZE, std::align_val_t{ ALIGNMENT })));
+        slots_ = slots;
+        free_.clear();
+        free_.reserve(slots);
+        for (size_t i = slots; i-- > 0;)
+            free_.push_back(static_cast<uint32_t>(i));
+    }
+
+    PacketPool::Buffer PacketPool::acquire() noexcept {
+        uint32_t slot = 0;
+        if (!take(slot))
+            return {};
+        return Buffer(this, slot);
+    }
+
+    bool PacketPool::take(uint32_t &slot) noexcept {
+        if (free_.empty())
+            return false;
+        slot = free_.back();
+        free_.pop_back();
+        return true;
+    }
+
+} // namespace DNS::Server
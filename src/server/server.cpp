@@ -1,80 +1,186 @@
 #include "../../include/server/server.hpp"
 #include "../../include/parser/parser.hpp"
+#include "../../include/server/edns.hpp"
 
 #include <print>
 #include <fstream>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <thread>
 
-// TODO Handle:
 // Windows-only: when a previous sendto() reaches a client that already closed
 // its port, Windows injects an ICMP error back into this socket, causing the
-// next recvfrom() to fail with WSAECONNRESET.
-// On Linux this never happens so no equivalent is needed.
+// next recvfrom() to fail with WSAECONNRESET. handleQuery() treats that
+// (Platform::isConnReset) as a harmless no-op rather than a receive failure.
+// On Linux an unconnected UDP socket never reports this.
 
 namespace DNS::Server {
+
+    namespace {
+        // Health probe for an open circuit: ". IN NS" with RD set. Any recursive resolver
+        // answers it from cache, so a reply means the resolver itself is back.
+        constexpr uint8_t PROBE_QUERY[] = {
+            0x00, 0x00, 0x01, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+            0x00, 0x00, 0x02, 0x00, 0x01,
+        };
+    }
+
     Listener::~Listener() noexcept {
+        // Stop and join worker threads before their sockets go away.
+        threads_.clear();
+        workers_.clear();
+        tcpClients_.closeAll();
+        dohClients_.closeAll();
+        tcpUpstreams_.closeAll();
+        dohUpstreams_.closeAll();
         closeSocket(socket_);
         closeSocket(upstream_);
-        WSACleanup();
+        closeSocket(tcp_);
+        closeSocket(doh_);
+        Platform::cleanup();
     }
 
-    void Listener::closeSocket(SOCKET &s) noexcept {
-        if (s != INVALID_SOCKET) {
-            closesocket(s);
-            s = INVALID_SOCKET;
-        }
+    void Listener::closeSocket(Platform::socket_t &s) noexcept {
+        Platform::closeSocket(s);
     }
 
     DNS::Error Listener::init(const Config &cfg) noexcept {
         cfg_ = cfg;
+        cfg_.ednsPayload = std::clamp<uint16_t>(cfg_.ednsPayload, DNS::Limits::MAX_UDP_PACKET,
+                                                DNS::Limits::MAX_EDNS_PAYLOAD);
 
-        WSADATA wsa{};
-        if (WSAStartup(MAKEWORD(2, 2), &wsa) != 0)
+        if (!Platform::startup())
             return DNS::Error::SERVER_SOCKET_FAIL;
 
         closeSocket(socket_);
         closeSocket(upstream_);
-        socket_ = ::socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
-        if (socket_ == INVALID_SOCKET)
-            return DNS::Error::SERVER_SOCKET_FAIL;
+        closeSocket(tcp_);
+        closeSocket(doh_);
 
+        // The listener's address family follows serverIp; an IPv6 listener is dual-stack,
+        // so binding "::" serves IPv4 and IPv6 clients on one socket.
+        sockaddr_storage bindAddr{};
+        if (!Platform::parseAddress(cfg_.serverIp, cfg_.portServerIp, bindAddr))
+            return DNS::Error::INVALID_IP;
 
-        sockaddr_in bindAddr{};
-        bindAddr.sin_family = AF_INET;
-        bindAddr.sin_port = htons(cfg_.portServerIp);
+        socket_ = ::socket(bindAddr.ss_family, SOCK_DGRAM, IPPROTO_UDP);
+        if (socket_ == Platform::INVALID_SOCK)
+            return DNS::Error::SERVER_SOCKET_FAIL;
+        if (bindAddr.ss_family == AF_INET6 && !Platform::setDualStack(socket_))
+            std::println(YELLOW "[WARN] Dual-stack unavailable , IPv6 clients only" RESET);
 
-        if (inet_pton(AF_INET, cfg_.serverIp.c_str(), &bindAddr.sin_addr) != 1) {
-            closeSocket(socket_);
-            return DNS::Error::INVALID_IP;
+        // Multi-worker mode: every worker binds its own socket to the same address and
+        // the kernel spreads incoming datagrams across them.
+        if (cfg_.workers > 1 && !Platform::setReusePort(socket_)) {
+            std::println(YELLOW "[WARN] SO_REUSEPORT unavailable , falling back to a single worker" RESET);
+            cfg_.workers = 1;
         }
+
         if (bind(socket_, reinterpret_cast<sockaddr *>(&bindAddr),
-                sizeof(bindAddr)) == SOCKET_ERROR) {
+                Platform::addressLength(bindAddr)) == Platform::SOCK_ERR) {
             closeSocket(socket_);
             return DNS::Error::SERVER_BIND_FAIL;
         }
 
-        upstream_ = ::socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
-        if (upstream_ == INVALID_SOCKET) {
+        // One unconnected socket reaches every resolver; the pool decides where each query goes.
+        // With any IPv6 resolver it is a dual-stack IPv6 socket and the pool holds the IPv4
+        // ones in mapped form, so replies compare equal without converting anything.
+        const uint16_t upstreamPort = cfg_.upstreamDoh ? DNS::Port::HTTPS
+                                    : cfg_.upstreamTls ? DNS::Port::DNS_TLS : DNS::Port::DNS;
+        if (upstreams_.init(cfg_.upstreamIps, upstreamPort) != DNS::Error::OK) {
             closeSocket(socket_);
-            return DNS::Error::SERVER_SOCKET_FAIL;
+            return DNS::Error::INVALID_IP;
         }
 
-        upstreamAddr_.sin_family = AF_INET;
-        upstreamAddr_.sin_port = htons(DNS::Port::DNS);
+        upstream_ = ::socket(upstreams_.family(), SOCK_DGRAM, IPPROTO_UDP);
+        if (upstream_ == Platform::INVALID_SOCK ||
+            (upstreams_.family() == AF_INET6 && !Platform::setDualStack(upstream_))) {
+            closeSocket(socket_);
+            closeSocket(upstream_);
+            return DNS::Error::SERVER_SOCKET_FAIL;
+        }
+        // TCP to the resolvers is opened on demand, for truncated answers (or every query).
+        // With DNS over TLS the same connections carry every query, encrypted; with DNS over
+        // HTTPS HTTP/2 connections of their own do.
+        if (cfg_.upstreamTls || cfg_.upstreamDoh) {
+            std::vector<TlsClient::Peer> peers;
+            for (size_t i = 0; i < upstreams_.size(); ++i) {
+                const Upstream &u = upstreams_[static_cast<uint8_t>(i)];
+                peers.push_back({ .ip = u.name, .host = u.tlsName });
+            }
+            if (const auto err = tls_.init(std::move(peers), cfg_.tlsCaFile, cfg_.upstreamDoh); err != DNS::Error::OK) {
+                closeSocket(socket_);
+                closeSocket(upstream_);
+                return err;
+            }
+        }
+        tcpUpstreams_.init(upstreams_.size(), cfg_.upstreamTls ? &tls_ : nullptr);
+        if (cfg_.upstreamDoh)
+            dohUpstreams_.init(upstreams_.size(), &tls_);
 
-        if (inet_pton(AF_INET, cfg_.upstreamIp.c_str(), &upstreamAddr_.sin_addr) != 1) {
+        // Both sockets are non-blocking: serve() sleeps in the poller instead of recvfrom(),
+        // and upstream replies are picked up whenever they arrive, so a dead resolver
+        // never stalls the listener.
+        if (!Platform::setNonBlocking(socket_) || !Platform::setNonBlocking(upstream_)) {
             closeSocket(socket_);
             closeSocket(upstream_);
-            return DNS::Error::INVALID_IP;
+            return DNS::Error::SERVER_SOCKET_FAIL;
+        }
+
+        // DNS over TCP on the same address. Optional: without it the listener still serves
+        // UDP, clients just cannot retry truncated answers.
+        if (cfg_.tcp) {
+            tcp_ = listenStream(bindAddr);
+            if (tcp_ == Platform::INVALID_SOCK)
+                std::println(YELLOW "[WARN] TCP listener unavailable , error {} , serving UDP only" RESET,
+                    Platform::lastError());
+        }
+
+        // DNS over HTTPS on its own port. A certificate that does not load is a configuration
+        // error; a port that cannot be bound only costs the DoH listener.
+        if (cfg_.dohPort != 0) {
+            if (const auto err = dohTls_.init(cfg_.dohCert, cfg_.dohKey); err != DNS::Error::OK) {
+                closeSocket(socket_);
+                closeSocket(upstream_);
+                closeSocket(tcp_);
+                return err;
+            }
+            sockaddr_storage dohAddr{};
+            Platform::parseAddress(cfg_.serverIp, cfg_.dohPort, dohAddr);
+            doh_ = listenStream(dohAddr);
+            if (doh_ == Platform::INVALID_SOCK)
+                std::println(YELLOW "[WARN] DNS-over-HTTPS listener unavailable , error {}" RESET,
+                    Platform::lastError());
+            dohClients_.init(&dohTls_);
         }
 
-        // Apply a receive timeout on the upstream socket so a dead resolver
-        // never stalls the listener indefinitely.
-        DWORD timeout = cfg_.timeout_ms;
-        setsockopt(upstream_, SOL_SOCKET, SO_RCVTIMEO,
-                    reinterpret_cast<const char *>(&timeout), sizeof(timeout));
+        // Junk is dropped before it reaches the receive queue; without the filter
+        // handleQuery() and classify() reject the same datagrams themselves.
+        prefiltered_ = cfg_.prefilter && Platform::attachQueryFilter(socket_);
+        if (cfg_.prefilter && !prefiltered_)
+            std::println(YELLOW "[WARN] Could not attach the query prefilter , error {}" RESET, Platform::lastError());
 
-        std::println(GREEN "[INFO] Listener bound to {}:{}" RESET, cfg_.serverIp, cfg_.portServerIp);
-        std::println(GREEN "[INFO] Upstream resolver : {}" RESET, cfg_.upstreamIp);
+        // Busy-poll mode spins in user space either way; SO_BUSY_POLL adds a pass over the
+        // NIC's receive queue to each non-blocking check, where the driver supports it.
+        if (cfg_.busyPoll_us > 0 &&
+            (!Platform::setBusyPoll(socket_, cfg_.busyPoll_us) || !Platform::setBusyPoll(upstream_, cfg_.busyPoll_us)))
+            std::println(YELLOW "[WARN] Could not set SO_BUSY_POLL , error {} , spinning in user space only" RESET,
+                Platform::lastError());
+
+        std::println(GREEN "[INFO] Listener bound to {}:{} (UDP{})" RESET, cfg_.serverIp, cfg_.portServerIp,
+            tcp_ != Platform::INVALID_SOCK ? " + TCP" : "");
+        if (doh_ != Platform::INVALID_SOCK)
+            std::println(GREEN "[INFO] DNS over HTTPS on {}:{} , https://.../dns-query over HTTP/2" RESET,
+                cfg_.serverIp, cfg_.dohPort);
+        for (size_t i = 0; i < upstreams_.size(); ++i) {
+            const Upstream &u = upstreams_[static_cast<uint8_t>(i)];
+            if (cfg_.upstreamTls || cfg_.upstreamDoh)
+                std::println(GREEN "[INFO] Upstream resolver : {} ({} port {} , authenticated as {})" RESET,
+                    u.name, streamTransport(), upstreamPort, u.tlsName.empty() ? u.name : u.tlsName);
+            else
+                std::println(GREEN "[INFO] Upstream resolver : {}" RESET, u.name);
+        }
         return DNS::Error::OK;
     }
 
@@ -89,60 +195,793 @@ namespace DNS::Server {
             while (std::getline(file, line)) {
                 std::transform(line.begin(), line.end(), line.begin(),
                                 [](unsigned char c) { return std::tolower(c); });
-                blocklist_.insert(line);
+                blocklist_->insert(line);
             }
         }
-        std::println(GREEN "[INFO] Blocklist loaded , {} domain(s) total" RESET, blocklist_.size());
+        std::println(GREEN "[INFO] Blocklist loaded , {} domain(s) total" RESET, blocklist_->size());
         return DNS::Error::OK;
     }
 
     DNS::Error Listener::run() noexcept {
-        if (socket_ == INVALID_SOCKET)
+        if (socket_ == Platform::INVALID_SOCK)
             return DNS::Error::SERVER_NOT_RUNNING;
 
+        // One classify pool for every worker; each gets its queries back on its own loop.
+        if (cfg_.classifyThreads > 0 && !classifyPool_) {
+            classifyPool_ = std::make_shared<Exec::ThreadPool>();
+            classifyPool_->start(cfg_.classifyThreads);
+            ownsClassifyPool_ = true;
+            std::println(GREEN "[INFO] Classifying queries on a pool of {} thread(s)" RESET, classifyPool_->size());
+        }
+
+        if (cfg_.pipeline)
+            return servePipelined();
+
+        const unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+        if (cfg_.workers <= 1) {
+            // A spinning worker should keep its core, and its caches, to itself.
+            if (cfg_.firstCore > 0 || cfg_.busyPoll_us > 0)
+                Platform::pinThisThread(cfg_.firstCore % cores);
+            return serve({});
+        }
+
+        // Thread-per-core: this Listener is worker 0; workers 1..N-1 get their own
+        // SO_REUSEPORT socket, upstream socket and batches, and share the blocklist
+        // read-only (nothing writes to it once run() starts).
+        const unsigned first = cfg_.firstCore;
+        for (uint32_t i = 1; i < cfg_.workers; ++i) {
+            auto worker = std::make_unique<Listener>();
+            worker->blocklist_    = blocklist_;
+            worker->classifyPool_ = classifyPool_;
+            if (auto err = worker->init(cfg_); err != DNS::Error::OK) {
+                std::println(YELLOW "[WARN] Worker {} failed to start: {}" RESET, i, DNS::errorToString(err));
+                continue;
+            }
+            Listener *w = worker.get();
+            workers_.push_back(std::move(worker));
+            threads_.emplace_back([w, i, first, cores](std::stop_token st) {
+                Platform::pinThisThread((first + i) % cores);
+                if (auto err = w->serve(st); err != DNS::Error::OK)
+                    std::println(YELLOW "[WARN] Worker {} stopped: {}" RESET, i, DNS::errorToString(err));
+            });
+        }
+
+        // Client affinity: replace the kernel's 4-tuple hash with a program that maps each
+        // client IP to one worker, so per-worker state for that client stays on one core.
+        if (cfg_.clientAffinity) {
+            const auto group = static_cast<uint32_t>(workers_.size() + 1);
+            // The same program steers TCP connections (it only reads the IP header).
+            if (tcp_ != Platform::INVALID_SOCK)
+                Platform::attachClientSteering(tcp_, group);
+            if (doh_ != Platform::INVALID_SOCK)
+                Platform::attachClientSteering(doh_, group);
+            if (Platform::attachClientSteering(socket_, group))
+                std::println(GREEN "[INFO] Client-affinity steering across {} worker(s)" RESET, group);
+            else
+                std::println(YELLOW "[WARN] Could not attach client-affinity program , error {}" RESET,
+                    Platform::lastError());
+        }
+
+        std::println(GREEN "[INFO] {} worker(s) running on {} core(s)" RESET, workers_.size() + 1, cores);
+        Platform::pinThisThread(first % cores);
+        return serve({});
+    }
+
+    DNS::Error Listener::serve(std::stop_token stop) noexcept {
+        // Queries classified on the pool resume on this thread, the next time loop_ is drained.
+        if (classifyPool_) {
+            if (!loop_.open())
+                return DNS::Error::SERVER_SOCKET_FAIL;
+            classifier_ = classifyPool_->scheduler();
+            home_       = loop_.scheduler();
+        }
+
+        if (cfg_.engine == IoEngine::URING && !pipeline_) {
+            if (auto err = serveUring(stop); err != DNS::Error::SERVER_SOCKET_FAIL)
+                return err;
+            std::println(YELLOW "[WARN] io_uring unavailable , falling back to the poll engine" RESET);
+        }
+
+        Platform::Poller poller;
+        // In pipeline mode the receive stage owns socket_; the classify stage rings instead.
+        if (!poller.open() || !poller.add(upstream_) ||
+            !poller.add(pipeline_ ? pipeline_->upstreamBell.fd() : socket_))
+            return DNS::Error::SERVER_SOCKET_FAIL;
+        // TCP clients share the poller: accepted sockets are added and removed as they come and go.
+        if (tcp_ != Platform::INVALID_SOCK && poller.add(tcp_))
+            tcpClients_.attach(&poller);
+        if (doh_ != Platform::INVALID_SOCK && poller.add(doh_))
+            dohClients_.attach(&poller);
+        // So do the connections to the resolvers.
+        tcpUpstreams_.attach(&poller);
+        dohUpstreams_.attach(&poller);
+        if (loop_.fd() != Platform::INVALID_SOCK && !poller.add(loop_.fd()))
+            return DNS::Error::SERVER_SOCKET_FAIL;
+
+        // A batch size of 1 keeps the classic one-datagram-per-syscall path.
+        const bool batched = cfg_.batchSize > 1;
+        if (batched) {
+            rx_.reset(cfg_.batchSize);
+            upstreamRx_.reset(cfg_.batchSize);
+            std::println(GREEN "[INFO] Batched I/O enabled , up to {} datagrams per syscall" RESET, rx_.capacity());
+        }
+        // The slow path's outbox: upstream-bound queries collected during one fast-path pass.
+        upstreamTx_.reset(batched ? cfg_.batchSize : FAST_PATH_BUDGET);
+        clientTx_.reset(batched ? cfg_.batchSize : FAST_PATH_BUDGET);
+        packets_.reset(PACKET_SLOTS);
+
         std::println(GREEN "[INFO] Listener running , waiting for queries..." RESET);
 
-        for (;;) {
-            if (auto err = handleQuery(); err != DNS::Error::OK) {
-                std::println(YELLOW "[WARN] handleQuery error: {}" RESET, DNS::errorToString(err));
+        // Workers wake up periodically so a stop request from ~Listener() is noticed;
+        // the single-worker path has nothing to stop it and sleeps indefinitely.
+        const int waitMs = stop.stop_possible() ? STOP_POLL_MS : -1;
+
+        while (!stop.stop_requested()) {
+            // Sleep until a datagram is queued on either socket or the oldest
+            // in-flight query is due to time out. Busy-poll mode first spins on
+            // non-blocking waits, unless something is due right now anyway.
+            const int budget = waitBudget(waitMs);
+            int ready = 0;
+            if (budget == 0 || !busyPoll([&] { return (ready = poller.wait(0)) != 0; }))
+                ready = poller.wait(budget);
+            if (ready < 0) {
+                if (!Platform::isInterrupted(Platform::lastError()))
+                    std::println(YELLOW "[WARN] poll failed , error {}" RESET, Platform::lastError());
+                continue;
+            }
+
+            const Platform::socket_t bell = pipeline_ ? pipeline_->upstreamBell.fd() : Platform::INVALID_SOCK;
+            auto isStream = [&](Platform::socket_t s) {
+                return s != upstream_ && s != socket_ && s != loop_.fd() && s != bell;
+            };
+            bool listenerReady = false, upstreamReady = false, tcpReady = false, loopReady = false,
+                 classifiedReady = false;
+            for (int i = 0; i < ready; ++i) {
+                const Platform::socket_t s = poller.ready(i);
+                if (s == upstream_)         upstreamReady = true;
+                else if (s == socket_)      listenerReady = true;
+                else if (s == loop_.fd())   loopReady = true;
+                else if (s == bell)         classifiedReady = true;
+                else                        tcpReady = true;
+            }
+
+            // Fast path: drain the listener first. Blocked names are answered inline;
+            // upstream-bound queries only get an in-flight entry and wait in upstreamTx_.
+            // The pass is bounded so a flood cannot starve the slow path; the poller is
+            // level-triggered and wakes straight up again for whatever is left.
+            if (listenerReady) {
+                for (uint32_t n = 0; n < FAST_PATH_BUDGET; ++n) {
+                    const auto err = batched ? handleBatch() : handleQuery();
+                    if (err == DNS::Error::SERVER_WOULD_BLOCK)
+                        break;
+                    if (err != DNS::Error::OK)
+                        std::println(YELLOW "[WARN] handleQuery error: {}" RESET, DNS::errorToString(err));
+                }
+            }
+
+            // TCP clients are part of the fast path too: each ready connection is drained
+            // and every pipelined query in it classified, without waiting on any answer.
+            if (tcpReady)
+                for (int i = 0; i < ready; ++i)
+                    if (const Platform::socket_t s = poller.ready(i); isStream(s))
+                        handleTcp(s);
+
+            // Pipeline mode: the queries the classify stage found must be forwarded.
+            if (classifiedReady)
+                takeClassified();
+
+            // Queries back from the classify pool: blocked ones are answered, the rest queued
+            // for the slow path below, like those of the fast path.
+            if (loopReady)
+                loop_.drain();
+
+            // Slow path: everything that involves the upstream resolver, only once
+            // every local answer of this pass is already on its way.
+            if (auto err = flushUpstream(); err != DNS::Error::OK)
+                std::println(YELLOW "[WARN] flushUpstream error: {}" RESET, DNS::errorToString(err));
+
+            if (upstreamReady) {
+                for (;;) {
+                    const auto err = handleUpstream();
+                    if (err == DNS::Error::SERVER_WOULD_BLOCK)
+                        break;
+                    if (err != DNS::Error::OK)
+                        std::println(YELLOW "[WARN] handleUpstream error: {}" RESET, DNS::errorToString(err));
+                }
+            }
+
+            // Whatever is still unanswered past its hedge delay or RTO gets another attempt;
+            // resolvers with an open circuit get their probe.
+            if (retryInflight() + probeUpstreams() > 0) {
+                if (auto err = flushUpstream(); err != DNS::Error::OK)
+                    std::println(YELLOW "[WARN] flushUpstream error: {}" RESET, DNS::errorToString(err));
+            }
+
+            expireInflight();
+            if (auto err = flushClientTx(); err != DNS::Error::OK)
+                std::println(YELLOW "[WARN] flushClientTx error: {}" RESET, DNS::errorToString(err));
+            sweepTcp();
+            logStats();
+        }
+        abandonInflight();
+        tcpClients_.closeAll();
+        tcpClients_.attach(nullptr);
+        dohClients_.closeAll();
+        dohClients_.attach(nullptr);
+        tcpUpstreams_.closeAll();
+        tcpUpstreams_.attach(nullptr);
+        dohUpstreams_.closeAll();
+        dohUpstreams_.attach(nullptr);
+        return DNS::Error::OK;
+    }
+
+    int Listener::waitBudget(int idleMs) const noexcept {
+        const auto now = std::chrono::steady_clock::now();
+        int due = inflight_.msUntilNextDeadline(now);
+        if (const int probeDue = upstreams_.msUntilNextProbe(now); probeDue >= 0)
+            due = due < 0 ? probeDue : std::min(due, probeDue);
+        if (tcpClients_.size() > 0 || dohClients_.size() > 0 || tcpUpstreams_.size() > 0 || dohUpstreams_.size() > 0) {
+            const auto left = std::chrono::ceil<std::chrono::milliseconds>(nextTcpSweep_ - now).count();
+            const int sweepDue = left > 0 ? static_cast<int>(left) : 0;
+            due = due < 0 ? sweepDue : std::min(due, sweepDue);
+        }
+        if (cfg_.statsInterval_s > 0) {
+            const auto left = std::chrono::ceil<std::chrono::milliseconds>(nextStats_ - now).count();
+            const int statsDue = left > 0 ? static_cast<int>(left) : 0;
+            due = due < 0 ? statsDue : std::min(due, statsDue);
+        }
+        if (due < 0)  return idleMs;
+        if (idleMs < 0) return due;
+        return std::min(idleMs, due);
+    }
+
+    size_t Listener::retryInflight() noexcept {
+        retryDue_.clear();
+        const auto now = std::chrono::steady_clock::now();
+        if (inflight_.dueRetries(now, retryDue_) == 0)
+            return 0;
+
+        size_t sent = 0;
+        for (const uint16_t primaryId : retryDue_) {
+            const InflightTable::Entry *primary = inflight_.find(primaryId);
+            if (!primary)
+                continue;
+            InflightTable::Entry *last = inflight_.find(primary->ids[primary->attempts - 1]);
+            if (!last)
+                continue;
+            const bool    hedge = primary->hedgeNext;
+            const uint8_t lastUpstream = last->upstream;
+
+            // A retransmit means the latest attempt missed its RTO: count it against its
+            // resolver now (feeding failover) rather than when the whole query expires.
+            // A hedge fires before the RTO and proves nothing about the resolver.
+            if (!hedge && !last->charged) {
+                last->charged = true;
+                chargeTimeout(lastUpstream, now);
+            }
+
+            // Prefer a resolver other than the one that just stayed silent; with a single
+            // upstream (or none other healthy) a retransmit goes back to the same one,
+            // unless charging it just now opened its circuit.
+            const bool overTcp = streamOnly() || primary->overTcp;
+            std::optional<uint8_t> target = upstreams_.pickOther(lastUpstream);
+            if (!target && !hedge && !upstreams_[lastUpstream].open) {
+                // Over TCP the query cannot get lost on its way; sending it down the same
+                // connection again only doubles the resolver's work. Wait another RTO instead.
+                const uint16_t lastId = primary->ids[primary->attempts - 1];
+                if (overTcp && (cfg_.upstreamDoh ? dohUpstreams_.waiting(lastUpstream, lastId)
+                                                 : tcpUpstreams_.waiting(lastUpstream, lastId))) {
+                    inflight_.scheduleRetry(primaryId,
+                        now + upstreams_.rto(lastUpstream, static_cast<uint8_t>(primary->retransmits + 1)), false);
+                    continue;
+                }
+                target = lastUpstream;
+                ++upstreams_[lastUpstream].sent;
+            }
+            if (!target) {
+                if (hedge) {
+                    // Nobody else to hedge to: fall back to a plain retransmit at the RTO.
+                    inflight_.scheduleRetry(primaryId, last->sent + upstreams_.rto(lastUpstream), false);
+                    continue;
+                }
+                // Every circuit is open; waiting out timeout_ms would not change the answer.
+                const auto query = inflight_.query(primaryId);
+                Pending<InflightTable::Outcome> *waiter = primary->waiter;
+                inflight_.take(primaryId);
+                if (waiter)
+                    waiter->resume({ InflightTable::Outcome::Kind::FAILED, query });
+                continue;
+            }
+
+            const auto attemptId = inflight_.addAttempt(primaryId, *target, hedge, now);
+            if (!attemptId)
+                continue;
+            primary = inflight_.find(primaryId);
+
+            // Once a query got a truncated answer, UDP would only bring the same again.
+            if (overTcp) {
+                if (!streamQuery(*attemptId))
+                    continue;
+            } else {
+                const auto query = inflight_.query(attemptId.value());
+                if (upstreamTx_.size() == upstreamTx_.capacity())
+                    flushUpstream();
+                const size_t slot = upstreamTx_.size();
+                if (!upstreamTx_.push(query.data(), query.size(), upstreams_[*target].addr))
+                    continue;
+                upstreamTx_.data(slot)[0] = static_cast<uint8_t>(*attemptId >> 8);
+                upstreamTx_.data(slot)[1] = static_cast<uint8_t>(*attemptId & 0xFF);
+                ++sent;
+            }
+
+            const std::string silent = upstreams_[lastUpstream].name;
+            const auto waited = std::chrono::duration_cast<std::chrono::milliseconds>(now - primary->sent).count();
+            if (hedge) {
+                ++upstreams_[*target].hedged;
+                std::println(YELLOW "[HEDGE] No answer from {} within {} ms , asking {} as well" RESET,
+                    silent, waited, upstreams_[*target].name);
+            } else {
+                ++upstreams_[*target].retransmits;
+                std::println(YELLOW "[RETRY] No answer from {} after {} ms , attempt {} to {}" RESET,
+                    silent, waited, primary->attempts, upstreams_[*target].name);
+            }
+
+            // Arm the next retransmit from the new attempt's RTO, backed off per retransmit.
+            inflight_.scheduleRetry(primaryId, now + upstreams_.rto(*target, primary->retransmits), false);
+        }
+        return sent;
+    }
+
+    void Listener::chargeTimeout(uint8_t upstream, std::chrono::steady_clock::time_point now) noexcept {
+        const Upstream &u = upstreams_[upstream];
+        if (upstreams_.onTimeout(upstream, now))
+            std::println(YELLOW "[WARN] Upstream {} circuit open after {} timeouts in a row , loss {:.0f}% , probing" RESET,
+                u.name, u.failures, u.loss * 100.0);
+    }
+
+    size_t Listener::probeUpstreams() noexcept {
+        probeDue_.clear();
+        const auto now = std::chrono::steady_clock::now();
+        if (upstreams_.dueProbes(now, probeDue_) == 0)
+            return 0;
+
+        size_t sent = 0;
+        for (const uint8_t i : probeDue_) {
+            // Probes live in inflight_ like queries, so they get a random ID and a deadline.
+            InflightTable::Entry entry;
+            entry.upstream = i;
+            entry.sent     = now;
+            entry.deadline = now + UpstreamPool::RTO_CEILING;
+            entry.probe    = true;
+
+            const auto probeId = inflight_.insert(entry, PROBE_QUERY, sizeof(PROBE_QUERY));
+            if (!probeId) {
+                upstreams_.onProbeTimeout(i, now);
+                continue;
+            }
+
+            // A DNS-over-TLS or -HTTPS resolver has nothing listening for UDP on its port.
+            if (cfg_.upstreamTls || cfg_.upstreamDoh) {
+                if (!streamQuery(*probeId)) {
+                    inflight_.take(*probeId);
+                    upstreams_.onProbeTimeout(i, now);
+                }
+                continue;
+            }
+
+            if (upstreamTx_.size() == upstreamTx_.capacity())
+                flushUpstream();
+            const size_t slot = upstreamTx_.size();
+            if (!upstreamTx_.push(PROBE_QUERY, sizeof(PROBE_QUERY), upstreams_[i].addr)) {
+                inflight_.take(*probeId);
+                upstreams_.onProbeTimeout(i, now);
+                continue;
+            }
+            upstreamTx_.data(slot)[0] = static_cast<uint8_t>(*probeId >> 8);
+            upstreamTx_.data(slot)[1] = static_cast<uint8_t>(*probeId & 0xFF);
+            ++sent;
+        }
+        return sent;
+    }
+
+    bool Listener::failFast(const uint8_t *query, size_t len, const sockaddr_storage &client, uint32_t tcp,
+                            uint32_t stream) noexcept {
+        // Echo the question back with RCODE=SERVFAIL; records the client sent (EDNS OPT) are dropped.
+        auto message = DNS::Parser::MessageParser::parse(query, len);
+        if (!message)
+            return false;
+        message->getHeader().setQr(true);
+        message->getHeader().setRa(true);
+        message->getHeader().setRcode(DNS::RCode::SERVFAIL);
+        message->getHeader().setAnswers(0);
+        message->getHeader().setAuthorities(0);
+        message->getHeader().setAdditionals(0);
+        message->setAnswers({});
+        message->setAuthority({});
+        message->setAdditional({});
+
+        const auto encoded = DNS::Parser::MessageParser::encode(*message);
+        if (!encoded)
+            return false;
+
+        if (tcp != 0)
+            return sendStream(tcp, stream, encoded->data(), encoded->size());
+
+        if (clientTx_.size() == clientTx_.capacity())
+            flushClientTx();
+        if (!clientTx_.push(encoded->data(), encoded->size(), client))
+            return false;
+        std::println(YELLOW "[FALLBACK] Every upstream circuit is open , SERVFAIL for {}" RESET, Platform::formatAddress(client));
+        return true;
+    }
+
+    DNS::Error Listener::flushClientTx() noexcept {
+        const size_t queued = clientTx_.size();
+        if (queued == 0)
+            return DNS::Error::OK;
+        if (pipeline_) {
+            // The send stage owns socket_'s sending side; never wait for it here.
+            size_t dropped = 0;
+            for (size_t i = 0; i < queued; ++i) {
+                const bool queuedOk = pipeline_->toSend.push([&](Datagram &d) {
+                    d.addr = clientTx_.addr(i);
+                    d.len  = clientTx_.length(i);
+                    std::memcpy(d.data, clientTx_.data(i), d.len);
+                    return true;
+                });
+                dropped += !queuedOk;
+            }
+            clientTx_.clear();
+            pipeline_->sendPark.wake();
+            if (dropped > 0)
+                std::println(YELLOW "[WARN] Send stage full , dropped {} of {} answers" RESET, dropped, queued);
+            return DNS::Error::OK;
+        }
+        if (ringTx_) {
+            queueOnRing(clientTx_, socket_);
+            return DNS::Error::OK;
+        }
+        if (clientTx_.send(socket_) < 0) {
+            std::println(YELLOW "[WARN] Client send failed for {} answers , error {}" RESET,
+                queued, Platform::lastError());
+            return DNS::Error::SERVER_SEND_FAIL;
+        }
+        return DNS::Error::OK;
+    }
+
+    bool Listener::sendStream(uint32_t tcp, uint32_t stream, const uint8_t *msg, size_t len) noexcept {
+        if (DohConnections::owns(tcp)) {
+            DohConnection *conn = dohClients_.find(tcp);
+            return conn && dohClients_.respond(*conn, stream, msg, len);
+        }
+        TcpConnection *conn = tcpClients_.find(tcp);
+        return conn && tcpClients_.send(*conn, msg, len);
+    }
+
+    void Listener::releaseTcp(uint32_t tcp) noexcept {
+        if (DohConnections::owns(tcp)) {
+            if (DohConnection *conn = dohClients_.find(tcp); conn && conn->pending > 0)
+                --conn->pending;
+        } else if (TcpConnection *conn = tcpClients_.find(tcp); conn && conn->pending > 0) {
+            --conn->pending;
+        }
+    }
+
+    Platform::socket_t Listener::listenStream(const sockaddr_storage &addr) const noexcept {
+        Platform::socket_t s = ::socket(addr.ss_family, SOCK_STREAM, IPPROTO_TCP);
+        const bool ok = s != Platform::INVALID_SOCK &&
+            (addr.ss_family != AF_INET6 || Platform::setDualStack(s)) &&
+            Platform::setReuseAddr(s) &&
+            (cfg_.workers <= 1 || Platform::setReusePort(s)) &&
+            bind(s, reinterpret_cast<const sockaddr *>(&addr), Platform::addressLength(addr)) != Platform::SOCK_ERR &&
+            listen(s, SOMAXCONN) != Platform::SOCK_ERR &&
+            Platform::setNonBlocking(s);
+        if (!ok)
+            Platform::closeSocket(s);
+        return s;
+    }
+
+    void Listener::handleTcp(Platform::socket_t s) noexcept {
+        if (s == tcp_) {
+            tcpClients_.accept(tcp_);
+            return;
+        }
+        if (s == doh_) {
+            dohClients_.accept(doh_);
+            return;
+        }
+        if (dohClients_.read(s, [this](DohConnection &conn, uint32_t stream, uint8_t *msg, size_t len) {
+                handleDohQuery(conn, stream, msg, len);
+            }))
+            return;
+        const bool client = tcpClients_.read(s, [this](TcpConnection &conn, uint8_t *msg, size_t len) {
+            handleTcpQuery(conn, msg, len);
+        });
+        if (client) {
+            tcpClients_.flush(s);
+            return;
+        }
+
+        // A resolver connection: finish its connect or write its backlog first, so answers
+        // are read from a connected socket.
+        auto onAnswer = [this](uint8_t upstream, uint8_t *msg, size_t len) {
+            handleStreamAnswer(upstream, msg, len);
+        };
+        if (dohUpstreams_.flush(s))
+            dohUpstreams_.read(s, onAnswer);
+        else if (tcpUpstreams_.flush(s))
+            tcpUpstreams_.read(s, onAnswer);
+        else
+            return;
+        resendOrphans();
+    }
+
+    void Listener::handleStreamAnswer(uint8_t upstream, uint8_t *msg, size_t len) noexcept {
+        sockaddr_storage client{};
+        if (!matchReply(msg, len, upstreams_[upstream].addr, client, true))
+            return;
+
+        std::println(GREEN "[FORWARD] Response received from upstream {} over {} ({} bytes) , relayed to {}" RESET,
+            upstreams_[upstream].name, streamTransport(), len, Platform::formatAddress(client));
+    }
+
+    bool Listener::streamQuery(uint16_t upstreamId) noexcept {
+        const InflightTable::Entry *e = inflight_.find(upstreamId);
+        if (!e)
+            return false;
+        const auto query = inflight_.query(upstreamId);
+        const Upstream &u = upstreams_[e->upstream];
+        const bool sent = cfg_.upstreamDoh
+            ? dohUpstreams_.send(e->upstream, u.addr, upstreamId, query.data(), query.size())
+            : tcpUpstreams_.send(e->upstream, u.addr, upstreamId, query.data(), query.size());
+        if (sent)
+            return true;
+        std::println(YELLOW "[WARN] {} connection to upstream {} failed , error {}" RESET,
+            streamTransport(), u.name, Platform::lastError());
+        return false;
+    }
+
+    void Listener::resendOrphans() noexcept {
+        orphans_.clear();
+        tcpUpstreams_.takeOrphans(orphans_);
+        dohUpstreams_.takeOrphans(orphans_);
+        for (const auto &[upstream, upstreamId] : orphans_) {
+            // Answered over UDP, expired, or its ID reused by another query since.
+            const InflightTable::Entry *e = inflight_.find(upstreamId);
+            if (!e || e->upstream != upstream)
+                continue;
+            streamQuery(upstreamId);
+        }
+    }
+
+    void Listener::handleTcpQuery(TcpConnection &conn, uint8_t *msg, size_t len) noexcept {
+        if (len < 13)
+            return;
+        // The query travels upstream over UDP, so it has to fit a datagram.
+        if (len > DNS::Limits::MAX_EDNS_PAYLOAD) {
+            std::println(YELLOW "[WARN] TCP query from {} too large ({} bytes) , dropping" RESET,
+                Platform::formatAddress(conn.peer), len);
+            return;
+        }
+
+        resolve(msg, len, conn.peer, conn.token);
+    }
+
+    void Listener::handleDohQuery(DohConnection &conn, uint32_t stream, uint8_t *msg, size_t len) noexcept {
+        // Also what goes upstream over UDP, so it has to fit a datagram.
+        if (len < 13 || len > DNS::Limits::MAX_EDNS_PAYLOAD) {
+            dohClients_.reject(conn, stream, len < 13 ? 400 : 413);
+            return;
+        }
+
+        resolve(msg, len, conn.peer, conn.token, stream);
+    }
+
+    void Listener::sweepTcp() noexcept {
+        if (tcpClients_.size() == 0 && dohClients_.size() == 0 && tcpUpstreams_.size() == 0 &&
+            dohUpstreams_.size() == 0)
+            return;
+        const auto now = std::chrono::steady_clock::now();
+        if (now < nextTcpSweep_)
+            return;
+        nextTcpSweep_ = now + std::chrono::seconds(1);
+        tcpClients_.closeIdle(now);
+        dohClients_.closeIdle(now);
+        tcpUpstreams_.closeIdle(now);
+        dohUpstreams_.closeIdle(now);
+    }
+
+    void Listener::logStats() noexcept {
+        if (cfg_.statsInterval_s == 0)
+            return;
+        const auto now = std::chrono::steady_clock::now();
+        if (now < nextStats_)
+            return;
+        nextStats_ = now + std::chrono::seconds(cfg_.statsInterval_s);
+
+        for (size_t i = 0; i < upstreams_.size(); ++i) {
+            const Upstream &u = upstreams_[static_cast<uint8_t>(i)];
+            std::println(GREEN "[STATS] Upstream {} , sent {} , answered {} , timed out {} , hedged {} ({} won) ,"
+                " retransmits {} , truncated {} , srtt {:.1f} ms , p95 {:.1f} ms , rto {} ms , loss {:.0f}% ,"
+                " circuit {} (opened {} , probes {})" RESET,
+                u.name, u.sent, u.answered, u.timedOut, u.hedged, u.hedgeWins, u.retransmits, u.truncated, u.srttMs,
+                u.p95Ms, std::chrono::duration_cast<std::chrono::milliseconds>(upstreams_.rto(static_cast<uint8_t>(i))).count(),
+                u.loss * 100.0, u.open ? "open" : "closed", u.opened, u.probes);
+            if (tls_.enabled()) {
+                const TlsClient::Peer &p = tls_.peer(static_cast<uint8_t>(i));
+                std::println(GREEN "[STATS] Upstream {} , TLS handshakes {} ({} resumed , {} failed)" RESET,
+                    u.name, p.handshakes, p.resumed, p.failed);
             }
         }
+        if (uint32_t drops = 0; prefiltered_ && Platform::receiveDrops(socket_, drops))
+            std::println(GREEN "[STATS] Listener {}:{} , dropped in kernel {} (prefilter or full receive queue)" RESET,
+                cfg_.serverIp, cfg_.portServerIp, drops);
+        if (pipeline_) {
+            Pipeline &p = *pipeline_;
+            std::println(GREEN "[STATS] Pipeline , receive->classify {} (peak {} , full {}) ,"
+                " classify->upstream {} (peak {} , full {}) , ->send {} (peak {} , full {}) , of {} slots each" RESET,
+                p.toClassify.size(), p.toClassify.peak(true), p.toClassify.full(),
+                p.toUpstream.size(), p.toUpstream.peak(true), p.toUpstream.full(),
+                p.toSend.size(), p.toSend.peak(true), p.toSend.full(), Pipeline::RING_SLOTS);
+        }
+        if (cfg_.busyPoll_us > 0)
+            std::println(GREEN "[STATS] Busy poll , {} us budget , found work spinning {} , slept {}" RESET,
+                cfg_.busyPoll_us, spinHits_.exchange(0, std::memory_order_relaxed),
+                spinMisses_.exchange(0, std::memory_order_relaxed));
+        // Shared by every worker; only the one that started it reports it.
+        if (ownsClassifyPool_) {
+            const auto s = classifyPool_->stats(true);
+            std::println(GREEN "[STATS] Classify pool , {} threads , ran {} , stolen {} , queued {}" RESET,
+                classifyPool_->size(), s.ran, s.stolen, s.queued);
+        }
     }
 
 
     DNS::Error Listener::handleQuery() noexcept {
-        DNS::Parser::MessageParser parser;
-        uint8_t buf[DNS::Limits::MAX_EDNS_PAYLOAD]{};
-        sockaddr_in client{};
-        int clientLen = sizeof(client);
+        // Borrowed, not zeroed: recvfrom() writes every byte that is read afterwards.
+        const PacketPool::Buffer packet = packets_.acquire();
+        if (!packet)
+            return DNS::Error::SERVER_WOULD_BLOCK;
+        uint8_t *buf = packet.data();
+        sockaddr_storage client{};
+        Platform::socklen_t clientLen = sizeof(client);
 
         // 1. Receive
-        // Block until a UDP datagram arrives on the bound socket.
+        // Pull one queued UDP datagram off the non-blocking socket.
         // recvfrom fills `client` with the sender's address so we can reply later.
-        const int received = recvfrom(
-            socket_, reinterpret_cast<char *>(buf), sizeof(buf), 0,
-            reinterpret_cast<sockaddr *>(&client), &clientLen);
+        const int received = static_cast<int>(recvfrom(
+            socket_, reinterpret_cast<char *>(buf), static_cast<int>(packet.size()), 0,
+            reinterpret_cast<sockaddr *>(&client), &clientLen));
 
-        if (received == SOCKET_ERROR)
+        if (received == Platform::SOCK_ERR) {
+            const int err = Platform::lastError();
+            if (Platform::isWouldBlock(err) || Platform::isInterrupted(err))
+                return DNS::Error::SERVER_WOULD_BLOCK;
+            // ICMP port-unreachable from an earlier reply to a client that already left.
+            if (Platform::isConnReset(err))
+                return DNS::Error::OK;
             return DNS::Error::SERVER_RECV_FAIL;
+        }
 
         // A valid DNS message requires at least a 12-byte header plus 1 byte of question data.
         if (received < 13)
             return DNS::Error::PARSE_TOO_SHORT;
 
+        // 2-7. Answered or forwarded by the query's coroutine, which suspends until the
+        // upstream answer comes; a blocked name's answer is already queued when it returns.
+        resolve(buf, static_cast<size_t>(received), client);
+        return flushClientTx();
+    }
+
+    Task Listener::resolve(uint8_t *data, size_t len, sockaddr_storage client, uint32_t tcp,
+                           uint32_t stream, bool classified) noexcept {
+        const char *transport = tcp == 0 ? "UDP" : DohConnections::owns(tcp) ? "DoH" : "TCP";
+        // An HTTP client waits for every request it sent; unlike a DNS client it never
+        // retries on its own, so a request that gets no answer gets a status instead.
+        auto reject = [&](int status) {
+            if (DohConnections::owns(tcp))
+                if (DohConnection *conn = dohClients_.find(tcp))
+                    dohClients_.reject(*conn, stream, status);
+        };
+
+        // The receive buffer is reused as soon as this suspends, which it does on the way
+        // to the classify pool: take the query along.
+        std::vector<uint8_t> query;
+        if (!classified && !classifier_.inlined()) {
+            query.assign(data, data + len);
+            data = query.data();
+        }
+
+        // 2-5. Parse, check the blocklist, and build the null answer if blocked, where
+        // classifier_ runs it, then carry on back home (both inline without a pool).
+        if (!classified) {
+            std::vector<uint8_t> answer;
+            offloaded_ += !classifier_.inlined();
+            const auto verdict = co_await (Exec::schedule(classifier_)
+                | Exec::then([&] { return classify(data, len, client, answer).value_or(Verdict::DROP); })
+                | Exec::continues_on(home_));
+            offloaded_ -= !classifier_.inlined();
+            if (!verdict || *verdict == Verdict::DROP) {
+                reject(400);
+                co_return;
+            }
+
+            // 6. Send the blocked response
+            if (*verdict == Verdict::ANSWER) {
+                if (!respond(client, tcp, stream, answer.data(), answer.size()) && tcp != 0)
+                    std::println(YELLOW "[WARN] {} client {} gone or not reading , closed" RESET,
+                        transport, Platform::formatAddress(client));
+                co_return;
+            }
+        }
+
+        // 7. Forward
+        // Domain is not blocked , queue the query for the upstream resolver and wait for
+        // its answer without holding up anyone else: serve() sends it on the slow path.
+        const auto upstreamId = forward(data, len, client, tcp, stream);
+        if (!upstreamId) {
+            // No resolver to ask: answer now instead of leaving the client to time out.
+            if (upstreamId.error() == DNS::Error::UPSTREAM_CIRCUIT_OPEN && failFast(data, len, client, tcp, stream))
+                co_return;
+            std::println(YELLOW "[WARN] Forward failed for {} ({}): {}" RESET,
+                Platform::formatAddress(client), transport, DNS::errorToString(upstreamId.error()));
+            reject(502);
+            co_return;
+        }
+
+        Pending<InflightTable::Outcome> outcome;
+        inflight_.find(*upstreamId)->waiter = &outcome;
+        const InflightTable::Outcome result = co_await outcome;
+
+        // 8. Relay
+        // The answer (or the query, for a SERVFAIL) is only valid until the next co_await.
+        releaseTcp(tcp);
+        switch (result.kind) {
+            case InflightTable::Outcome::Kind::ANSWERED:
+                respond(client, tcp, stream, result.msg.data(), result.msg.size());
+                break;
+            case InflightTable::Outcome::Kind::TIMED_OUT:
+                // A UDP client simply asks again; a TCP or DoH client waits on its
+                // connection, so it gets an explicit SERVFAIL.
+                if (tcp != 0)
+                    failFast(result.msg.data(), result.msg.size(), client, tcp, stream);
+                break;
+            case InflightTable::Outcome::Kind::FAILED:
+                failFast(result.msg.data(), result.msg.size(), client, tcp, stream);
+                break;
+        }
+    }
+
+    bool Listener::respond(const sockaddr_storage &client, uint32_t tcp, uint32_t stream, const uint8_t *msg,
+                           size_t len) noexcept {
+        if (tcp != 0)
+            return sendStream(tcp, stream, msg, len);
+        if (clientTx_.size() == clientTx_.capacity())
+            flushClientTx();
+        return clientTx_.push(msg, len, client);
+    }
+
+    std::expected<Listener::Verdict, DNS::Error>
+    Listener::classify(const uint8_t *data, size_t len, const sockaddr_storage &client,
+                       std::vector<uint8_t> &answer) noexcept {
+        // A response (QR set) is never a question for us: forwarding it could loop it
+        // between two resolvers. The prefilter drops these in the kernel already.
+        if (len > 2 && (data[2] & 0x80))
+            return Verdict::DROP;
+
         // 2. Parse
         // Decode the raw bytes into a structured Message (header + questions + resource records).
         // Malformed packets are rejected here , we never forward garbage upstream.
-        std::expected<DNS::Parser::Message, DNS::Error> result = parser.parse(buf, received);
+        std::expected<DNS::Parser::Message, DNS::Error> result = DNS::Parser::MessageParser::parse(data, len);
         if (!result.has_value())
-            return result.error();
+            return std::unexpected(result.error());
 
         // 3. Inspect questions
         // RFC 1035 permits multiple questions per message, but real resolvers always send one.
         // We iterate anyway for correctness; the first blocked name short-circuits the loop.
         for (const auto& q : result.value().getQuestions()) {
             std::println(GREEN "[QUERY] {} asked for: {} (type {})" RESET,
-                inet_ntoa(client.sin_addr), q.getName(), static_cast<uint16_t>(q.getType()));
+                Platform::formatAddress(client), q.getName(), static_cast<uint16_t>(q.getType()));
 
             // 4. Blocklist check
             // search() walks up the label hierarchy, so blocking "ads.example.com"
@@ -193,105 +1032,313 @@ namespace DNS::Server {
                     result.value().getHeader().setAnswers(1);
                 }
 
-                // 6. Encode & send the blocked response
+                // 6. Encode the blocked response
                 auto encoded = DNS::Parser::MessageParser::encode(result.value());
                 if (!encoded) {
                     std::println(YELLOW "[WARN] Failed to encode blocked response for '{}': {}" RESET,
                         q.getName(), DNS::errorToString(encoded.error()));
-                    return encoded.error();
+                    return std::unexpected(encoded.error());
                 }
 
                 // Sanity check: the encoded size must fit within a single UDP datagram.
                 // This should never trigger for our small synthetic records, but we guard
-                // defensively before passing raw sizes to the Winsock API.
+                // defensively before passing raw sizes to the socket API.
                 if (encoded->size() > DNS::Limits::MAX_EDNS_PAYLOAD) {
                     std::println(YELLOW "[WARN] Blocked response for '{}' exceeds max payload ({} bytes) , dropping" RESET,
                         q.getName(), encoded->size());
-                    return DNS::Error::SERVER_SEND_FAIL;
+                    return std::unexpected(DNS::Error::SERVER_SEND_FAIL);
                 }
 
-                const int sent = sendto(
-                    socket_,
-                    reinterpret_cast<const char*>(encoded->data()),
-                    encoded->size(),
-                    0,
-                    reinterpret_cast<const sockaddr*>(&client),
-                    sizeof(client));
+                std::println(RED "[BLOCKED] {} , null response for {} ({} bytes)" RESET,
+                    q.getName(), Platform::formatAddress(client), encoded->size());
+                answer = std::move(*encoded);
+                return Verdict::ANSWER;
+            }
+        }
 
-                if (sent == SOCKET_ERROR) {
+        // Nothing blocked , forward as long as there was something to ask.
+        return result.value().getQuestions().empty() ? Verdict::DROP : Verdict::FORWARD;
+    }
 
-                    std::println(YELLOW "[WARN] sendto failed for blocked '{}' , WSA error {}" RESET,
-                        q.getName(), WSAGetLastError());
-                    return DNS::Error::SERVER_SEND_FAIL;
-                }
+    DNS::Error Listener::handleBatch() noexcept {
+        // 1. Receive
+        // One recvmmsg() drains up to cfg_.batchSize datagrams from the listener socket.
+        const int received = rx_.recv(socket_);
+        if (received < 0)
+            return DNS::Error::SERVER_RECV_FAIL;
+        if (received == 0)
+            return DNS::Error::SERVER_WOULD_BLOCK;
 
-                if (sent !=encoded->size()) {
-                    // UDP sendto is atomic , the entire datagram is sent or the call fails.
-                    // A partial send is theoretically impossible, but we log it as a sanity check.
-                    std::println(YELLOW "[WARN] Partial send for blocked '{}': {} of {} bytes sent" RESET,
-                        q.getName(), sent, encoded->size());
-                    return DNS::Error::SERVER_SEND_FAIL;
-                }
+        // 2. Resolve
+        // One coroutine per query: blocked names are answered straight into clientTx_;
+        // everything else is queued for the slow path under a fresh upstream ID and waits.
+        for (size_t i = 0; i < rx_.size(); ++i)
+            if (rx_.length(i) >= 13)
+                resolve(rx_.data(i), rx_.length(i), rx_.addr(i));
+
+        // 3. Reply
+        // Blocked answers go back to clients in one sendmmsg(). Upstream-bound queries
+        // stay in upstreamTx_ until serve() reaches the slow path.
+        return flushClientTx();
+    }
 
-                std::println(RED "[BLOCKED] {} , null response sent to {} ({} bytes)" RESET,
-                    q.getName(), inet_ntoa(client.sin_addr), sent);
-                return Error::OK;
+    DNS::Error Listener::handleUpstream() noexcept {
+        sockaddr_storage client{};
+
+        if (cfg_.batchSize > 1) {
+            // One recvmmsg() for every queued response, one sendmmsg() to relay the matches.
+            const int received = upstreamRx_.recv(upstream_);
+            if (received < 0) {
+                // ICMP port-unreachable from the resolver; the error is consumed, carry on.
+                if (Platform::isConnReset(Platform::lastError()))
+                    return DNS::Error::OK;
+                return DNS::Error::SERVER_RECV_FAIL;
             }
+            if (received == 0)
+                return DNS::Error::SERVER_WOULD_BLOCK;
 
-            // 7. Forward
-            // Domain is not blocked , relay the original raw datagram to the upstream
-            // resolver and pipe the response straight back to the client.
-            if (auto err = forward(buf, received, client); err != Error::OK) {
-                std::println(YELLOW "[WARN] Forward failed for '{}': {}" RESET,
-                    q.getName(), DNS::errorToString(err));
+            // Each match resumes its query's coroutine, which queues the answer in clientTx_.
+            for (size_t i = 0; i < upstreamRx_.size(); ++i) {
+                size_t len = upstreamRx_.length(i);
+                matchReply(upstreamRx_.data(i), len, upstreamRx_.addr(i), client);
             }
+            return flushClientTx();
         }
 
-        return Error::OK;
+        const PacketPool::Buffer packet = packets_.acquire();
+        if (!packet)
+            return DNS::Error::SERVER_WOULD_BLOCK;
+        uint8_t *response = packet.data();
+        sockaddr_storage from{};
+        Platform::socklen_t fromLen = sizeof(from);
+
+        const int respLen = static_cast<int>(recvfrom(upstream_, reinterpret_cast<char *>(response),
+                                static_cast<int>(packet.size()), 0,
+                                reinterpret_cast<sockaddr *>(&from), &fromLen));
+        if (respLen == Platform::SOCK_ERR) {
+            const int err = Platform::lastError();
+            if (Platform::isWouldBlock(err) || Platform::isInterrupted(err))
+                return DNS::Error::SERVER_WOULD_BLOCK;
+            if (Platform::isConnReset(err))
+                return DNS::Error::OK;
+            return DNS::Error::SERVER_RECV_FAIL;
+        }
+
+        size_t len = static_cast<size_t>(respLen);
+        if (!matchReply(response, len, from, client))
+            return DNS::Error::OK;
+
+        std::println(GREEN "[FORWARD] Response received from upstream {} ({} bytes) , relayed to {}" RESET,
+            Platform::formatAddress(from), respLen, Platform::formatAddress(client));
+        return flushClientTx();
     }
 
+    bool Listener::matchReply(uint8_t *reply, size_t &len, const sockaddr_storage &from, sockaddr_storage &client,
+                              bool stream) noexcept {
+        if (len < 12)
+            return false;
 
-    DNS::Error Listener::forward(const uint8_t *data, const size_t len, const sockaddr_in &client) noexcept {
-        if (upstream_ == INVALID_SOCKET)
-            return DNS::Error::UPSTREAM_UNREACHABLE;
+        const uint16_t upstreamId = static_cast<uint16_t>((reply[0] << 8) | reply[1]);
+        const InflightTable::Entry *pending = inflight_.find(upstreamId);
+        if (!pending)
+            return false; // late (already timed out) or duplicate reply
 
-        const int sent = sendto(upstream_, reinterpret_cast<const char *>(data),
-                                len, 0,
-                                reinterpret_cast<const sockaddr *>(&upstreamAddr_),
-                                sizeof(upstreamAddr_));
-        if (sent == SOCKET_ERROR)
-            return DNS::Error::UPSTREAM_UNREACHABLE;
+        // Only the resolver we asked may answer; anything else is stray or spoofed.
+        const sockaddr_storage &asked = upstreams_[pending->upstream].addr;
+        if (!Platform::sameAddress(from, asked))
+            return false;
+
+        const auto now = std::chrono::steady_clock::now();
 
-        std::println(GREEN "[FORWARD] Query sent to upstream {}" RESET, inet_ntoa(upstreamAddr_.sin_addr));
+        // Truncated (TC): the full answer is only available over TCP. Ask the same resolver
+        // again there under the same ID; the query stays in flight until that answer comes.
+        // A client whose buffer is no larger than what we advertised could not take more.
+        if ((reply[2] & 0x02) && !stream && !pending->probe && pending->udpSize > cfg_.ednsPayload) {
+            InflightTable::Entry *primary = inflight_.find(pending->primary);
+            // Another attempt of this query was truncated already and is on its way over TCP.
+            if (primary && primary->overTcp)
+                return false;
+            if (primary && streamQuery(upstreamId)) {
+                InflightTable::Entry *attempt = inflight_.find(upstreamId);
+                const Upstream &u = upstreams_[attempt->upstream];
+                if (upstreams_.onAnswer(attempt->upstream, now - attempt->sent))
+                    std::println(GREEN "[INFO] Upstream {} answered again , circuit closed" RESET, u.name);
+                ++upstreams_[attempt->upstream].truncated;
+                attempt->truncated = true;
+                attempt->charged   = true;
+                primary->overTcp   = true;
+                // The connection may still have to be set up: allow one extra RTO for the handshake.
+                inflight_.scheduleRetry(pending->primary,
+                    now + upstreams_.rto(attempt->upstream, static_cast<uint8_t>(primary->retransmits + 1)), false);
+                std::println(GREEN "[TCP] Truncated answer from {} ({} bytes) , asking again over TCP" RESET, u.name, len);
+                return false;
+            }
+            // No TCP to the resolver: relay the truncated answer, the client retries itself.
+        }
 
-        uint8_t response[DNS::Limits::MAX_EDNS_PAYLOAD]{};
-        sockaddr_in from{};
-        int fromLen = sizeof(from);
+        const auto entry = inflight_.take(upstreamId);
+        // A truncated attempt fed its RTT sample when the UDP answer came; the TCP one
+        // includes the handshake and would skew the estimate.
+        if (!entry->truncated && upstreams_.onAnswer(entry->upstream, now - entry->sent))
+            std::println(GREEN "[INFO] Upstream {} answered again , circuit closed" RESET, upstreams_[entry->upstream].name);
 
-        const int respLen = recvfrom(upstream_, reinterpret_cast<char *>(response),
-                                    sizeof(response), 0,
-                                    reinterpret_cast<sockaddr *>(&from), &fromLen);
+        // A probe has no client; it only told us the resolver is back.
+        if (entry->probe) {
+            upstreams_[entry->upstream].probing = false;
+            return false;
+        }
 
-        if (respLen == SOCKET_ERROR) {
-            const int err = WSAGetLastError();
-            if (err == WSAETIMEDOUT)
-                std::println(YELLOW "[WARN] Upstream {} timed out" RESET, inet_ntoa(upstreamAddr_.sin_addr));
-            else
-                std::println(YELLOW "[WARN] Upstream {} unreachable , WSA error {}" RESET, inet_ntoa(upstreamAddr_.sin_addr), err);
+        // take() released every other attempt of this query; their answers, if any, are dropped.
+        if (entry->hedge)
+            ++upstreams_[entry->upstream].hedgeWins;
+
+        reply[0] = static_cast<uint8_t>(entry->id >> 8);
+        reply[1] = static_cast<uint8_t>(entry->id & 0xFF);
 
-            return (err == WSAETIMEDOUT) ? DNS::Error::UPSTREAM_TIMEOUT
-                                        : DNS::Error::UPSTREAM_UNREACHABLE;
+        // Cut down to what a UDP client advertised; it comes back over TCP for the rest.
+        if (entry->tcp == 0 && (len = Edns::truncate(reply, len, entry->udpSize, cfg_.ednsPayload)) == 0)
+            return false;
+
+        // The query's coroutine relays it: a TCP or DoH client gets it on its connection
+        // right away, whatever order its queries were asked in.
+        client = entry->client;
+        if (entry->waiter)
+            entry->waiter->resume({ InflightTable::Outcome::Kind::ANSWERED, { reply, len } });
+        return true;
+    }
+
+    void Listener::expireInflight() noexcept {
+        if (inflight_.empty())
+            return;
+        const auto now = std::chrono::steady_clock::now();
+        inflight_.expire(now, [&](const InflightTable::Entry &e) {
+            if (e.probe) {
+                upstreams_.onProbeTimeout(e.upstream, now);
+                return;
+            }
+            // All attempts of a query share one deadline; report the client's timeout once.
+            // Only the primary has attempts set.
+            if (e.attempts > 0) {
+                std::println(YELLOW "[WARN] Upstream {} timed out for {}" RESET,
+                    upstreams_[e.upstream].name, Platform::formatAddress(e.client));
+                if (e.waiter)
+                    e.waiter->resume({ InflightTable::Outcome::Kind::TIMED_OUT, inflight_.query(e.primary) });
+            }
+            if (!e.charged)
+                chargeTimeout(e.upstream, now);
+        });
+    }
+
+    void Listener::abandonInflight() noexcept {
+        // Queries on the classify pool post back to loop_; take them in (they forward, and
+        // are released below with the rest) before the worker goes away under them.
+        while (offloaded_ > 0)
+            if (Platform::waitReadable(loop_.fd(), STOP_POLL_MS) > 0)
+                loop_.drain();
+
+        inflight_.expire(InflightTable::clock::time_point::max(), [](const InflightTable::Entry &e) {
+            if (e.attempts > 0 && e.waiter)
+                e.waiter->cancel();
+        });
+    }
+
+    std::expected<uint8_t, DNS::Error>
+    Listener::beginForward(uint8_t *data, size_t len, const sockaddr_storage &client, uint32_t tcp,
+                           uint32_t stream) noexcept {
+        const auto now = std::chrono::steady_clock::now();
+
+        // Park the client and its ID; the query travels under a fresh upstream ID so
+        // two clients that happen to pick the same ID cannot receive each other's answer.
+        InflightTable::Entry entry;
+        entry.client   = client;
+        entry.id       = static_cast<uint16_t>((data[0] << 8) | data[1]);
+        const auto upstream = upstreams_.pick();
+        if (!upstream)
+            return std::unexpected(DNS::Error::UPSTREAM_CIRCUIT_OPEN);
+        entry.upstream = *upstream;
+        entry.sent     = now;
+        entry.deadline = now + std::chrono::milliseconds(cfg_.timeout_ms);
+        entry.tcp      = tcp;
+        entry.stream   = stream;
+        // Stream clients take any size; a UDP client takes what its OPT record says.
+        entry.udpSize  = tcp != 0 ? UINT16_MAX : Edns::payloadSize(data, len);
+
+        // First retry: a hedge once the resolver is slower than its own p95 (if there is
+        // another one to ask), otherwise a retransmit once its RTO has passed.
+        entry.retryAt = now + upstreams_.rto(entry.upstream);
+        if (cfg_.hedging && upstreams_.size() > 1)
+            if (const auto delay = upstreams_.hedgeDelay(entry.upstream); delay && now + *delay < entry.retryAt) {
+                entry.retryAt   = now + *delay;
+                entry.hedgeNext = true;
+            }
+
+        // Retries are sent from the copy kept here, so clamp before it is taken.
+        Edns::clampPayload(data, len, cfg_.ednsPayload);
+        const auto upstreamId = inflight_.insert(entry, data, len);
+        if (!upstreamId)
+            return std::unexpected(upstreamId.error());
+
+        data[0] = static_cast<uint8_t>(*upstreamId >> 8);
+        data[1] = static_cast<uint8_t>(*upstreamId & 0xFF);
+        if (DohConnections::owns(tcp)) {
+            if (DohConnection *conn = dohClients_.find(tcp))
+                ++conn->pending;
+        } else if (TcpConnection *conn = tcpClients_.find(tcp)) {
+            ++conn->pending;
         }
+        return entry.upstream;
+    }
+
+    std::expected<uint16_t, DNS::Error>
+    Listener::forward(uint8_t *data, const size_t len, const sockaddr_storage &client, uint32_t tcp,
+                      uint32_t stream) noexcept {
+        if (upstream_ == Platform::INVALID_SOCK)
+            return std::unexpected(DNS::Error::UPSTREAM_UNREACHABLE);
+
+        const auto upstream = beginForward(data, len, client, tcp, stream);
+        if (!upstream)
+            return std::unexpected(upstream.error());
+        const auto upstreamId = static_cast<uint16_t>((data[0] << 8) | data[1]);
 
-        std::println(GREEN "[FORWARD] Response received from upstream {} ({} bytes) , relaying to {}" RESET,
-            inet_ntoa(upstreamAddr_.sin_addr), respLen, inet_ntoa(client.sin_addr));
+        if (streamOnly()) {
+            if (streamQuery(upstreamId))
+                return upstreamId;
+            inflight_.take(upstreamId);
+            releaseTcp(tcp);
+            return std::unexpected(DNS::Error::UPSTREAM_UNREACHABLE);
+        }
+
+        // The outbox is sized for one fast-path pass; if it still fills up, send early.
+        if (upstreamTx_.size() == upstreamTx_.capacity())
+            flushUpstream();
+        if (!upstreamTx_.push(data, len, upstreams_[*upstream].addr)) {
+            inflight_.take(upstreamId);
+            releaseTcp(tcp);
+            return std::unexpected(DNS::Error::UPSTREAM_UNREACHABLE);
+        }
+        return upstreamId;
+    }
 
-        const int fwd = sendto(socket_, reinterpret_cast<const char *>(response), respLen, 0,
-                    reinterpret_cast<const sockaddr *>(&client), sizeof(client));
-        if (WSAGetLastError() == WSAECONNRESET)
+    DNS::Error Listener::flushUpstream() noexcept {
+        const size_t queued = upstreamTx_.size();
+        if (queued == 0)
+            return DNS::Error::OK;
+        if (ringTx_) {
+            queueOnRing(upstreamTx_, upstream_);
             return DNS::Error::OK;
+        }
 
-        return (fwd == SOCKET_ERROR) ? DNS::Error::SERVER_SEND_FAIL : DNS::Error::OK;
+        // One sendmmsg() (sendto loop elsewhere) for every query of this pass,
+        // whichever resolvers they are addressed to.
+        if (upstreamTx_.send(upstream_) < 0) {
+            // The entries stay in flight and are reported once they time out.
+            std::println(YELLOW "[WARN] Upstream send failed for {} queries , error {}" RESET,
+                queued, Platform::lastError());
+            return DNS::Error::UPSTREAM_UNREACHABLE;
+        }
+
+        std::println(GREEN "[FORWARD] {} quer{} sent upstream" RESET, queued, queued == 1 ? "y" : "ies");
+        return DNS::Error::OK;
     }
 
     void Listener::stripPathAndQuery(std::string &str) noexcept {
@@ -315,7 +1362,7 @@ namespace DNS::Server {
                        [](unsigned char c){ return std::tolower(c); });
 
         while (true) {
-            if (blocklist_.contains(current))
+            if (blocklist_->contains(current))
                 return true;
             size_t dot = current.find('.');
             if (dot == std::string::npos)
@@ -0,0 +1,165 @@
+#include "../../include/server/server.hpp"
+
+#include <print>
+#include <algorithm>
+#include <cstring>
+#include <thread>
+
+// Staged pipeline for Listener (Config::pipeline).
+//
+// Instead of every worker running the whole of a query, each stage of it gets a thread
+// and a core of its own, so its code and data stay in that core's caches:
+//   - receive:  recvmmsg() batches off socket_ into toClassify;
+//   - classify: parse and blocklist check; blocked answers go to toSend, everything
+//               else to toUpstream, ringing the event loop's doorbell;
+//   - upstream: serve() without socket_: forwarding, retries, TCP and DoH clients, and
+//               the resolve() coroutines, whose answers flushClientTx() puts in toSend;
+//   - send:     sendmmsg() batches from toSend on socket_.
+// toClassify and toUpstream have one producer and one consumer each; toSend has two
+// producers. [STATS] shows how full each ring runs, which names the slowest stage.
+// In busy-poll mode the receive stage spins on socket_ before it sleeps, like a worker.
+
+namespace DNS::Server {
+
+    DNS::Error Listener::servePipelined() noexcept {
+        if (cfg_.workers > 1)
+            std::println(YELLOW "[WARN] Pipeline mode runs one set of stages , --workers ignored" RESET);
+        if (cfg_.engine == IoEngine::URING)
+            std::println(YELLOW "[WARN] Pipeline mode drives the resolvers with the poll engine , io_uring ignored" RESET);
+
+        pipeline_ = std::make_unique<Pipeline>();
+        if (!pipeline_->upstreamBell.open())
+            return DNS::Error::SERVER_SOCKET_FAIL;
+
+        const unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+        const unsigned first = cfg_.firstCore;
+        auto stage = [&](unsigned core, void (Listener::*body)(std::stop_token)) {
+            pipeline_->stages.emplace_back([this, core, cores, body](std::stop_token st) {
+                Platform::pinThisThread(core % cores);
+                (this->*body)(st);
+            });
+        };
+        stage(first + 1, &Listener::receiveStage);
+        stage(first + 2, &Listener::classifyStage);
+        stage(first + 3, &Listener::sendStage);
+
+        std::println(GREEN "[INFO] Pipeline running , receive / classify / upstream / send on cores {} / {} / {} / {}" RESET,
+            (first + 1) % cores, (first + 2) % cores, first % cores, (first + 3) % cores);
+        Platform::pinThisThread(first % cores);
+        const auto err = serve({});
+
+        pipeline_->stages.clear();
+        return err;
+    }
+
+    void Listener::receiveStage(std::stop_token stop) noexcept {
+        Pipeline &p = *pipeline_;
+        DatagramBatch rx;
+        rx.reset(cfg_.batchSize > 1 ? cfg_.batchSize : FAST_PATH_BUDGET);
+
+        while (!stop.stop_requested()) {
+            const int received = rx.recv(socket_);
+            if (received < 0) {
+                const int err = Platform::lastError();
+                if (!Platform::isWouldBlock(err) && !Platform::isConnReset(err) && !Platform::isInterrupted(err))
+                    std::println(YELLOW "[WARN] Receive stage failed , error {}" RESET, err);
+            }
+            if (received <= 0) {
+                // Busy-poll mode spins first; the sleep is bounded, so a stop request is noticed.
+                if (!busyPoll([&] { return Platform::waitReadable(socket_, 0) != 0; }))
+                    Platform::waitReadable(socket_, STOP_POLL_MS);
+                continue;
+            }
+
+            for (int i = 0; i < received; ++i) {
+                // Same minimum as handleQuery(): a header and at least one byte of question.
+                if (rx.length(i) < 13)
+                    continue;
+                // Full: wait for the classify stage rather than drop; meanwhile the kernel's
+                // receive queue holds whatever else arrives.
+                while (!p.toClassify.push([&](Datagram &d) {
+                           d.addr = rx.addr(i);
+                           d.len  = rx.length(i);
+                           std::memcpy(d.data, rx.data(i), d.len);
+                           return true;
+                       })) {
+                    if (stop.stop_requested())
+                        return;
+                    p.classifyPark.wake();
+                    std::this_thread::yield();
+                }
+            }
+            p.classifyPark.wake();
+        }
+    }
+
+    void Listener::classifyStage(std::stop_token stop) noexcept {
+        Pipeline &p = *pipeline_;
+        std::stop_callback wakeOnStop(stop, [&p] { p.classifyPark.wakeAll(); });
+        std::vector<uint8_t> answer;
+
+        // Hands one datagram to the next stage, waiting while its ring is full.
+        auto handOn = [&](auto &ring, auto &&wake, const sockaddr_storage &to, const uint8_t *msg, size_t len) {
+            while (!ring.push([&](Datagram &d) {
+                       d.addr = to;
+                       d.len  = len;
+                       std::memcpy(d.data, msg, len);
+                       return true;
+                   })) {
+                if (stop.stop_requested())
+                    return;
+                wake();
+                std::this_thread::yield();
+            }
+            wake();
+        };
+
+        while (!stop.stop_requested()) {
+            p.classifyPark.wait(stop, [&p] { return !p.toClassify.empty(); });
+
+            while (p.toClassify.pop([&](Datagram &q) {
+                answer.clear();
+                switch (classify(q.data, q.len, q.addr, answer).value_or(Verdict::DROP)) {
+                    case Verdict::DROP:
+                        break;
+                    case Verdict::ANSWER:
+                        handOn(p.toSend, [&p] { p.sendPark.wake(); }, q.addr, answer.data(), answer.size());
+                        break;
+                    case Verdict::FORWARD:
+                        handOn(p.toUpstream, [&p] { p.upstreamBell.ring(); }, q.addr, q.data, q.len);
+                        break;
+                }
+            })) {}
+        }
+    }
+
+    void Listener::takeClassified() noexcept {
+        Pipeline &p = *pipeline_;
+        p.upstreamBell.answer();
+
+        // Bounded like the fast path, so the slow path keeps its turn under a flood.
+        for (uint32_t n = 0; n < FAST_PATH_BUDGET; ++n)
+            if (!p.toUpstream.pop([&](Datagram &q) { resolve(q.data, q.len, q.addr, 0, 0, true); }))
+                return;
+        if (!p.toUpstream.empty())
+            p.upstreamBell.ring();
+    }
+
+    void Listener::sendStage(std::stop_token stop) noexcept {
+        Pipeline &p = *pipeline_;
+        std::stop_callback wakeOnStop(stop, [&p] { p.sendPark.wakeAll(); });
+        DatagramBatch tx;
+        tx.reset(cfg_.batchSize > 1 ? cfg_.batchSize : FAST_PATH_BUDGET);
+
+        while (!stop.stop_requested()) {
+            p.sendPark.wait(stop, [&p] { return !p.toSend.empty(); });
+
+            while (tx.size() < tx.capacity() &&
+                   p.toSend.pop([&](Datagram &d) { tx.push(d.data, d.len, d.addr); })) {}
+            if (const size_t queued = tx.size(); queued > 0 && tx.send(socket_) < 0)
+                std::println(YELLOW "[WARN] Send stage failed for {} answers , error {}" RESET,
+                    queued, Platform::lastError());
+        }
+    }
+
+} // namespace DNS::Server
@@ -0,0 +1,277 @@
+#include "../../include/server/server.hpp"
+#include "../../include/server/uring.hpp"
+
+#include <print>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+
+// io_uring engine for Listener (Config::engine == IoEngine::URING).
+//
+// One ring per worker drives both sockets:
+//   - a multishot RECVMSG on socket_ and one on upstream_, each fed from its own
+//     provided-buffer ring, so receiving costs no syscall per datagram;
+//   - every outgoing datagram is copied into a slot of a registered tx arena and
+//     sent with SEND_ZC straight from that fixed buffer (plain SEND if unsupported);
+//     flushUpstream() and flushClientTx() queue their outboxes there too (ringTx_),
+//     so one that fills up mid-pass never falls back to a synchronous sendmmsg();
+//   - forwarding never waits: each upstream query is parked in inflight_ under a
+//     fresh ID and the reply is matched when it arrives, as in the poll loop;
+//   - queries classified on the pool come back through the RunLoop's wakeup handle, which
+//     a POLL_ADD on the ring watches, and are carried on like any other;
+//   - TCP clients and the TCP connections to the resolvers stay readiness-driven: they
+//     live in an epoll set of their own and a POLL_ADD on that epoll descriptor wakes
+//     the ring when any of them is ready.
+
+namespace DNS::Server {
+
+#ifdef DNS_HAVE_URING
+
+    namespace {
+        constexpr unsigned RING_ENTRIES   = 256;
+        constexpr uint16_t LISTEN_GROUP   = 0;
+        constexpr uint16_t UPSTREAM_GROUP = 1;
+        constexpr uint16_t RECV_BUFFERS   = 256;   // per group, power of two
+        constexpr uint32_t RECV_BUF_SIZE  = Uring::RECV_HEADROOM + DNS::Limits::MAX_EDNS_PAYLOAD;
+        constexpr size_t   TX_SLOTS       = 512;
+
+        // user_data = kind << 32 | slot
+        enum Tag : uint64_t { TAG_LISTEN = 1, TAG_UPSTREAM = 2, TAG_SEND = 3, TAG_TCP = 4, TAG_LOOP = 5 };
+        constexpr uint64_t tag(Tag kind, uint32_t slot = 0) { return (static_cast<uint64_t>(kind) << 32) | slot; }
+    }
+
+    /*
+     *  The registered tx arena of serveUring(): a slot is busy from sendTo() until its
+     *  completion (or its zero-copy notification), and remembers where it was going so
+     *  it can be resent. Outlives the ring it sends on (see serveUring()).
+     */
+    struct Listener::RingTx {
+        Uring                          *ring { nullptr };
+        PacketPool                      pool;
+        std::vector<sockaddr_storage>   addr;
+        std::vector<size_t>             len;
+        std::vector<Platform::socket_t> sock;
+        size_t                          dropped { 0 };   // found the arena full, this pass
+
+        explicit RingTx(size_t slots) : addr(slots), len(slots), sock(slots) { pool.reset(slots); }
+
+        // Copies a datagram into a free slot and queues the send.
+        // If the SQ is full, flush it once without waiting and try again.
+        bool send(Platform::socket_t s, const uint8_t *data, size_t n, const sockaddr_storage &to) noexcept {
+            uint32_t slot = 0;
+            if (n > PacketPool::SLOT_SIZE || !pool.take(slot))
+                return false;
+            uint8_t *buf = pool.data(slot);
+            std::memcpy(buf, data, n);
+            addr[slot] = to;
+            len[slot]  = n;
+            sock[slot] = s;
+            if (!ring->sendTo(s, buf, n, &addr[slot], tag(TAG_SEND, slot))) {
+                ring->submitAndWait(0);
+                if (!ring->sendTo(s, buf, n, &addr[slot], tag(TAG_SEND, slot))) {
+                    pool.put(slot);
+                    return false;
+                }
+            }
+            return true;
+        }
+    };
+
+    void Listener::queueOnRing(DatagramBatch &out, Platform::socket_t s) noexcept {
+        for (size_t i = 0; i < out.size(); ++i)
+            if (!ringTx_->send(s, out.data(i), out.length(i), out.addr(i)))
+                ++ringTx_->dropped;
+        out.clear();
+    }
+
+    DNS::Error Listener::serveUring(std::stop_token stop) noexcept {
+        // Outgoing datagrams live in one registered arena. Declared before the ring so it is
+        // freed only after the ring is torn down: a zero-copy send may still be reading it.
+        RingTx tx(TX_SLOTS);
+        Uring  ring;
+        if (!ring.init(RING_ENTRIES) ||
+            !ring.addBufferRing(LISTEN_GROUP,   RECV_BUFFERS, RECV_BUF_SIZE) ||
+            !ring.addBufferRing(UPSTREAM_GROUP, RECV_BUFFERS, RECV_BUF_SIZE))
+            return DNS::Error::SERVER_SOCKET_FAIL;
+
+        // Queries back from the classify pool wake the ring through loop_'s handle.
+        if (loop_.fd() != Platform::INVALID_SOCK && !ring.pollReadable(loop_.fd(), tag(TAG_LOOP)))
+            return DNS::Error::SERVER_SOCKET_FAIL;
+
+        tx.ring = &ring;
+        if (!ring.registerBuffers(tx.pool.data(0), tx.pool.bytes()))
+            std::println(YELLOW "[WARN] io_uring buffer registration failed , using copying sends" RESET);
+
+        if (!ring.recvMultishot(socket_,   LISTEN_GROUP,   tag(TAG_LISTEN)) ||
+            !ring.recvMultishot(upstream_, UPSTREAM_GROUP, tag(TAG_UPSTREAM)))
+            return DNS::Error::SERVER_SOCKET_FAIL;
+
+        // Resolver connections can be needed at any time (truncated answers), so the epoll
+        // set exists even without a TCP listener.
+        Platform::Poller tcpPoller;
+        if (tcpPoller.open() && ring.pollReadable(tcpPoller.fd(), tag(TAG_TCP))) {
+            tcpUpstreams_.attach(&tcpPoller);
+            dohUpstreams_.attach(&tcpPoller);
+            if (tcp_ != Platform::INVALID_SOCK && tcpPoller.add(tcp_))
+                tcpClients_.attach(&tcpPoller);
+            if (doh_ != Platform::INVALID_SOCK && tcpPoller.add(doh_))
+                dohClients_.attach(&tcpPoller);
+        }
+
+        // Queries, hedges and retransmits are assembled here by forward() and retryInflight(),
+        // as in the poll loop; answers to UDP clients by the coroutines.
+        upstreamTx_.reset(FAST_PATH_BUDGET);
+        clientTx_.reset(FAST_PATH_BUDGET);
+
+        // Each query runs as a resolve() coroutine, exactly as in the poll loop: answers land
+        // in clientTx_ and upstream-bound queries in upstreamTx_, both sent from the arena below.
+        auto onQuery = [&](uint8_t *payload, size_t len, const sockaddr_storage &client) {
+            if (len >= 13)
+                resolve(payload, len, client);
+        };
+
+        // A match resumes the query's coroutine, which queues the answer in clientTx_.
+        auto onReply = [&](uint8_t *payload, size_t len, const sockaddr_storage &from) {
+            sockaddr_storage client{};
+            matchReply(payload, len, from, client);
+        };
+
+        // Unpacks one multishot RECVMSG completion, hands the payload on, and recycles the buffer.
+        bool unsupported = false;
+        auto onRecv = [&](const Uring::Completion &c, uint16_t group, Platform::socket_t s, Tag kind) {
+            if (c.res >= 0 && (c.flags & IORING_CQE_F_BUFFER)) {
+                const auto bid = static_cast<uint16_t>(c.flags >> IORING_CQE_BUFFER_SHIFT);
+                uint8_t *buf = ring.buffer(group, bid);
+                const auto *out = reinterpret_cast<const io_uring_recvmsg_out *>(buf);
+                const auto *from = reinterpret_cast<const sockaddr_storage *>(buf + sizeof(io_uring_recvmsg_out));
+                uint8_t *payload = buf + sizeof(io_uring_recvmsg_out) + sizeof(sockaddr_storage) + out->controllen;
+                const size_t room = RECV_BUF_SIZE - static_cast<size_t>(payload - buf);
+
+                if (!(out->flags & MSG_TRUNC) && out->payloadlen <= room) {
+                    if (kind == TAG_LISTEN) onQuery(payload, out->payloadlen, *from);
+                    else                    onReply(payload, out->payloadlen, *from);
+                }
+                ring.recycle(group, bid);
+            } else if (c.res == -EINVAL || c.res == -EOPNOTSUPP) {
+                // No multishot RECVMSG (Linux 6.0; buffer rings came in 5.19, and a probe
+                // only reports opcodes, not this flag). Re-arming would fail the same way
+                // forever: give up on the ring so serve() falls back to the poll engine.
+                unsupported = true;
+                return;
+            } else if (c.res < 0 && c.res != -ENOBUFS) {
+                std::println(YELLOW "[WARN] io_uring recv failed , error {}" RESET, -c.res);
+            }
+
+            // The kernel ends a multishot on errors or when buffers run out; re-arm it.
+            if (!(c.flags & IORING_CQE_F_MORE))
+                ring.recvMultishot(s, group, tag(kind));
+        };
+
+        // The epoll set has something ready: service it without blocking and re-arm the poll.
+        auto onTcp = [&] {
+            const int ready = tcpPoller.wait(0);
+            for (int i = 0; i < ready; ++i)
+                handleTcp(tcpPoller.ready(i));
+            ring.pollReadable(tcpPoller.fd(), tag(TAG_TCP));
+        };
+
+        auto onSend = [&](const Uring::Completion &c) {
+            const auto slot = static_cast<uint32_t>(c.tag & 0xFFFFFFFF);
+
+            // Kernels without fixed-buffer SEND_ZC reject it; resend this slot the copying way.
+            if (c.res == -EINVAL || c.res == -EOPNOTSUPP) {
+                if (ring.zeroCopy()) {
+                    ring.disableZeroCopy();
+                    std::println(YELLOW "[WARN] io_uring zero-copy send unsupported , using plain sends" RESET);
+                    if (!(c.flags & IORING_CQE_F_MORE) &&
+                        ring.sendTo(tx.sock[slot], tx.pool.data(slot), tx.len[slot], &tx.addr[slot], tag(TAG_SEND, slot)))
+                        return;
+                }
+            }
+
+            // A zero-copy send posts F_MORE first and F_NOTIF once the buffer is free again.
+            if (c.flags & IORING_CQE_F_MORE)
+                return;
+            tx.pool.put(slot);
+        };
+
+        std::println(GREEN "[INFO] io_uring engine running , multishot recv + provided buffers{}" RESET,
+            ring.zeroCopy() ? " + zero-copy sends" : "");
+
+        // Upstream replies seen during a CQ walk; handled after every query of that walk,
+        // so local answers are queued first (fast path before slow path, as in serve()).
+        std::vector<Uring::Completion> deferred;
+        deferred.reserve(RING_ENTRIES * 4);
+
+        ringTx_ = &tx;
+
+        const int waitMs = stop.stop_possible() ? STOP_POLL_MS : -1;
+        while (!stop.stop_requested() && !unsupported) {
+            // Busy-poll mode: submit without waiting, then watch the CQ from user space
+            // for a while before sleeping in the kernel.
+            const int budget = waitBudget(waitMs);
+            const bool spun = budget != 0 && cfg_.busyPoll_us > 0 && ring.submitAndWait(0) >= 0 &&
+                              busyPoll([&] { return ring.hasCompletions(); });
+            if (const int rc = spun ? 0 : ring.submitAndWait(budget); rc < 0) {
+                std::println(YELLOW "[WARN] io_uring_enter failed , error {}" RESET, -rc);
+                continue;
+            }
+
+            ring.forEachCompletion([&](const Uring::Completion &c) {
+                switch (static_cast<Tag>(c.tag >> 32)) {
+                    case TAG_LISTEN:   onRecv(c, LISTEN_GROUP,   socket_,   TAG_LISTEN);   break;
+                    case TAG_UPSTREAM: deferred.push_back(c); break;
+                    case TAG_SEND:     onSend(c); break;
+                    case TAG_TCP:      onTcp(); break;
+                    case TAG_LOOP:
+                        loop_.drain();
+                        ring.pollReadable(loop_.fd(), tag(TAG_LOOP));
+                        break;
+                }
+            });
+
+            for (const auto &c : deferred)
+                onRecv(c, UPSTREAM_GROUP, upstream_, TAG_UPSTREAM);
+            deferred.clear();
+
+            // Queries, retries and probes are built in upstreamTx_ like in the poll loop,
+            // then sent from the arena.
+            retryInflight();
+            probeUpstreams();
+            flushUpstream();
+
+            expireInflight();
+            flushClientTx();
+            // Once per pass, not per datagram: this is what overload looks like.
+            if (const size_t dropped = std::exchange(tx.dropped, 0); dropped > 0)
+                std::println(YELLOW "[WARN] io_uring tx full , dropped {} datagram(s) this pass" RESET, dropped);
+            sweepTcp();
+            logStats();
+        }
+        // What is left is sent the plain way; the ring is about to go.
+        ringTx_ = nullptr;
+        abandonInflight();
+        tcpClients_.closeAll();
+        tcpClients_.attach(nullptr);
+        dohClients_.closeAll();
+        dohClients_.attach(nullptr);
+        tcpUpstreams_.closeAll();
+        tcpUpstreams_.attach(nullptr);
+        dohUpstreams_.closeAll();
+        dohUpstreams_.attach(nullptr);
+        return unsupported ? DNS::Error::SERVER_SOCKET_FAIL : DNS::Error::OK;
+    }
+
+#else
+
+    struct Listener::RingTx {};
+
+    void Listener::queueOnRing(DatagramBatch &, Platform::socket_t) noexcept {}
+
+    DNS::Error Listener::serveUring(std::stop_token) noexcept {
+        return DNS::Error::SERVER_SOCKET_FAIL;
+    }
+
+#endif
+
+} // namespace DNS::Server
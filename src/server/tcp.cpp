@@ -0,0 +1,325 @@
+#include "../../include/server/tcp.hpp"
+
+#include <algorithm>
+
+namespace DNS::Server {
+
+    namespace Stream {
+
+        bool fill(TcpStream &s) noexcept {
+            uint8_t buf[16 * 1024];
+            for (;;) {
+                const int n = static_cast<int>(::recv(s.sock, reinterpret_cast<char *>(buf), sizeof(buf), 0));
+                if (n > 0) {
+                    s.rx.insert(s.rx.end(), buf, buf + n);
+                    s.lastActive = std::chrono::steady_clock::now();
+                    continue;
+                }
+                if (n < 0) {
+                    const int err = Platform::lastError();
+                    if (Platform::isWouldBlock(err))
+                        return true;
+                    if (Platform::isInterrupted(err))
+                        continue;
+                }
+                return false;
+            }
+        }
+
+        void frame(TcpStream &s, const uint8_t *msg, size_t len) noexcept {
+            s.tx.push_back(static_cast<uint8_t>(len >> 8));
+            s.tx.push_back(static_cast<uint8_t>(len & 0xFF));
+            s.tx.insert(s.tx.end(), msg, msg + len);
+            s.lastActive = std::chrono::steady_clock::now();
+        }
+
+        bool write(TcpStream &s, Platform::Poller *poller) noexcept {
+            while (s.txOff < s.tx.size()) {
+                const int n = Platform::sendStream(s.sock, s.tx.data() + s.txOff, s.tx.size() - s.txOff);
+                if (n > 0) {
+                    s.txOff += static_cast<size_t>(n);
+                    continue;
+                }
+                const int err = Platform::lastError();
+                if (Platform::isInterrupted(err))
+                    continue;
+                if (!Platform::isWouldBlock(err))
+                    return false;
+                // The socket buffer is full; carry on once the Poller reports it writable.
+                if (poller && !s.stalled)
+                    poller->setWritable(s.sock, true);
+                s.stalled = true;
+                return true;
+            }
+
+            // Everything went out; stop asking about writability and reuse the buffer.
+            if (poller && s.stalled)
+                poller->setWritable(s.sock, false);
+            s.stalled = false;
+            s.tx.clear();
+            s.txOff = 0;
+            return true;
+        }
+
+    } // namespace Stream
+
+    size_t TcpConnections::accept(Platform::socket_t listener) noexcept {
+        size_t accepted = 0;
+        for (;;) {
+            sockaddr_storage peer{};
+            Platform::socklen_t peerLen = sizeof(peer);
+            Platform::socket_t s = ::accept(listener, reinterpret_cast<sockaddr *>(&peer), &peerLen);
+            if (s == Platform::INVALID_SOCK)
+                return accepted;
+
+            if (bySocket_.size() >= MAX_CONNECTIONS || !Platform::setNonBlocking(s) ||
+                (poller_ && !poller_->add(s))) {
+                Platform::closeSocket(s);
+                continue;
+            }
+
+            uint32_t slot;
+            if (!free_.empty()) {
+                slot = free_.back();
+                free_.pop_back();
+            } else {
+                slot = static_cast<uint32_t>(slots_.size());
+                slots_.emplace_back();
+                generations_.push_back(0);
+            }
+
+            // Generation 0 is never handed out, so token 0 can mean "not a TCP client".
+            if (++generations_[slot] == 0)
+                generations_[slot] = 1;
+
+            TcpConnection &c = slots_[slot];
+            c.sock       = s;
+            c.peer       = peer;
+            c.token      = slot << 16 | generations_[slot];
+            c.rx.clear();
+            c.tx.clear();
+            c.txOff      = 0;
+            c.stalled    = false;
+            c.lastActive = clock::now();
+            c.pending    = 0;
+            bySocket_.emplace(s, slot);
+            ++accepted;
+        }
+    }
+
+    bool TcpConnections::send(TcpConnection &c, const uint8_t *msg, size_t len) noexcept {
+        if (c.sock == Platform::INVALID_SOCK || len > UINT16_MAX)
+            return false;
+        if (c.tx.size() - c.txOff + len > MAX_BACKLOG) {
+            close(c);
+            return false;
+        }
+
+        Stream::frame(c, msg, len);
+
+        // With a backlog already waiting for writability, the Poller will call flush().
+        if (c.stalled || Stream::write(c, poller_))
+            return true;
+        close(c);
+        return false;
+    }
+
+    void TcpConnections::flush(Platform::socket_t s) noexcept {
+        const auto it = bySocket_.find(s);
+        if (it != bySocket_.end() && !Stream::write(slots_[it->second], poller_))
+            close(slots_[it->second]);
+    }
+
+    TcpConnection *TcpConnections::find(uint32_t token) noexcept {
+        const uint32_t slot = token >> 16;
+        if (token == 0 || slot >= slots_.size())
+            return nullptr;
+        TcpConnection &c = slots_[slot];
+        return c.sock != Platform::INVALID_SOCK && c.token == token ? &c : nullptr;
+    }
+
+    void TcpConnections::closeIdle(clock::time_point now) noexcept {
+        for (TcpConnection &c : slots_)
+            if (c.sock != Platform::INVALID_SOCK && c.pending == 0 && now - c.lastActive >= IDLE_TIMEOUT)
+                close(c);
+    }
+
+    void TcpConnections::close(TcpConnection &c) noexcept {
+        if (c.sock == Platform::INVALID_SOCK)
+            return;
+        if (poller_)
+            poller_->remove(c.sock);
+        bySocket_.erase(c.sock);
+        Platform::closeSocket(c.sock);
+        c.rx.clear();
+        c.tx.clear();
+        c.txOff   = 0;
+        c.pending = 0;
+        c.stalled = false;
+        free_.push_back(c.token >> 16);
+    }
+
+    void TcpConnections::closeAll() noexcept {
+        for (TcpConnection &c : slots_)
+            close(c);
+    }
+
+    void TcpUpstreams::init(size_t upstreams, TlsClient *tls) {
+        closeAll();
+        tls_ = tls;
+        streams_.assign(upstreams, UpstreamStream{});
+        orphans_.clear();
+    }
+
+    bool TcpUpstreams::send(uint8_t upstream, const sockaddr_storage &addr, uint16_t id,
+                            const uint8_t *msg, size_t len) noexcept {
+        if (upstream >= streams_.size() || len < 2 || len > UINT16_MAX)
+            return false;
+        UpstreamStream &c = streams_[upstream];
+
+        if (c.sock == Platform::INVALID_SOCK) {
+            Platform::socket_t s = Platform::connectStream(addr);
+            if (s == Platform::INVALID_SOCK)
+                return false;
+            if (poller_ && !poller_->add(s)) {
+                Platform::closeSocket(s);
+                return false;
+            }
+            c.sock       = s;
+            c.connecting = true;
+            c.answered   = 0;
+            // The connect completes when the socket turns writable.
+            c.stalled    = true;
+            if (poller_)
+                poller_->setWritable(s, true);
+            bySocket_.emplace(s, upstream);
+        }
+
+        const size_t at = c.tx.size() + 2;
+        Stream::frame(c, msg, len);
+        c.tx[at]     = static_cast<uint8_t>(id >> 8);
+        c.tx[at + 1] = static_cast<uint8_t>(id & 0xFF);
+        c.waiting.push_back(id);
+        if (c.connecting || c.handshaking || c.stalled || write(c))
+            return true;
+        // The caller learns about this query from the return value, not as an orphan.
+        c.waiting.pop_back();
+        close(upstream);
+        return false;
+    }
+
+    bool TcpUpstreams::flush(Platform::socket_t s) noexcept {
+        const auto it = bySocket_.find(s);
+        if (it == bySocket_.end())
+            return false;
+        const uint8_t upstream = it->second;
+        UpstreamStream &c = streams_[upstream];
+
+        if (c.connecting) {
+            if (Platform::connectError(s) != 0) {
+                close(upstream);
+                return true;
+            }
+            c.connecting = false;
+            if (tls_) {
+                c.tls = tls_->open(s, upstream);
+                if (!c.tls) {
+                    close(upstream);
+                    return true;
+                }
+                c.handshaking = true;
+            }
+        }
+        // Until the handshake is done, readiness either way only moves it along.
+        if (c.handshaking && !handshake(upstream))
+            return true;
+        if (!write(c))
+            close(upstream);
+        return true;
+    }
+
+    bool TcpUpstreams::handshake(uint8_t upstream) noexcept {
+        UpstreamStream &c = streams_[upstream];
+        const TlsClient::Step step = tls_->handshake(c.tls);
+        if (step == TlsClient::Step::FAILED) {
+            close(upstream);
+            return false;
+        }
+        // Watch for writability only while the handshake waits to write; otherwise the
+        // resolver's next flight (readable) drives it.
+        const bool writable = step == TlsClient::Step::WANT_WRITE;
+        if (poller_ && c.stalled != writable)
+            poller_->setWritable(c.sock, writable);
+        c.stalled = writable;
+        if (step != TlsClient::Step::DONE)
+            return false;
+        c.handshaking = false;
+        return true;
+    }
+
+    bool TcpUpstreams::write(UpstreamStream &c) noexcept {
+        return c.tls ? Tls::write(c.tls, c, poller_) : Stream::write(c, poller_);
+    }
+
+    void TcpUpstreams::answered(UpstreamStream &c, uint16_t id) noexcept {
+        ++c.answered;
+        const auto it = std::find(c.waiting.begin(), c.waiting.end(), id);
+        if (it != c.waiting.end()) {
+            *it = c.waiting.back();
+            c.waiting.pop_back();
+        }
+    }
+
+    bool TcpUpstreams::waiting(uint8_t upstream, uint16_t id) const noexcept {
+        if (upstream >= streams_.size() || streams_[upstream].sock == Platform::INVALID_SOCK)
+            return false;
+        const auto &w = streams_[upstream].waiting;
+        return std::find(w.begin(), w.end(), id) != w.end();
+    }
+
+    void TcpUpstreams::takeOrphans(std::vector<std::pair<uint8_t, uint16_t>> &out) noexcept {
+        out.insert(out.end(), orphans_.begin(), orphans_.end());
+        orphans_.clear();
+    }
+
+    void TcpUpstreams::closeIdle(clock::time_point now) noexcept {
+        for (size_t i = 0; i < streams_.size(); ++i) {
+            const UpstreamStream &c = streams_[i];
+            if (c.sock != Platform::INVALID_SOCK && c.waiting.empty() && now - c.lastActive >= IDLE_TIMEOUT)
+                close(static_cast<uint8_t>(i));
+        }
+    }
+
+    void TcpUpstreams::close(uint8_t upstream) noexcept {
+        UpstreamStream &c = streams_[upstream];
+        if (c.sock == Platform::INVALID_SOCK)
+            return;
+        if (poller_)
+            poller_->remove(c.sock);
+        bySocket_.erase(c.sock);
+        if (c.tls)
+            Tls::close(c.tls);
+        Platform::closeSocket(c.sock);
+
+        // A connection that worked before was most likely closed for being idle or busy;
+        // what was still waiting on it deserves one more try on a fresh connection.
+        if (c.answered > 0)
+            for (const uint16_t id : c.waiting)
+                orphans_.emplace_back(upstream, id);
+        c.waiting.clear();
+        c.rx.clear();
+        c.tx.clear();
+        c.txOff      = 0;
+        c.stalled    = false;
+        c.connecting = false;
+        c.handshaking = false;
+        c.answered   = 0;
+    }
+
+    void TcpUpstreams::closeAll() noexcept {
+        for (size_t i = 0; i < streams_.size(); ++i)
+            close(static_cast<uint8_t>(i));
+        orphans_.clear();
+    }
+
+} // namespace DNS::Server
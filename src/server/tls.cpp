@@ -0,0 +1,268 @@
+#include "../../include/server/tls.hpp"
+#include "../../include/server/tcp.hpp"
+
+#ifdef DNS_HAVE_TLS
+#include <csignal>
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+#include <openssl/x509v3.h>
+#endif
+
+namespace DNS::Server {
+
+#ifdef DNS_HAVE_TLS
+
+    TlsClient::~TlsClient() noexcept {
+        reset();
+    }
+
+    void TlsClient::reset() noexcept {
+        for (Peer &p : peers_)
+            if (p.session) SSL_SESSION_free(p.session);
+        peers_.clear();
+        if (ctx_) SSL_CTX_free(ctx_);
+        ctx_ = nullptr;
+    }
+
+    DNS::Error TlsClient::init(std::vector<Peer> peers, const std::string &caFile, bool http2) noexcept {
+        reset();
+#ifndef _WIN32
+        // OpenSSL writes with plain write(); a resolver that already closed would
+        // otherwise raise SIGPIPE and kill the process.
+        std::signal(SIGPIPE, SIG_IGN);
+#endif
+        SSL_CTX *ctx = SSL_CTX_new(TLS_client_method());
+        if (!ctx)
+            return DNS::Error::UPSTREAM_TLS_FAIL;
+
+        SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+        SSL_CTX_set_verify(ctx, SSL_VERIFY_PEER, nullptr);
+        const int trusted = caFile.empty() ? SSL_CTX_set_default_verify_paths(ctx)
+                                           : SSL_CTX_load_verify_locations(ctx, caFile.c_str(), nullptr);
+        if (trusted != 1) {
+            SSL_CTX_free(ctx);
+            return DNS::Error::UPSTREAM_TLS_FAIL;
+        }
+
+        // s.tx may move (it grows) between a short write and its retry.
+        SSL_CTX_set_mode(ctx, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+        // Messages are length-prefixed, so a resolver closing without close_notify cannot
+        // truncate one unnoticed; treating it as fatal would only throw its ticket away.
+        SSL_CTX_set_options(ctx, SSL_OP_IGNORE_UNEXPECTED_EOF);
+        // Tickets are kept per resolver by onSession(), not in OpenSSL's internal cache.
+        SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+        SSL_CTX_sess_set_new_cb(ctx, &TlsClient::onSession);
+        SSL_CTX_set_app_data(ctx, this);
+        // RFC 8484 section 5.2: DoH runs over HTTP/2, which TLS negotiates with ALPN "h2".
+        static constexpr unsigned char H2[] = { 2, 'h', '2' };
+        if (http2 && SSL_CTX_set_alpn_protos(ctx, H2, sizeof(H2)) != 0) {
+            SSL_CTX_free(ctx);
+            return DNS::Error::UPSTREAM_TLS_FAIL;
+        }
+
+        ctx_   = ctx;
+        peers_ = std::move(peers);
+        return DNS::Error::OK;
+    }
+
+    int TlsClient::onSession(SSL *tls, SSL_SESSION *session) {
+        auto *self = static_cast<TlsClient *>(SSL_CTX_get_app_data(SSL_get_SSL_CTX(tls)));
+        const auto upstream = reinterpret_cast<uintptr_t>(SSL_get_app_data(tls));
+        if (!self || upstream >= self->peers_.size())
+            return 0;
+        Peer &p = self->peers_[upstream];
+        if (p.session)
+            SSL_SESSION_free(p.session);
+        // Returning 1 hands our reference to p.session.
+        p.session = session;
+        return 1;
+    }
+
+    SSL *TlsClient::open(Platform::socket_t s, uint8_t upstream) noexcept {
+        if (!ctx_ || upstream >= peers_.size())
+            return nullptr;
+        SSL *tls = SSL_new(ctx_);
+        if (!tls)
+            return nullptr;
+        const Peer &p = peers_[upstream];
+        SSL_set_app_data(tls, reinterpret_cast<void *>(static_cast<uintptr_t>(upstream)));
+
+        // RFC 7858 section 3.2: the resolver is authenticated by name if one is configured,
+        // by its address otherwise.
+        bool ok = SSL_set_fd(tls, static_cast<int>(s)) == 1;
+        if (ok && !p.host.empty())
+            ok = SSL_set_tlsext_host_name(tls, p.host.c_str()) == 1 && SSL_set1_host(tls, p.host.c_str()) == 1;
+        else if (ok)
+            ok = X509_VERIFY_PARAM_set1_ip_asc(SSL_get0_param(tls), p.ip.c_str()) == 1;
+        if (ok && p.session && SSL_SESSION_is_resumable(p.session))
+            SSL_set_session(tls, p.session);
+        if (!ok) {
+            SSL_free(tls);
+            return nullptr;
+        }
+        SSL_set_connect_state(tls);
+        return tls;
+    }
+
+    TlsClient::Step TlsClient::handshake(SSL *tls) noexcept {
+        const Step step = Tls::handshake(tls);
+        const auto upstream = reinterpret_cast<uintptr_t>(SSL_get_app_data(tls));
+        if (upstream >= peers_.size())
+            return step;
+        Peer &p = peers_[upstream];
+        if (step == Step::DONE) {
+            ++p.handshakes;
+            if (SSL_session_reused(tls))
+                ++p.resumed;
+        } else if (step == Step::FAILED) {
+            ++p.failed;
+        }
+        return step;
+    }
+
+    TlsServer::~TlsServer() noexcept {
+        if (ctx_) SSL_CTX_free(ctx_);
+    }
+
+    DNS::Error TlsServer::init(const std::string &certFile, const std::string &keyFile) noexcept {
+        if (ctx_) SSL_CTX_free(ctx_);
+        ctx_ = nullptr;
+#ifndef _WIN32
+        std::signal(SIGPIPE, SIG_IGN);
+#endif
+        SSL_CTX *ctx = SSL_CTX_new(TLS_server_method());
+        if (!ctx)
+            return DNS::Error::SERVER_TLS_FAIL;
+        SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+        if (SSL_CTX_use_certificate_chain_file(ctx, certFile.c_str()) != 1 ||
+            SSL_CTX_use_PrivateKey_file(ctx, keyFile.c_str(), SSL_FILETYPE_PEM) != 1 ||
+            SSL_CTX_check_private_key(ctx) != 1) {
+            ERR_clear_error();
+            SSL_CTX_free(ctx);
+            return DNS::Error::SERVER_TLS_FAIL;
+        }
+        SSL_CTX_set_mode(ctx, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+        SSL_CTX_set_options(ctx, SSL_OP_IGNORE_UNEXPECTED_EOF);
+        // RFC 9113 section 9.2: HTTP/2 over TLS is negotiated with ALPN "h2"; a client offering
+        // only something else is turned away. One offering nothing is assumed to know.
+        SSL_CTX_set_alpn_select_cb(ctx, [](SSL *, const unsigned char **out, unsigned char *outLen,
+                                           const unsigned char *in, unsigned int inLen, void *) {
+            static constexpr unsigned char H2[] = { 2, 'h', '2' };
+            unsigned char *selected = nullptr;
+            if (SSL_select_next_proto(&selected, outLen, H2, sizeof(H2), in, inLen) != OPENSSL_NPN_NEGOTIATED)
+                return SSL_TLSEXT_ERR_ALERT_FATAL;
+            *out = selected;
+            return SSL_TLSEXT_ERR_OK;
+        }, nullptr);
+        ctx_ = ctx;
+        return DNS::Error::OK;
+    }
+
+    SSL *TlsServer::accept(Platform::socket_t s) noexcept {
+        if (!ctx_)
+            return nullptr;
+        SSL *tls = SSL_new(ctx_);
+        if (!tls)
+            return nullptr;
+        if (SSL_set_fd(tls, static_cast<int>(s)) != 1) {
+            SSL_free(tls);
+            return nullptr;
+        }
+        SSL_set_accept_state(tls);
+        return tls;
+    }
+
+    Tls::Step Tls::handshake(SSL *tls) noexcept {
+        const int r = SSL_do_handshake(tls);
+        if (r == 1)
+            return Step::DONE;
+        switch (SSL_get_error(tls, r)) {
+            case SSL_ERROR_WANT_READ:  return Step::WANT_READ;
+            case SSL_ERROR_WANT_WRITE: return Step::WANT_WRITE;
+            default:
+                ERR_clear_error();
+                return Step::FAILED;
+        }
+    }
+
+    bool Tls::fill(SSL *tls, TcpStream &s) noexcept {
+        uint8_t buf[16 * 1024];
+        for (;;) {
+            const int n = SSL_read(tls, buf, static_cast<int>(sizeof(buf)));
+            if (n > 0) {
+                s.rx.insert(s.rx.end(), buf, buf + n);
+                s.lastActive = std::chrono::steady_clock::now();
+                continue;
+            }
+            switch (SSL_get_error(tls, n)) {
+                // Nothing more decrypted for now; post-handshake messages (tickets) end up
+                // here too, after onSession() took them.
+                case SSL_ERROR_WANT_READ:
+                case SSL_ERROR_WANT_WRITE:
+                    return true;
+                default:
+                    ERR_clear_error();
+                    return false;
+            }
+        }
+    }
+
+    bool Tls::write(SSL *tls, TcpStream &s, Platform::Poller *poller) noexcept {
+        while (s.txOff < s.tx.size()) {
+            const int n = SSL_write(tls, s.tx.data() + s.txOff, static_cast<int>(s.tx.size() - s.txOff));
+            if (n > 0) {
+                s.txOff += static_cast<size_t>(n);
+                continue;
+            }
+            const int err = SSL_get_error(tls, n);
+            // A record the peer has to answer first; reading it resumes the write.
+            if (err == SSL_ERROR_WANT_READ)
+                return true;
+            if (err != SSL_ERROR_WANT_WRITE) {
+                ERR_clear_error();
+                return false;
+            }
+            if (poller && !s.stalled)
+                poller->setWritable(s.sock, true);
+            s.stalled = true;
+            return true;
+        }
+
+        if (poller && s.stalled)
+            poller->setWritable(s.sock, false);
+        s.stalled = false;
+        s.tx.clear();
+        s.txOff = 0;
+        return true;
+    }
+
+    void Tls::close(SSL *&tls) noexcept {
+        if (!tls)
+            return;
+        // A session freed without close_notify is marked not resumable; the socket is
+        // non-blocking, so this never waits for the resolver's reply.
+        SSL_shutdown(tls);
+        ERR_clear_error();
+        SSL_free(tls);
+        tls = nullptr;
+    }
+
+#else
+
+    TlsClient::~TlsClient() noexcept = default;
+    void TlsClient::reset() noexcept {}
+    DNS::Error TlsClient::init(std::vector<Peer>, const std::string &, bool) noexcept { return DNS::Error::UPSTREAM_TLS_FAIL; }
+    int TlsClient::onSession(ssl_st *, ssl_session_st *) { return 0; }
+    ssl_st *TlsClient::open(Platform::socket_t, uint8_t) noexcept { return nullptr; }
+    TlsClient::Step TlsClient::handshake(ssl_st *) noexcept { return Step::FAILED; }
+    TlsServer::~TlsServer() noexcept = default;
+    DNS::Error TlsServer::init(const std::string &, const std::string &) noexcept { return DNS::Error::SERVER_TLS_FAIL; }
+    ssl_st *TlsServer::accept(Platform::socket_t) noexcept { return nullptr; }
+    Tls::Step Tls::handshake(ssl_st *) noexcept { return Tls::Step::FAILED; }
+    bool Tls::fill(ssl_st *, TcpStream &) noexcept { return false; }
+    bool Tls::write(ssl_st *, TcpStream &, Platform::Poller *) noexcept { return false; }
+    void Tls::close(ssl_st *&tls) noexcept { tls = nullptr; }
+
+#endif
+
+} // namespace DNS::Server
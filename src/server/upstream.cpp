@@ -0,0 +1,198 @@
+#include "../../include/server/upstream.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace DNS::Server {
+
+    DNS::Error UpstreamPool::init(const std::vector<std::string> &ips, uint16_t port) noexcept {
+        upstreams_.clear();
+        picks_ = 0;
+        if (ips.empty() || ips.size() > MAX_UPSTREAMS)
+            return DNS::Error::INVALID_IP;
+
+        family_ = AF_INET;
+        for (const auto &ip : ips) {
+            Upstream u;
+            // "address#name": the name the resolver's TLS certificate is checked against.
+            const size_t hash = ip.find('#');
+            u.name = ip.substr(0, hash);
+            if (hash != std::string::npos)
+                u.tlsName = ip.substr(hash + 1);
+            if (!Platform::parseAddress(u.name, port, u.addr)) {
+                upstreams_.clear();
+                return DNS::Error::INVALID_IP;
+            }
+            if (u.addr.ss_family == AF_INET6)
+                family_ = AF_INET6;
+            upstreams_.push_back(std::move(u));
+        }
+
+        // One socket reaches them all: with any IPv6 resolver it is a dual-stack IPv6
+        // socket, which addresses (and reports) IPv4 peers in their mapped form.
+        if (family_ == AF_INET6)
+            for (Upstream &u : upstreams_)
+                Platform::mapToV6(u.addr);
+        return DNS::Error::OK;
+    }
+
+    double UpstreamPool::score(const Upstream &u) noexcept {
+        // Unmeasured resolvers score 0 and are tried first.
+        return u.answered == 0 ? 0.0 : u.srttMs / std::max(0.05, 1.0 - u.loss);
+    }
+
+    std::optional<uint8_t> UpstreamPool::pick() noexcept {
+        const size_t n = upstreams_.size();
+        const uint32_t turn = picks_++;
+
+        auto isUp = [](const Upstream &u) { return !u.open; };
+
+        // Exploration: keep RTT estimates of the resolvers we do not normally use fresh.
+        size_t best = n;
+        if (n > 1 && turn % EXPLORE_EVERY == EXPLORE_EVERY - 1) {
+            const size_t candidate = (turn / EXPLORE_EVERY) % n;
+            if (isUp(upstreams_[candidate]))
+                best = candidate;
+        }
+
+        if (best == n) {
+            double bestScore = 0.0;
+            for (size_t i = 0; i < n; ++i) {
+                const Upstream &u = upstreams_[i];
+                if (!isUp(u))
+                    continue;
+                const double score = UpstreamPool::score(u);
+                if (best == n || score < bestScore) {
+                    best      = i;
+                    bestScore = score;
+                }
+            }
+        }
+
+        if (best == n)
+            return std::nullopt;
+
+        ++upstreams_[best].sent;
+        return static_cast<uint8_t>(best);
+    }
+
+    bool UpstreamPool::onAnswer(uint8_t i, clock::duration rtt) noexcept {
+        Upstream &u = upstreams_[i];
+        const double sample = std::chrono::duration<double, std::milli>(rtt).count();
+        // RFC 6298: RTTVAR is updated with the old SRTT before SRTT moves.
+        if (u.answered == 0) {
+            u.srttMs   = sample;
+            u.rttvarMs = sample / 2.0;
+        } else {
+            u.rttvarMs += RTTVAR_BETA * (std::abs(u.srttMs - sample) - u.rttvarMs);
+            u.srttMs   += RTT_ALPHA * (sample - u.srttMs);
+        }
+
+        // p95 over the last RTT_WINDOW samples; nth_element on 64 floats is cheap enough per answer.
+        u.rtts[u.answered % Upstream::RTT_WINDOW] = static_cast<float>(sample);
+        const size_t n = std::min<size_t>(u.answered + 1, Upstream::RTT_WINDOW);
+        if (n >= Upstream::MIN_P95_SAMPLES) {
+            std::copy_n(u.rtts.begin(), n, scratch_.begin());
+            const size_t k = (n * 95 + 99) / 100 - 1;
+            std::nth_element(scratch_.begin(), scratch_.begin() + k, scratch_.begin() + n);
+            u.p95Ms = scratch_[k];
+        }
+        u.loss    -= LOSS_ALPHA * u.loss;
+        u.failures  = 0;
+        ++u.answered;
+
+        const bool wasOpen = u.open;
+        u.open        = false;
+        u.probeMisses = 0;
+        return wasOpen;
+    }
+
+    std::optional<uint8_t> UpstreamPool::pickOther(uint8_t exclude) noexcept {
+        size_t best = upstreams_.size();
+        double bestScore = 0.0;
+        for (size_t i = 0; i < upstreams_.size(); ++i) {
+            const Upstream &u = upstreams_[i];
+            if (i == exclude || u.open)
+                continue;
+            const double score = UpstreamPool::score(u);
+            if (best == upstreams_.size() || score < bestScore) {
+                best      = i;
+                bestScore = score;
+            }
+        }
+        if (best == upstreams_.size())
+            return std::nullopt;
+        ++upstreams_[best].sent;
+        return static_cast<uint8_t>(best);
+    }
+
+    std::optional<UpstreamPool::clock::duration> UpstreamPool::hedgeDelay(uint8_t i) const noexcept {
+        const Upstream &u = upstreams_[i];
+        if (u.answered < Upstream::MIN_P95_SAMPLES)
+            return std::nullopt;
+        const auto p95 = std::chrono::duration_cast<clock::duration>(std::chrono::duration<double, std::milli>(u.p95Ms));
+        return std::max<clock::duration>(p95, HEDGE_FLOOR);
+    }
+
+    UpstreamPool::clock::duration UpstreamPool::rto(uint8_t i, uint8_t backoff) const noexcept {
+        const Upstream &u = upstreams_[i];
+        std::chrono::duration<double, std::milli> rto = RTO_INITIAL;
+        if (u.answered > 0)
+            rto = std::chrono::duration<double, std::milli>(u.srttMs + 4.0 * u.rttvarMs);
+        // Back off from the floored value, so a fast resolver still doubles 50, 100, 200 ms.
+        const auto base = std::max<clock::duration>(std::chrono::duration_cast<clock::duration>(rto), RTO_FLOOR);
+        return std::min<clock::duration>(base * (1 << std::min<uint8_t>(backoff, 6)), RTO_CEILING);
+    }
+
+    bool UpstreamPool::onTimeout(uint8_t i, clock::time_point now) noexcept {
+        Upstream &u = upstreams_[i];
+        u.loss += LOSS_ALPHA * (1.0 - u.loss);
+        ++u.timedOut;
+        // Only report the transition, not every timeout of queries already in flight.
+        if (++u.failures < OPEN_AFTER || u.open)
+            return false;
+
+        u.open        = true;
+        u.probing     = false;
+        u.probeMisses = 0;
+        u.nextProbe   = now + PROBE_INTERVAL;
+        ++u.opened;
+        return true;
+    }
+
+    size_t UpstreamPool::dueProbes(clock::time_point now, std::vector<uint8_t> &out) noexcept {
+        size_t n = 0;
+        for (size_t i = 0; i < upstreams_.size(); ++i) {
+            Upstream &u = upstreams_[i];
+            if (!u.open || u.probing || u.nextProbe > now)
+                continue;
+            u.probing = true;
+            ++u.probes;
+            out.push_back(static_cast<uint8_t>(i));
+            ++n;
+        }
+        return n;
+    }
+
+    void UpstreamPool::onProbeTimeout(uint8_t i, clock::time_point now) noexcept {
+        Upstream &u = upstreams_[i];
+        u.probing = false;
+        if (!u.open)
+            return;
+        const auto backoff = PROBE_INTERVAL * (1 << std::min<uint32_t>(u.probeMisses++, 5));
+        u.nextProbe = now + std::min<clock::duration>(backoff, PROBE_MAX_INTERVAL);
+    }
+
+    int UpstreamPool::msUntilNextProbe(clock::time_point now) const noexcept {
+        int due = -1;
+        for (const Upstream &u : upstreams_) {
+            if (!u.open || u.probing)
+                continue;
+            const auto left = std::chrono::ceil<std::chrono::milliseconds>(u.nextProbe - now).count();
+            const int ms = left > 0 ? static_cast<int>(left) : 0;
+            due = due < 0 ? ms : std::min(due, ms);
+        }
+        return due;
+    }
+
+} // namespace DNS::Server
@@ -0,0 +1,272 @@
+#include "../../include/server/uring.hpp"
+
+#ifdef DNS_HAVE_URING
+#include <cerrno>
+#include <algorithm>
+#include <cstring>
+#include <ctime>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace DNS::Server {
+
+#ifdef DNS_HAVE_URING
+
+    namespace {
+        int sysSetup(unsigned entries, io_uring_params *p) noexcept {
+            return static_cast<int>(syscall(__NR_io_uring_setup, entries, p));
+        }
+        int sysEnter(int fd, unsigned submit, unsigned wait, unsigned flags, void *arg, size_t argsz) noexcept {
+            return static_cast<int>(syscall(__NR_io_uring_enter, fd, submit, wait, flags, arg, argsz));
+        }
+        int sysRegister(int fd, unsigned op, void *arg, unsigned nr) noexcept {
+            return static_cast<int>(syscall(__NR_io_uring_register, fd, op, arg, nr));
+        }
+    }
+
+    Uring::~Uring() noexcept {
+        for (auto &r : rings_)
+            if (r.ring) munmap(r.ring, r.ringBytes);
+        if (sqes_)                          munmap(sqes_, sqesLen_);
+        if (cqMap_ && cqMap_ != sqMap_)     munmap(cqMap_, cqMapLen_);
+        if (sqMap_)                         munmap(sqMap_, sqMapLen_);
+        if (fd_ >= 0)                       ::close(fd_);
+    }
+
+    bool Uring::init(unsigned entries) noexcept {
+        io_uring_params p{};
+        p.flags      = IORING_SETUP_CQSIZE;
+        p.cq_entries = entries * 4;
+
+        fd_ = sysSetup(entries, &p);
+        if (fd_ < 0)
+            return false;
+        // Timed waits need IORING_ENTER_EXT_ARG (5.11+).
+        if (!(p.features & IORING_FEAT_EXT_ARG))
+            return false;
+
+        sqMapLen_ = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+        cqMapLen_ = p.cq_off.cqes  + p.cq_entries * sizeof(io_uring_cqe);
+        const bool single = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+        if (single)
+            sqMapLen_ = cqMapLen_ = std::max(sqMapLen_, cqMapLen_);
+
+        sqMap_ = mmap(nullptr, sqMapLen_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQ_RING);
+        if (sqMap_ == MAP_FAILED) { sqMap_ = nullptr; return false; }
+
+        if (single) {
+            cqMap_ = sqMap_;
+        } else {
+            cqMap_ = mmap(nullptr, cqMapLen_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_CQ_RING);
+            if (cqMap_ == MAP_FAILED) { cqMap_ = nullptr; return false; }
+        }
+
+        sqesLen_ = p.sq_entries * sizeof(io_uring_sqe);
+        void *sqes = mmap(nullptr, sqesLen_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQES);
+        if (sqes == MAP_FAILED)
+            return false;
+        sqes_ = static_cast<io_uring_sqe *>(sqes);
+
+        auto *sq = static_cast<uint8_t *>(sqMap_);
+        sqHead_    = reinterpret_cast<unsigned *>(sq + p.sq_off.head);
+        sqTail_    = reinterpret_cast<unsigned *>(sq + p.sq_off.tail);
+        sqArray_   = reinterpret_cast<unsigned *>(sq + p.sq_off.array);
+        sqMask_    = *reinterpret_cast<unsigned *>(sq + p.sq_off.ring_mask);
+        sqEntries_ = p.sq_entries;
+        sqLocalTail_ = *sqTail_;
+
+        auto *cq = static_cast<uint8_t *>(cqMap_);
+        cqHead_ = reinterpret_cast<unsigned *>(cq + p.cq_off.head);
+        cqTail_ = reinterpret_cast<unsigned *>(cq + p.cq_off.tail);
+        cqMask_ = *reinterpret_cast<unsigned *>(cq + p.cq_off.ring_mask);
+        cqes_   = reinterpret_cast<io_uring_cqe *>(cq + p.cq_off.cqes);
+        return true;
+    }
+
+    io_uring_sqe *Uring::nextSqe() noexcept {
+        const unsigned head = __atomic_load_n(sqHead_, __ATOMIC_ACQUIRE);
+        if (sqLocalTail_ - head >= sqEntries_)
+            return nullptr;
+        const unsigned idx = sqLocalTail_ & sqMask_;
+        io_uring_sqe *sqe = &sqes_[idx];
+        std::memset(sqe, 0, sizeof(*sqe));
+        sqArray_[idx] = idx;
+        ++sqLocalTail_;
+        return sqe;
+    }
+
+    io_uring_buf *Uring::entries(BufferRing &br) noexcept {
+        // Entry 0 starts at offset 0 (its last two bytes double as the ring tail). Not
+        // br.ring->bufs: in C++ the kernel header's flex-array wrapper adds an empty
+        // struct that shifts bufs[] by 8 bytes.
+        return reinterpret_cast<io_uring_buf *>(br.ring);
+    }
+
+    Uring::BufferRing *Uring::ring(uint16_t bgid) noexcept {
+        for (auto &r : rings_)
+            if (r.bgid == bgid) return &r;
+        return nullptr;
+    }
+
+    bool Uring::addBufferRing(uint16_t bgid, uint16_t count, uint32_t size) noexcept {
+        if (count == 0 || (count & (count - 1)) != 0)
+            return false;
+
+        BufferRing br;
+        br.bgid      = bgid;
+        br.mask      = static_cast<uint16_t>(count - 1);
+        br.size      = size;
+        br.ringBytes = count * sizeof(io_uring_buf);
+        void *mem = mmap(nullptr, br.ringBytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mem == MAP_FAILED)
+            return false;
+        br.ring = static_cast<io_uring_buf_ring *>(mem);
+        br.storage.assign(static_cast<size_t>(count) * size, 0);
+
+        io_uring_buf_reg reg{};
+        reg.ring_addr    = reinterpret_cast<uint64_t>(br.ring);
+        reg.ring_entries = count;
+        reg.bgid         = bgid;
+        if (sysRegister(fd_, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+            munmap(mem, br.ringBytes);
+            return false;
+        }
+
+        // Publish every buffer up front.
+        for (uint16_t bid = 0; bid < count; ++bid) {
+            io_uring_buf &b = entries(br)[bid];
+            b.addr = reinterpret_cast<uint64_t>(br.storage.data() + static_cast<size_t>(bid) * size);
+            b.len  = size;
+            b.bid  = bid;
+        }
+        __atomic_store_n(&br.ring->tail, count, __ATOMIC_RELEASE);
+
+        rings_.push_back(std::move(br));
+        return true;
+    }
+
+    uint8_t *Uring::buffer(uint16_t bgid, uint16_t bid) noexcept {
+        BufferRing *br = ring(bgid);
+        return br->storage.data() + static_cast<size_t>(bid) * br->size;
+    }
+
+    void Uring::recycle(uint16_t bgid, uint16_t bid) noexcept {
+        BufferRing *br = ring(bgid);
+        const uint16_t tail = br->ring->tail;
+        io_uring_buf &b = entries(*br)[tail & br->mask];
+        b.addr = reinterpret_cast<uint64_t>(buffer(bgid, bid));
+        b.len  = br->size;
+        b.bid  = bid;
+        __atomic_store_n(&br->ring->tail, static_cast<uint16_t>(tail + 1), __ATOMIC_RELEASE);
+    }
+
+    bool Uring::registerBuffers(uint8_t *base, size_t len) noexcept {
+        iovec iov{ base, len };
+        if (sysRegister(fd_, IORING_REGISTER_BUFFERS, &iov, 1) < 0) {
+            // Without fixed buffers SEND_ZC has nothing to pin; fall back to copying sends.
+            zeroCopy_ = false;
+            return false;
+        }
+        fixedBase_ = base;
+        return true;
+    }
+
+    bool Uring::recvMultishot(Platform::socket_t s, uint16_t bgid, uint64_t tag) noexcept {
+        io_uring_sqe *sqe = nextSqe();
+        if (!sqe)
+            return false;
+
+        // The kernel copies this header at submission; only the name length matters,
+        // the buffer itself comes from the provided ring.
+        recvHdr_ = msghdr{};
+        recvHdr_.msg_namelen = sizeof(sockaddr_storage);
+
+        sqe->opcode    = IORING_OP_RECVMSG;
+        sqe->fd        = s;
+        sqe->addr      = reinterpret_cast<uint64_t>(&recvHdr_);
+        sqe->len       = 1;
+        sqe->ioprio    = IORING_RECV_MULTISHOT;
+        sqe->flags     = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = bgid;
+        sqe->user_data = tag;
+        return true;
+    }
+
+    bool Uring::pollReadable(int fd, uint64_t tag) noexcept {
+        io_uring_sqe *sqe = nextSqe();
+        if (!sqe)
+            return false;
+        sqe->opcode        = IORING_OP_POLL_ADD;
+        sqe->fd            = fd;
+        sqe->poll32_events = POLLIN;
+        sqe->user_data     = tag;
+        return true;
+    }
+
+    bool Uring::sendTo(Platform::socket_t s, const uint8_t *data, size_t len,
+                       const sockaddr_storage *to, uint64_t tag) noexcept {
+        io_uring_sqe *sqe = nextSqe();
+        if (!sqe)
+            return false;
+
+        sqe->fd        = s;
+        sqe->addr      = reinterpret_cast<uint64_t>(data);
+        sqe->len       = static_cast<uint32_t>(len);
+        sqe->addr2     = reinterpret_cast<uint64_t>(to);
+        sqe->addr_len  = static_cast<uint16_t>(Platform::addressLength(*to));
+        sqe->user_data = tag;
+        if (zeroCopy_ && fixedBase_) {
+            sqe->opcode    = IORING_OP_SEND_ZC;
+            sqe->ioprio    = IORING_RECVSEND_FIXED_BUF;
+            sqe->buf_index = 0;
+        } else {
+            sqe->opcode    = IORING_OP_SEND;
+        }
+        return true;
+    }
+
+    int Uring::submitAndWait(int timeout_ms) noexcept {
+        __atomic_store_n(sqTail_, sqLocalTail_, __ATOMIC_RELEASE);
+        // Anything between the kernel's head and our tail has not been consumed yet.
+        const unsigned toSubmit = sqLocalTail_ - __atomic_load_n(sqHead_, __ATOMIC_ACQUIRE);
+
+        __kernel_timespec ts{};
+        io_uring_getevents_arg arg{};
+        if (timeout_ms >= 0) {
+            ts.tv_sec  = timeout_ms / 1000;
+            ts.tv_nsec = static_cast<long long>(timeout_ms % 1000) * 1000000;
+            arg.ts     = reinterpret_cast<uint64_t>(&ts);
+        }
+
+        const int rc = sysEnter(fd_, toSubmit, 1, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG,
+                                &arg, sizeof(arg));
+        if (rc < 0) {
+            const int err = errno;
+            // ETIME just means the timeout fired; EINTR a signal. Either way nothing was lost,
+            // unconsumed SQEs are picked up by the next call.
+            if (err == ETIME || err == EINTR)
+                return 0;
+            return -err;
+        }
+        return rc;
+    }
+
+#else
+
+    Uring::~Uring() noexcept = default;
+    bool Uring::init(unsigned) noexcept { return false; }
+    bool Uring::addBufferRing(uint16_t, uint16_t, uint32_t) noexcept { return false; }
+    uint8_t *Uring::buffer(uint16_t, uint16_t) noexcept { return nullptr; }
+    void Uring::recycle(uint16_t, uint16_t) noexcept {}
+    bool Uring::registerBuffers(uint8_t *, size_t) noexcept { return false; }
+    bool Uring::recvMultishot(Platform::socket_t, uint16_t, uint64_t) noexcept { return false; }
+    bool Uring::pollReadable(int, uint64_t) noexcept { return false; }
+    bool Uring::sendTo(Platform::socket_t, const uint8_t *, size_t, const sockaddr_storage *, uint64_t) noexcept { return false; }
+    int  Uring::submitAndWait(int) noexcept { return -1; }
+
+#endif
+
+} // namespace DNS::Server